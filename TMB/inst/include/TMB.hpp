@@ -72,13 +72,18 @@ namespace CppAD{
 }
 #include "convert.hpp" // asSEXP, asMatrix, asVector
 #include "config.hpp"
+#include "stats.hpp"
 #include "atomic_math.hpp"
 #include "expm.hpp"
 #include "atomic_convolve.hpp"
 #include "Vectorize.hpp"
 #include "dnorm.hpp"   // harmless
 #include "lgamma.hpp"  // harmless
+#include "atomic_density.hpp"
+#include "atomic_sparse.hpp"
 #include "start_parallel.hpp"
+#include "mcmc.hpp"
+#include "osa.hpp"
 #include "tmb_core.hpp"
 #include "convenience.hpp"
 #include "distributions_R.hpp"
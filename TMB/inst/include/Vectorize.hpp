@@ -139,3 +139,51 @@ VECTORIZE1_t(log10)
 VECTORIZE1_t(sin)
 VECTORIZE1_t(sqrt)
 VECTORIZE2_tt(pow)
+
+/** \brief Vector valued atomic versions of elementwise math for AD types.
+
+    For AD types the vectorized functions below occupy a single node
+    on the tape regardless of the vector length (the generic
+    vectorization above records one node per element). The
+    overloads are selected over GVECTORIZE by partial ordering.
+*/
+#define VECTORIZE1_ATOMIC(FUN, ATOMIC)					\
+template<class T>							\
+vector<AD<T> > FUN(const vector<AD<T> > &x)				\
+{									\
+  int n = x.size();							\
+  if (n == 0) return x;							\
+  CppAD::vector<AD<T> > tx(n);						\
+  for (int i = 0; i < n; i++) tx[i] = x[i];				\
+  return vector<AD<T> >(atomic::ATOMIC(tx));				\
+}
+VECTORIZE1_ATOMIC(exp,  vexp)
+VECTORIZE1_ATOMIC(log,  vlog)
+VECTORIZE1_ATOMIC(sqrt, vsqrt)
+#undef VECTORIZE1_ATOMIC
+
+/** \brief Atomic elementwise power of two vectors of equal length. */
+template<class T>
+vector<AD<T> > pow(const vector<AD<T> > &x, const vector<AD<T> > &y)
+{
+  int n = x.size();
+  if (y.size() != n) error("pow: vector lengths differ");
+  if (n == 0) return x;
+  CppAD::vector<AD<T> > tx(2 * n);
+  for (int i = 0; i < n; i++) { tx[i] = x[i]; tx[n + i] = y[i]; }
+  return vector<AD<T> >(atomic::vpow(tx));
+}
+template<class T>
+vector<AD<T> > pow(const vector<AD<T> > &x, AD<T> y)
+{
+  vector<AD<T> > y_(x.size());
+  y_.fill(y);
+  return pow(x, y_);
+}
+template<class T>
+vector<AD<T> > pow(AD<T> x, const vector<AD<T> > &y)
+{
+  vector<AD<T> > x_(y.size());
+  x_.fill(x);
+  return pow(x_, y);
+}
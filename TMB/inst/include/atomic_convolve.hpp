@@ -3,11 +3,142 @@
 
 namespace atomic {
 
-/* Workhorse version (used while sweeping - pre-allocated output) */
+/** \brief Self-contained FFT used by convol2d for large inputs.
+
+    Radix-2 complex transforms with twiddle factors and bit reversal
+    tables computed once per length (cached per thread). The two real
+    inputs of a correlation are transformed together as the real and
+    imaginary part of a single complex array.
+*/
+namespace fft {
+typedef std::complex<double> cplx;
+
+/* Transform of length n (power of two) */
+struct plan_t {
+  size_t n;
+  std::vector<cplx> w;     /* exp(-2 pi i k / n), k < n / 2 */
+  std::vector<size_t> rev; /* Bit reversal permutation */
+  plan_t(size_t n_) : n(n_), w(n_ / 2), rev(n_, 0) {
+    for (size_t k = 0; k < n / 2; k++)
+      w[k] = std::polar(1.0, -2.0 * M_PI * k / n);
+    for (size_t i = 1; i < n; i++)
+      rev[i] = (rev[i >> 1] >> 1) | ((i & 1) ? n >> 1 : 0);
+  }
+  /* Unscaled in-place transform */
+  void operator()(cplx* x, bool inverse) const {
+    for (size_t i = 0; i < n; i++)
+      if (i < rev[i]) std::swap(x[i], x[rev[i]]);
+    for (size_t len = 2; len <= n; len <<= 1) {
+      size_t half = len / 2, step = n / len;
+      for (size_t i = 0; i < n; i += len) {
+        for (size_t k = 0; k < half; k++) {
+          cplx wk = (inverse ? std::conj(w[k * step]) : w[k * step]);
+          cplx t = wk * x[i + k + half];
+          x[i + k + half] = x[i + k] - t;
+          x[i + k] += t;
+        }
+      }
+    }
+  }
+};
+
+/* Plan for length n (most recently used plans kept per thread) */
+inline const plan_t& plan(size_t n) {
+  typedef std::vector<plan_t*> list_t;
+  static const size_t max_cached = 8;
+  static std::vector<list_t*> cache;
+  list_t* tcache;
+  size_t thread = 0;
+#ifdef _OPENMP
+  thread = omp_get_thread_num();
+#pragma omp critical (atomic_fft_plan)
+#endif
+  {
+    if (cache.size() <= thread) cache.resize(thread + 1, NULL);
+    if (cache[thread] == NULL) cache[thread] = new list_t();
+    tcache = cache[thread];
+  }
+  size_t i = 0;
+  while (i < tcache->size() && (*tcache)[i]->n != n) i++;
+  if (i == tcache->size()) {
+    if (tcache->size() >= max_cached) {
+      delete tcache->back();
+      tcache->pop_back();
+    }
+    tcache->insert(tcache->begin(), new plan_t(n));
+  } else {
+    std::rotate(tcache->begin(), tcache->begin() + i, tcache->begin() + i + 1);
+  }
+  return *(*tcache)[0];
+}
+
+inline size_t next_pow2(size_t n) {
+  size_t m = 1;
+  while (m < n) m <<= 1;
+  return m;
+}
+
+/* 2D transform of a column major m1 x m2 array */
+inline void fft2(std::vector<cplx>& z, size_t m1, size_t m2, bool inverse) {
+  const plan_t* p1 = &plan(m1);
+  for (size_t j = 0; j < m2; j++) (*p1)(&z[j * m1], inverse);
+  const plan_t* p2 = &plan(m2);
+  std::vector<cplx> row(m2);
+  for (size_t i = 0; i < m1; i++) {
+    for (size_t j = 0; j < m2; j++) row[j] = z[i + j * m1];
+    (*p2)(&row[0], inverse);
+    for (size_t j = 0; j < m2; j++) z[i + j * m1] = row[j];
+  }
+}
+
+/* Relative cost of the direct sum and the FFT (direct sum is used
+   when 'ny * nk < fft_threshold * m log2(m)' with m the padded size) */
+static const double fft_threshold = 10.;
+
+inline bool use_fft(int nx1, int nx2, int nk1, int nk2) {
+  double m = (double) next_pow2(nx1) * next_pow2(nx2);
+  double direct = (double) (nx1 - nk1 + 1) * (nx2 - nk2 + 1) * nk1 * nk2;
+  return direct > fft_threshold * m * log(m) / log(2.);
+}
+
+/* Valid correlation y(i,j) = sum_ab x(i+a,j+b) K(a,b). The circular
+   correlation of size m >= size(x) does not wrap on the valid part. */
+inline Eigen::MatrixXd correlate(const Eigen::MatrixXd& x,
+                                 const Eigen::MatrixXd& K) {
+  size_t m1 = next_pow2(x.rows()), m2 = next_pow2(x.cols());
+  std::vector<cplx> z(m1 * m2, cplx(0, 0));
+  for (int j = 0; j < x.cols(); j++)
+    for (int i = 0; i < x.rows(); i++) z[i + j * m1] = cplx(x(i, j), 0);
+  for (int j = 0; j < K.cols(); j++)
+    for (int i = 0; i < K.rows(); i++) z[i + j * m1] += cplx(0, K(i, j));
+  fft2(z, m1, m2, false);
+  /* Separate the transforms of x and K and multiply by conj(Khat) */
+  std::vector<cplx> p(m1 * m2);
+  for (size_t k2 = 0; k2 < m2; k2++) {
+    for (size_t k1 = 0; k1 < m1; k1++) {
+      size_t n1 = (m1 - k1) % m1, n2 = (m2 - k2) % m2;
+      cplx zk = z[k1 + k2 * m1], zn = std::conj(z[n1 + n2 * m1]);
+      cplx xh = 0.5 * (zk + zn);
+      cplx kh = cplx(0, -0.5) * (zk - zn);
+      p[k1 + k2 * m1] = xh * std::conj(kh);
+    }
+  }
+  fft2(p, m1, m2, true);
+  Eigen::MatrixXd y(x.rows() - K.rows() + 1, x.cols() - K.cols() + 1);
+  double scale = 1. / ((double) m1 * m2);
+  for (int j = 0; j < y.cols(); j++)
+    for (int i = 0; i < y.rows(); i++) y(i, j) = p[i + j * m1].real() * scale;
+  return y;
+}
+} // End namespace fft
+
+/* Workhorse version (used while sweeping - pre-allocated output).
+   Large problems are computed by FFT. */
 Eigen::MatrixXd convol2d_work(const Eigen::MatrixXd& x,
                               const Eigen::MatrixXd& K) CSKIP({
   int kr = K.rows();
   int kc = K.cols();
+  if (fft::use_fft(x.rows(), x.cols(), kr, kc)) return fft::correlate(x, K);
   Eigen::MatrixXd y(x.rows() - kr + 1, x.cols() - kc + 1);
   for (int i = 0; i < y.rows(); i++)
     for (int j = 0; j < y.cols(); j++)
@@ -21,7 +152,28 @@ matrix<typename DerivedA::Scalar>
 convol2d(const Eigen::MatrixBase<DerivedA>& x,
          const Eigen::MatrixBase<DerivedB>& K);
 
-TMB_ATOMIC_VECTOR_FUNCTION(
+/* Sparsity: entry (i,j) of the result depends on the kernel and the
+   block of x starting at (i,j) */
+struct convol2d_pattern {
+  template<class T>
+  static void signature(const CppAD::vector<T>& tx, std::vector<int>& sig) {
+    sig.resize(4);
+    for (int i = 0; i < 4; i++) sig[i] = CppAD::Integer(tx[i]);
+  }
+  static void inputs(const std::vector<int>& sig, size_t i,
+                     std::vector<size_t>& in) {
+    size_t nx1 = sig[0], nx2 = sig[1], nk1 = sig[2], nk2 = sig[3];
+    size_t ny1 = nx1 - nk1 + 1;
+    size_t row = i % ny1, col = i / ny1;
+    in.resize(0);
+    for (size_t b = 0; b < nk2; b++)
+      for (size_t a = 0; a < nk1; a++)
+        in.push_back(4 + (row + a) + nx1 * (col + b));
+    for (size_t k = 0; k < nk1 * nk2; k++) in.push_back(4 + nx1 * nx2 + k);
+  }
+};
+
+TMB_ATOMIC_VECTOR_FUNCTION_SPARSE(
     // ATOMIC_NAME
     convol2d,
     // OUTPUT_DIM
@@ -59,6 +211,9 @@ TMB_ATOMIC_VECTOR_FUNCTION(
     P0.setZero();
     PX = convol2d(Wexpand, Kflip);
     PK = convol2d(      X,     W);
+    ,
+    // SPARSITY
+    signature_sparsity<convol2d_pattern>
 )
 
 /* Implementation of the forward declared version */
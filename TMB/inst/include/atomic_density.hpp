@@ -0,0 +1,1094 @@
+// License: GPL-2
+
+/** \file
+    \brief Fused atomic log densities of independent observations.
+
+    A call like dpois_sum(x, lambda) is equivalent to
+    dpois(x, lambda, true).sum() but occupies one node on the tape
+    regardless of the number of observations. Derivatives are hand
+    coded:
+
+    - The gradient is a second atomic (one tape node).
+    - The reverse mode of the gradient uses the Hessian blocks of the
+      individual observations written out with ordinary operators.
+      Those are only recorded on the Hessian tape.
+
+    Parameters are either vectors of the same length as the data or
+    scalars (vectors of length one are recycled).
+
+    mvnorm_sum is the analogue for multivariate normal observations
+    with a common covariance matrix (see MVNORM_sum).
+
+    hmm_forward is the log likelihood of a hidden Markov model (see
+    dhmm) evaluated by the scaled forward algorithm. Its gradient is
+    obtained by the scaled backward recursion. Only the inputs
+    (initial distribution, transition matrices and emission log
+    densities) are stored on the tape.
+
+    kalman_filter is the log likelihood of a linear Gaussian state
+    space model evaluated by a square root Kalman filter. Its gradient
+    is obtained by reverse accumulation through the covariance filter.
+*/
+
+namespace atomic {
+namespace fused {
+
+/* Derivatives of the log gamma function */
+inline double D_lgamma(double x, double k) {
+  return Rmath::D_lgamma(x, k);
+}
+template<class Type>
+Type D_lgamma(const Type &x, double k) {
+  CppAD::vector<Type> tx(2);
+  tx[0] = x;
+  tx[1] = Type(k);
+  return atomic::D_lgamma(tx)[0];
+}
+
+/** \brief Kernels of the fused densities.
+
+    Each kernel has NARG arguments per observation (the observation
+    first) and a member
+
+    Type eval(const Type* a, Type* g, Type* H)
+
+    returning the log density of a single observation. If 'g' is not
+    NULL the gradient (NARG) is stored in 'g'. If 'H' is not NULL
+    (requires 'g') the Hessian (NARG x NARG column major) is stored in
+    'H'.
+*/
+struct dnorm_t {
+  static const int NARG = 3;
+  template<class Type>
+  static Type eval(const Type* a, Type* g, Type* H) {
+    Type sd = a[2];
+    Type r = (a[0] - a[1]) / sd;
+    Type f = -log(Type(sqrt(2 * M_PI)) * sd) - Type(.5) * r * r;
+    if (g != NULL) {
+      g[0] = -r / sd;
+      g[1] = r / sd;
+      g[2] = (r * r - Type(1)) / sd;
+    }
+    if (H != NULL) {
+      Type isd2 = Type(1) / (sd * sd);
+      H[0] = -isd2;                  H[3] = isd2;           H[6] = Type(2) * r * isd2;
+      H[1] = H[3];                   H[4] = -isd2;          H[7] = -Type(2) * r * isd2;
+      H[2] = H[6];                   H[5] = H[7];           H[8] = (Type(1) - Type(3) * r * r) * isd2;
+    }
+    return f;
+  }
+};
+
+struct dpois_t {
+  static const int NARG = 2;
+  template<class Type>
+  static Type eval(const Type* a, Type* g, Type* H) {
+    Type x = a[0], lambda = a[1];
+    Type loglambda = log(lambda);
+    Type f = -lambda + x * loglambda - D_lgamma(x + Type(1), 0);
+    if (g != NULL) {
+      g[0] = loglambda - D_lgamma(x + Type(1), 1);
+      g[1] = x / lambda - Type(1);
+    }
+    if (H != NULL) {
+      H[0] = -D_lgamma(x + Type(1), 2);
+      H[1] = Type(1) / lambda;
+      H[2] = H[1];
+      H[3] = -x / (lambda * lambda);
+    }
+    return f;
+  }
+};
+
+struct dgamma_t {
+  static const int NARG = 3;
+  template<class Type>
+  static Type eval(const Type* a, Type* g, Type* H) {
+    Type y = a[0], shape = a[1], scale = a[2];
+    Type logy = log(y), logscale = log(scale);
+    Type f = -D_lgamma(shape, 0) + (shape - Type(1)) * logy - y / scale -
+      shape * logscale;
+    if (g != NULL) {
+      g[0] = (shape - Type(1)) / y - Type(1) / scale;
+      g[1] = -D_lgamma(shape, 1) + logy - logscale;
+      g[2] = y / (scale * scale) - shape / scale;
+    }
+    if (H != NULL) {
+      H[0] = -(shape - Type(1)) / (y * y);
+      H[1] = Type(1) / y;
+      H[2] = Type(1) / (scale * scale);
+      H[4] = -D_lgamma(shape, 2);
+      H[5] = -Type(1) / scale;
+      H[8] = -Type(2) * y / (scale * scale * scale) + shape / (scale * scale);
+      H[3] = H[1]; H[6] = H[2]; H[7] = H[5];
+    }
+    return f;
+  }
+};
+
+struct dnbinom_t {
+  static const int NARG = 3;
+  template<class Type>
+  static Type eval(const Type* a, Type* g, Type* H) {
+    Type x = a[0], n = a[1], p = a[2];
+    Type f = D_lgamma(x + n, 0) - D_lgamma(n, 0) - D_lgamma(x + Type(1), 0) +
+      n * log(p) + x * log(Type(1) - p);
+    if (g != NULL) {
+      Type psi = D_lgamma(x + n, 1);
+      g[0] = psi - D_lgamma(x + Type(1), 1) + log(Type(1) - p);
+      g[1] = psi - D_lgamma(n, 1) + log(p);
+      g[2] = n / p - x / (Type(1) - p);
+    }
+    if (H != NULL) {
+      Type psi1 = D_lgamma(x + n, 2);
+      H[0] = psi1 - D_lgamma(x + Type(1), 2);
+      H[1] = psi1;
+      H[2] = -Type(1) / (Type(1) - p);
+      H[4] = psi1 - D_lgamma(n, 2);
+      H[5] = Type(1) / p;
+      H[8] = -n / (p * p) - x / ((Type(1) - p) * (Type(1) - p));
+      H[3] = H[1]; H[6] = H[2]; H[7] = H[5];
+    }
+    return f;
+  }
+};
+
+/* dnbinom with (size, prob) = (mu^2 / (var - mu), mu / var) */
+struct dnbinom2_t {
+  static const int NARG = 3;
+  template<class Type>
+  static Type eval(const Type* a, Type* g, Type* H) {
+    Type mu = a[1], var = a[2];
+    Type d = var - mu;
+    Type b[3] = {a[0], mu * mu / d, mu / var};
+    Type gb[3], Hb[9];
+    Type f = dnbinom_t::eval(b, (g != NULL ? gb : NULL), (H != NULL ? Hb : NULL));
+    if (g == NULL) return f;
+    /* Jacobian of (x, size, prob) wrt. (x, mu, var) (column major) */
+    Type J[9] = {Type(1), Type(0), Type(0),
+                 Type(0), mu * (Type(2) * var - mu) / (d * d), Type(1) / var,
+                 Type(0), -mu * mu / (d * d), -mu / (var * var)};
+    for (int j = 0; j < 3; j++) {
+      g[j] = Type(0);
+      for (int k = 0; k < 3; k++) g[j] += gb[k] * J[k + 3 * j];
+    }
+    if (H != NULL) {
+      /* J' Hb J */
+      for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+          Type s = Type(0);
+          for (int k = 0; k < 3; k++)
+            for (int l = 0; l < 3; l++)
+              s += J[k + 3 * i] * Hb[k + 3 * l] * J[l + 3 * j];
+          H[i + 3 * j] = s;
+        }
+      }
+      /* Second derivatives of size and prob wrt. (mu, var) */
+      Type d3 = d * d * d;
+      Type size_mm = Type(2) * var * var / d3;
+      Type size_mv = -Type(2) * mu * var / d3;
+      Type size_vv = Type(2) * mu * mu / d3;
+      Type prob_mv = -Type(1) / (var * var);
+      Type prob_vv = Type(2) * mu / (var * var * var);
+      H[4] += gb[1] * size_mm;
+      H[7] += gb[1] * size_mv + gb[2] * prob_mv;
+      H[5] = H[7];
+      H[8] += gb[1] * size_vv + gb[2] * prob_vv;
+    }
+    return f;
+  }
+};
+
+/** \brief Zero inflated version of a kernel. The zero inflation
+    probability is appended to the arguments of the kernel. */
+template<class Kernel>
+struct zeroinflated_t {
+  static const int NARG = Kernel::NARG + 1;
+  template<class Type>
+  static Type eval(const Type* a, Type* g, Type* H) {
+    const int nb = Kernel::NARG;
+    const int N = NARG;
+    Type zip = a[nb];
+    Type gb[nb], Hb[nb * nb];
+    Type lb = Kernel::eval(a, (g != NULL ? gb : NULL), (H != NULL ? Hb : NULL));
+    if (a[0] == Type(0)) {
+      Type P = exp(lb);
+      Type D = zip + (Type(1) - zip) * P;
+      if (g != NULL) {
+        Type w = (Type(1) - zip) * P / D;
+        for (int i = 0; i < nb; i++) g[i] = w * gb[i];
+        g[nb] = (Type(1) - P) / D;
+        if (H != NULL) {
+          for (int i = 0; i < nb; i++) {
+            for (int j = 0; j < nb; j++)
+              H[i + N * j] = w * Hb[i + nb * j] + w * (Type(1) - w) * gb[i] * gb[j];
+            H[i + N * nb] = -P / (D * D) * gb[i];
+            H[nb + N * i] = H[i + N * nb];
+          }
+          H[nb + N * nb] = -(Type(1) - P) * (Type(1) - P) / (D * D);
+        }
+      }
+      return log(D);
+    } else {
+      if (g != NULL) {
+        for (int i = 0; i < nb; i++) g[i] = gb[i];
+        g[nb] = -Type(1) / (Type(1) - zip);
+        if (H != NULL) {
+          for (int i = 0; i < nb; i++) {
+            for (int j = 0; j < nb; j++) H[i + N * j] = Hb[i + nb * j];
+            H[i + N * nb] = Type(0);
+            H[nb + N * i] = Type(0);
+          }
+          H[nb + N * nb] = -Type(1) / ((Type(1) - zip) * (Type(1) - zip));
+        }
+      }
+      return log(Type(1) - zip) + lb;
+    }
+  }
+};
+typedef zeroinflated_t<dpois_t> dzipois_t;
+typedef zeroinflated_t<dnbinom_t> dzinbinom_t;
+typedef zeroinflated_t<dnbinom2_t> dzinbinom2_t;
+
+/* Input of the atomics is NARG stacked vectors of length n */
+
+/* Sum of log densities */
+template<class Kernel>
+double value(const CppAD::vector<double> &tx) {
+  const int N = Kernel::NARG;
+  size_t n = tx.size() / N;
+  double a[N];
+  double ans = 0;
+  for (size_t i = 0; i < n; i++) {
+    for (int k = 0; k < N; k++) a[k] = tx[k * n + i];
+    ans += Kernel::eval(a, (double*) NULL, (double*) NULL);
+  }
+  return ans;
+}
+
+/* Gradient of sum of log densities */
+template<class Kernel>
+void gradient(const CppAD::vector<double> &tx, CppAD::vector<double> &ty) {
+  const int N = Kernel::NARG;
+  size_t n = tx.size() / N;
+  double a[N], g[N];
+  for (size_t i = 0; i < n; i++) {
+    for (int k = 0; k < N; k++) a[k] = tx[k * n + i];
+    Kernel::eval(a, g, (double*) NULL);
+    for (int k = 0; k < N; k++) ty[k * n + i] = g[k];
+  }
+}
+
+/* Hessian (block diagonal) times 'py' */
+template<class Kernel, class Type>
+void hessian_times(const CppAD::vector<Type> &tx,
+                   const CppAD::vector<Type> &py,
+                   CppAD::vector<Type> &px) {
+  const int N = Kernel::NARG;
+  size_t n = tx.size() / N;
+  Type a[N], g[N], H[N * N];
+  for (size_t i = 0; i < n; i++) {
+    for (int k = 0; k < N; k++) a[k] = tx[k * n + i];
+    Kernel::eval(a, g, H);
+    for (int k = 0; k < N; k++) {
+      Type s = Type(0);
+      for (int l = 0; l < N; l++) s += H[k + N * l] * py[l * n + i];
+      px[k * n + i] = s;
+    }
+  }
+}
+
+}  // End namespace fused
+
+/* Value and gradient atomics of a kernel */
+#define TMB_FUSED_DENSITY(NAME, KERNEL)                                 \
+TMB_ATOMIC_VECTOR_FUNCTION_SPARSE(                                      \
+  NAME##_grad                                                           \
+  ,                                                                     \
+  tx.size()                                                             \
+  ,                                                                     \
+  fused::gradient<fused::KERNEL>(tx, ty);                               \
+  ,                                                                     \
+  fused::hessian_times<fused::KERNEL>(tx, py, px);                      \
+  ,                                                                     \
+  stacked_sparsity<fused::KERNEL::NARG>                                 \
+  )                                                                     \
+TMB_ATOMIC_VECTOR_FUNCTION_SPARSE(                                      \
+  NAME                                                                  \
+  ,                                                                     \
+  1                                                                     \
+  ,                                                                     \
+  ty[0] = fused::value<fused::KERNEL>(tx);                              \
+  ,                                                                     \
+  CppAD::vector<Type> g = NAME##_grad(tx);                              \
+  for (size_t i = 0; i < tx.size(); i++) px[i] = g[i] * py[0];          \
+  ,                                                                     \
+  stacked_sum_sparsity<fused::KERNEL::NARG>                             \
+  )
+
+TMB_FUSED_DENSITY(fused_dnorm, dnorm_t)
+TMB_FUSED_DENSITY(fused_dpois, dpois_t)
+TMB_FUSED_DENSITY(fused_dgamma, dgamma_t)
+TMB_FUSED_DENSITY(fused_dnbinom, dnbinom_t)
+TMB_FUSED_DENSITY(fused_dnbinom2, dnbinom2_t)
+TMB_FUSED_DENSITY(fused_dzipois, dzipois_t)
+TMB_FUSED_DENSITY(fused_dzinbinom, dzinbinom_t)
+TMB_FUSED_DENSITY(fused_dzinbinom2, dzinbinom2_t)
+
+#undef TMB_FUSED_DENSITY
+
+namespace fused {
+/** \brief Argument of the fused densities: a vector or a scalar.
+    (The second template parameter prevents the generic conversion
+    operator of 'vector' from competing with the constructors.) */
+template<class Type, class Dummy = void>
+struct arg {
+  typedef arg type;
+  vector<Type> x;
+  arg(const vector<Type> &x_) : x(x_) {}
+  template<class Derived>
+  arg(const Eigen::ArrayBase<Derived> &x_) : x(x_) {}
+  arg(const Type &x_) : x(1) { x[0] = x_; }
+  Type operator()(int i) const { return (x.size() == 1 ? x[0] : x[i]); }
+};
+/* Stack the data and the parameters (NULL terminated) */
+template<class Type>
+CppAD::vector<Type> stack(const vector<Type> &x, const arg<Type>* p1,
+                          const arg<Type>* p2 = NULL,
+                          const arg<Type>* p3 = NULL) {
+  const arg<Type>* p[3] = {p1, p2, p3};
+  int n = x.size();
+  int narg = 1;
+  while (narg <= 3 && p[narg - 1] != NULL) narg++;
+  CppAD::vector<Type> tx(narg * n);
+  for (int i = 0; i < n; i++) tx[i] = x[i];
+  for (int k = 1; k < narg; k++) {
+    if (p[k - 1]->x.size() != 1 && p[k - 1]->x.size() != n)
+      error("Parameter length must be one or equal to the data length");
+    for (int i = 0; i < n; i++) tx[k * n + i] = (*p[k - 1])(i);
+  }
+  return tx;
+}
+}  // End namespace fused
+
+namespace mvnorm {
+/** \brief Cholesky factor of a covariance matrix */
+struct factor_t {
+  std::vector<double> Sigma;
+  Eigen::LLT<Eigen::MatrixXd> llt;
+  double logdet;                 /* log|Sigma| (NaN if not positive definite) */
+  Eigen::MatrixXd Q;             /* Inverse (computed on demand) */
+  bool Q_ok;
+  bool match(const double* S, int p) const {
+    return (int) Sigma.size() == p * p && std::equal(Sigma.begin(), Sigma.end(), S);
+  }
+  void factorize(const double* S, int p) {
+    Sigma.assign(S, S + p * p);
+    llt.compute(Eigen::Map<const Eigen::MatrixXd>(S, p, p));
+    if (llt.info() == Eigen::Success)
+      logdet = 2. * llt.matrixLLT().diagonal().array().log().sum();
+    else
+      logdet = R_NaN;
+    Q_ok = false;
+  }
+  const Eigen::MatrixXd& inverse() {
+    if (!Q_ok) {
+      int p = llt.rows();
+      Q = llt.solve(Eigen::MatrixXd::Identity(p, p));
+      Q_ok = true;
+    }
+    return Q;
+  }
+};
+
+/** \brief Factor of the covariance matrix in tx = [p, Sigma, X].
+    The last few distinct covariance matrices are cached per thread,
+    so repeated evaluations with the same covariance share the
+    factorization. */
+inline factor_t& factor(const CppAD::vector<double>& tx) {
+  typedef std::vector<factor_t*> list_t;
+  static const size_t max_cached = 8;
+  static std::vector<list_t*> cache;
+  list_t* tcache;
+  size_t thread = 0;
+#ifdef _OPENMP
+  thread = omp_get_thread_num();
+#pragma omp critical (atomic_mvnorm_factor)
+#endif
+  {
+    if (cache.size() <= thread) cache.resize(thread + 1, NULL);
+    if (cache[thread] == NULL) cache[thread] = new list_t();
+    tcache = cache[thread];
+  }
+  int p = CppAD::Integer(tx[0]);
+  const double* S = &tx[1];
+  /* Most recently used first */
+  size_t i = 0;
+  while (i < tcache->size() && !(*tcache)[i]->match(S, p)) i++;
+  if (i == tcache->size()) {
+    if (tcache->size() >= max_cached) {
+      delete tcache->back();
+      tcache->pop_back();
+    }
+    factor_t* F = new factor_t();
+    F->factorize(S, p);
+    tcache->insert(tcache->begin(), F);
+  } else {
+    std::rotate(tcache->begin(), tcache->begin() + i, tcache->begin() + i + 1);
+  }
+  return *(*tcache)[0];
+}
+
+/* Sum of negative log densities of the columns of X (zero if p=0:
+   the number of columns cannot be recovered then, and each density
+   of a zero dimensional vector is one) */
+inline double value(const CppAD::vector<double>& tx) {
+  int p = CppAD::Integer(tx[0]);
+  if (p == 0) return 0;
+  int m = (tx.size() - 1 - p * p) / p;
+  factor_t& F = factor(tx);
+  if (ISNAN(F.logdet)) return R_NaN;
+  /* Batched triangular solve L^-1 X */
+  Eigen::MatrixXd Y =
+    Eigen::Map<const Eigen::MatrixXd>(&tx[1 + p * p], p, m);
+  F.llt.matrixL().solveInPlace(Y);
+  return .5 * Y.squaredNorm() + m * (.5 * F.logdet + p * log(sqrt(2. * M_PI)));
+}
+
+/* Gradient times w: d/dSigma = w*(m*Q - Z*Z')/2 and d/dX = w*Z with
+   Z = Q*X. */
+inline void gradient(const CppAD::vector<double>& tx, double w,
+                     CppAD::vector<double>& px) {
+  int p = CppAD::Integer(tx[0]);
+  if (p == 0) {
+    px[0] = 0;
+    return;
+  }
+  int m = (tx.size() - 1 - p * p) / p;
+  factor_t& F = factor(tx);
+  Eigen::MatrixXd Z =
+    F.llt.solve(Eigen::Map<const Eigen::MatrixXd>(&tx[1 + p * p], p, m));
+  Eigen::MatrixXd G = (.5 * w) * (m * F.inverse() - Z * Z.transpose());
+  px[0] = 0;
+  for (int i = 0; i < p * p; i++) px[1 + i] = G(i);
+  for (int i = 0; i < p * m; i++) px[1 + p * p + i] = w * Z(i);
+}
+template<class Type>
+void gradient(const CppAD::vector<Type>& tx, Type w,
+              CppAD::vector<Type>& px) {
+  int p = CppAD::Integer(tx[0]);
+  if (p == 0) {
+    px[0] = Type(0);
+    return;
+  }
+  int m = (tx.size() - 1 - p * p) / p;
+  matrix<Type> Sigma = vec2mat(tx, p, p, 1);
+  matrix<Type> X = vec2mat(tx, p, m, 1 + p * p);
+  Type logdet;
+  matrix<Type> Q = matinvpd(Sigma, logdet);
+  matrix<Type> Z = matmul(Q, X);
+  matrix<Type> Zt = Z.transpose();
+  matrix<Type> G = (Type(.5) * w) * (Type(m) * Q - matmul(Z, Zt));
+  px[0] = Type(0);
+  for (int i = 0; i < p * p; i++) px[1 + i] = G(i);
+  for (int i = 0; i < p * m; i++) px[1 + p * p + i] = w * Z(i);
+}
+}  // End namespace mvnorm
+
+/** \brief Atomic sum of multivariate normal negative log densities
+    with common covariance matrix (see MVNORM_sum).
+    \param x Input vector [p, Sigma (p*p), X (p*m)].
+    \return Vector of length 1.
+*/
+TMB_ATOMIC_VECTOR_FUNCTION(
+			   // ATOMIC_NAME
+			   mvnorm_sum
+			   ,
+			   // OUTPUT_DIM
+			   1
+			   ,
+			   // ATOMIC_DOUBLE
+			   ty[0] = mvnorm::value(tx);
+			   ,
+			   // ATOMIC_REVERSE
+			   mvnorm::gradient(tx, py[0], px);
+			   )
+
+namespace hmm {
+/** \brief Layout of tx = [m, T, K, idx (T-1), delta (m), Gamma (K*m*m),
+    L (m*T)]: m states, T time points, K transition matrices (column
+    major) with Gamma[idx[t-1]] used into time t, and emission log
+    densities L (state x time). */
+struct dim_t {
+  int m, T, K;
+  size_t D, G, L;  /* Offsets of delta, Gamma and L */
+  template<class Type>
+  dim_t(const CppAD::vector<Type>& tx) {
+    m = CppAD::Integer(tx[0]);
+    T = CppAD::Integer(tx[1]);
+    K = CppAD::Integer(tx[2]);
+    D = 3 + std::max(T - 1, 0);
+    G = D + m;
+    L = G + K * m * m;
+  }
+  /* Offset of the transition matrix into time t (t >= 1) */
+  template<class Type>
+  size_t Gamma(const CppAD::vector<Type>& tx, int t) const {
+    return G + CppAD::Integer(tx[2 + t]) * m * m;
+  }
+};
+
+/* Maximum (the shift of the log densities does not affect the
+   result, so it is safe to branch on it) */
+inline double maxc(double a, double b) { return std::max(a, b); }
+template<class Type>
+Type maxc(const Type& a, const Type& b) { return CppAD::CondExpGt(a, b, a, b); }
+
+/* Log likelihood by the scaled forward algorithm */
+inline double value(const CppAD::vector<double>& tx) {
+  typedef Eigen::Map<const Eigen::MatrixXd> map_t;
+  dim_t d(tx);
+  int m = d.m;
+  Eigen::VectorXd phi = map_t(&tx[d.D], m, 1);
+  double ll = 0;
+  for (int t = 0; t < d.T; t++) {
+    map_t l(&tx[d.L + t * m], m, 1);
+    if (t > 0) phi = map_t(&tx[d.Gamma(tx, t)], m, m).transpose() * phi;
+    double c = l.maxCoeff();
+    phi.array() *= (l.array() - c).exp();
+    double u = phi.sum();
+    phi /= u;
+    ll += log(u) + c;
+  }
+  return ll;
+}
+
+/* Gradient times w by the scaled backward recursion
+   \f$\beta_{t-1} = \Gamma_t r_t\f$ with
+   \f$r_t = e_t \beta_t / u_t\f$, where \f$e_t\f$ are the shifted
+   emission densities and \f$u_t\f$ the scaling constants: d/dL is
+   \f$\phi_t \beta_t\f$ (smoothing probabilities), d/dGamma_t is
+   \f$\phi_{t-1} r_t'\f$ and d/ddelta is \f$r_0\f$. Written with
+   ordinary operators so that all orders are available. */
+template<class Type>
+void gradient(const CppAD::vector<Type>& tx, Type w,
+              CppAD::vector<Type>& px) {
+  typedef Eigen::Matrix<Type, Eigen::Dynamic, Eigen::Dynamic> mat_t;
+  typedef Eigen::Matrix<Type, Eigen::Dynamic, 1> vec_t;
+  typedef Eigen::Map<const mat_t> map_t;
+  dim_t d(tx);
+  int m = d.m;
+  int T = d.T;
+  for (size_t i = 0; i < px.size(); i++) px[i] = Type(0);
+  /* Forward sweep */
+  mat_t phi(m, T), e(m, T);
+  vec_t u(T);
+  for (int t = 0; t < T; t++) {
+    const Type* l = &tx[d.L + t * m];
+    Type c = l[0];
+    for (int i = 1; i < m; i++) c = maxc(l[i], c);
+    for (int i = 0; i < m; i++) e(i, t) = exp(l[i] - c);
+    vec_t a = (t == 0 ?
+               vec_t(map_t(&tx[d.D], m, 1)) :
+               vec_t(map_t(&tx[d.Gamma(tx, t)], m, m).transpose() * phi.col(t - 1)));
+    a = a.cwiseProduct(e.col(t));
+    u[t] = a.sum();
+    phi.col(t) = a / u[t];
+  }
+  /* Backward sweep */
+  vec_t beta = vec_t::Constant(m, Type(1));
+  for (int t = T - 1; t >= 0; t--) {
+    for (int i = 0; i < m; i++) px[d.L + t * m + i] = w * phi(i, t) * beta[i];
+    vec_t r = e.col(t).cwiseProduct(beta) / u[t];
+    if (t == 0) {
+      for (int i = 0; i < m; i++) px[d.D + i] = w * r[i];
+    } else {
+      size_t G = d.Gamma(tx, t);
+      mat_t dG = (w * phi.col(t - 1)) * r.transpose();
+      for (int i = 0; i < m * m; i++) px[G + i] += dG(i);
+      beta = map_t(&tx[G], m, m) * r;
+    }
+  }
+}
+}  // End namespace hmm
+
+/** \brief Atomic log likelihood of a hidden Markov model (see dhmm).
+    \param x Input vector [m, T, K, idx, delta, Gamma, L] (see
+    hmm::dim_t).
+    \return Vector of length 1.
+*/
+TMB_ATOMIC_VECTOR_FUNCTION(
+			   // ATOMIC_NAME
+			   hmm_forward
+			   ,
+			   // OUTPUT_DIM
+			   1
+			   ,
+			   // ATOMIC_DOUBLE
+			   ty[0] = hmm::value(tx);
+			   ,
+			   // ATOMIC_REVERSE
+			   hmm::gradient(tx, py[0], px);
+			   )
+
+namespace kalman {
+/** \brief Layout of tx = [n, p, T, m0 (n), P0 (n*n), F (n*n), Q (n*n),
+    H (p*n), R (p*p), Y (p*T)] (matrices column major): n states, p
+    observations per time point and T time points. Time t is
+    unobserved if y_t contains NaN. */
+struct dim_t {
+  int n, p, T;
+  size_t m0, P0, F, Q, H, R, Y;  /* Offsets */
+  template<class Type>
+  dim_t(const CppAD::vector<Type>& tx) {
+    n = CppAD::Integer(tx[0]);
+    p = CppAD::Integer(tx[1]);
+    T = CppAD::Integer(tx[2]);
+    m0 = 3;
+    P0 = m0 + n;
+    F = P0 + n * n;
+    Q = F + n * n;
+    H = Q + n * n;
+    R = H + p * n;
+    Y = R + p * p;
+  }
+  template<class Type>
+  bool observed(const CppAD::vector<Type>& tx, int t) const {
+    for (int i = 0; i < p; i++)
+      if (ISNAN(asDouble(tx[Y + t * p + i]))) return false;
+    return true;
+  }
+};
+
+/* Square root factor L with LL' = S of a positive semi-definite
+   matrix by the pivoted LDL' decomposition (NaN if S is indefinite
+   beyond rounding errors). */
+inline Eigen::MatrixXd factor(const Eigen::MatrixXd& S) {
+  Eigen::LDLT<Eigen::MatrixXd> ldlt(S);
+  Eigen::VectorXd D = ldlt.vectorD();
+  double eps = 1e-12 * D.cwiseAbs().maxCoeff();
+  if (ldlt.info() != Eigen::Success || !(D.minCoeff() >= -eps))
+    return Eigen::MatrixXd::Constant(S.rows(), S.cols(), R_NaN);
+  D = D.cwiseMax(0).cwiseSqrt();
+  Eigen::MatrixXd L = ldlt.matrixL();
+  L = L * D.asDiagonal();
+  return ldlt.transpositionsP().transpose() * L;
+}
+
+/** \brief Log likelihood by the square root covariance filter.
+
+    With \f$P = SS'\f$ the prediction triangularizes
+    \f$[FS,\; L_Q]\f$ and the update triangularizes the array
+    \f[ \begin{pmatrix} L_R & HS \\ 0 & S \end{pmatrix} =
+        \begin{pmatrix} S_e & 0 \\ \bar K & S^+ \end{pmatrix} \Theta \f]
+    (Householder QR of the transpose), giving the Cholesky factor
+    \f$S_e\f$ of the innovation covariance, the gain
+    \f$\bar K S_e^{-1}\f$ and the updated factor \f$S^+\f$. The
+    covariance is never formed, so it stays positive semi-definite.
+    The factors of \f$P_0\f$, Q and R need not be triangular, so
+    singular matrices are factored by the pivoted LDL' decomposition.
+*/
+inline double value(const CppAD::vector<double>& tx) {
+  typedef Eigen::Map<const Eigen::MatrixXd> map_t;
+  dim_t d(tx);
+  int n = d.n;
+  int p = d.p;
+  map_t F(&tx[d.F], n, n), H(&tx[d.H], p, n);
+  Eigen::MatrixXd S = factor(map_t(&tx[d.P0], n, n));
+  Eigen::MatrixXd LQ = factor(map_t(&tx[d.Q], n, n));
+  Eigen::MatrixXd LR = factor(map_t(&tx[d.R], p, p));
+  Eigen::VectorXd x = map_t(&tx[d.m0], n, 1);
+  Eigen::MatrixXd B(2 * n, n), M(p + n, p + n);
+  double ll = 0;
+  for (int t = 0; t < d.T; t++) {
+    if (t > 0) {
+      x = F * x;
+      B.topRows(n) = (F * S).transpose();
+      B.bottomRows(n) = LQ.transpose();
+      Eigen::HouseholderQR<Eigen::MatrixXd> qr(B);
+      S = qr.matrixQR().topRows(n).triangularView<Eigen::Upper>().transpose();
+    }
+    if (!d.observed(tx, t)) continue;
+    M.setZero();
+    M.topLeftCorner(p, p) = LR.transpose();
+    M.bottomLeftCorner(n, p) = (H * S).transpose();
+    M.bottomRightCorner(n, n) = S.transpose();
+    Eigen::HouseholderQR<Eigen::MatrixXd> qr(M);
+    Eigen::MatrixXd L = qr.matrixQR().triangularView<Eigen::Upper>().transpose();
+    Eigen::MatrixXd Se = L.topLeftCorner(p, p);
+    Eigen::VectorXd z = map_t(&tx[d.Y + t * p], p, 1) - H * x;
+    Se.triangularView<Eigen::Lower>().solveInPlace(z);
+    x += L.bottomLeftCorner(n, p) * z;
+    S = L.bottomRightCorner(n, n);
+    ll -= Se.diagonal().array().abs().log().sum() + .5 * z.squaredNorm()
+      + p * log(sqrt(2. * M_PI));
+  }
+  return ll;
+}
+
+/** \brief Covariance filter and Rauch-Tung-Striebel smoother. Used
+    for reporting (kalman_smoother). Requires positive definite
+    predicted covariances. */
+template<class Type>
+struct smoother_t {
+  dim_t d;
+  matrix<Type> F, Q, H, R;
+  vector<matrix<Type> > Pp, Ps;  /* Predicted and smoothed covariances */
+  vector<matrix<Type> > J;       /* Smoother gains */
+  matrix<Type> mp, ms;           /* Predicted and smoothed means */
+  smoother_t(const CppAD::vector<Type>& tx) : d(tx) {
+    int n = d.n;
+    int p = d.p;
+    int T = d.T;
+    F = vec2mat(tx, n, n, d.F);
+    Q = vec2mat(tx, n, n, d.Q);
+    H = vec2mat(tx, p, n, d.H);
+    R = vec2mat(tx, p, p, d.R);
+    Pp.resize(T); Ps.resize(T); J.resize(T);
+    mp.resize(n, T); ms.resize(n, T);
+    /* Filter (ms and Ps hold the filtered moments) */
+    matrix<Type> Ht = H.transpose();
+    matrix<Type> Ft = F.transpose();
+    for (int t = 0; t < T; t++) {
+      if (t == 0) {
+        mp.col(0) = vec2mat(tx, n, 1, d.m0);
+        Pp[0] = vec2mat(tx, n, n, d.P0);
+      } else {
+        mp.col(t) = F * ms.col(t - 1);
+        Pp[t] = matrix<Type>(F * Ps[t - 1]) * Ft + Q;
+      }
+      ms.col(t) = mp.col(t);
+      Ps[t] = Pp[t];
+      if (!d.observed(tx, t)) continue;
+      matrix<Type> PHt = Pp[t] * Ht;
+      matrix<Type> K = PHt * matinv(matrix<Type>(H * PHt + R));
+      matrix<Type> e = vec2mat(tx, p, 1, d.Y + t * p) - H * mp.col(t);
+      ms.col(t) += K * e;
+      Ps[t] -= K * PHt.transpose();
+    }
+    /* Smoother */
+    for (int t = T - 2; t >= 0; t--) {
+      J[t] = matrix<Type>(Ps[t] * Ft) * matinv(Pp[t + 1]);
+      ms.col(t) += J[t] * (ms.col(t + 1) - mp.col(t + 1));
+      Ps[t] += matrix<Type>(J[t] * (Ps[t + 1] - Pp[t + 1])) * J[t].transpose();
+    }
+  }
+};
+
+/* Symmetric part of a square matrix */
+template<class Type>
+matrix<Type> sym(const matrix<Type>& A) {
+  return Type(.5) * (A + matrix<Type>(A.transpose()));
+}
+
+/** \brief Gradient times w by reverse accumulation through the
+    covariance filter with predicted moments \f$m_t, P_t\f$, filtered
+    moments \f$a_t, C_t\f$, \f$B_t = HP_t\f$ and innovation covariance
+    \f$S_t = B_tH' + R\f$:
+    \f[ a_t = m_t + B_t'S_t^{-1}e_t,\quad
+        C_t = P_t - B_t'S_t^{-1}B_t,\quad
+        m_{t+1} = Fa_t,\quad P_{t+1} = FC_tF' + Q. \f]
+    Only the innovation covariances are inverted, so \f$P_0\f$ and Q
+    may be singular (e.g. an AR(p) process in companion form). The
+    gradients of the covariance matrices are symmetrized. Written with
+    ordinary operators and atomic matrix inverses, so it can be taped
+    for higher order derivatives. */
+template<class Type>
+void gradient(const CppAD::vector<Type>& tx, Type w,
+              CppAD::vector<Type>& px) {
+  dim_t d(tx);
+  int n = d.n;
+  int p = d.p;
+  int T = d.T;
+  for (size_t i = 0; i < px.size(); i++) px[i] = Type(0);
+  if (T == 0) return;
+  matrix<Type> F = vec2mat(tx, n, n, d.F);
+  matrix<Type> Q = vec2mat(tx, n, n, d.Q);
+  matrix<Type> H = vec2mat(tx, p, n, d.H);
+  matrix<Type> R = vec2mat(tx, p, p, d.R);
+  matrix<Type> Ft = F.transpose();
+  matrix<Type> Ht = H.transpose();
+  /* Forward sweep */
+  vector<matrix<Type> > m(T), P(T), a(T), C(T), Si(T);
+  for (int t = 0; t < T; t++) {
+    if (t == 0) {
+      m[0] = vec2mat(tx, n, 1, d.m0);
+      P[0] = vec2mat(tx, n, n, d.P0);
+    } else {
+      m[t] = F * a[t - 1];
+      P[t] = matrix<Type>(F * C[t - 1]) * Ft + Q;
+    }
+    a[t] = m[t];
+    C[t] = P[t];
+    if (!d.observed(tx, t)) continue;
+    matrix<Type> B = H * P[t];
+    Si[t] = matinv(matrix<Type>(B * Ht + R));
+    matrix<Type> e = vec2mat(tx, p, 1, d.Y + t * p) - H * m[t];
+    matrix<Type> SiB = Si[t] * B;
+    a[t] += SiB.transpose() * e;
+    C[t] -= B.transpose() * SiB;
+  }
+  /* Reverse sweep (b* are the adjoints) */
+  matrix<Type> ba = matrix<Type>::Zero(n, 1);
+  matrix<Type> bC = matrix<Type>::Zero(n, n);
+  matrix<Type> bF = bC, bQ = bC;
+  matrix<Type> bH = matrix<Type>::Zero(p, n);
+  matrix<Type> bR = matrix<Type>::Zero(p, p);
+  for (int t = T - 1; t >= 0; t--) {
+    matrix<Type> bm = ba;
+    matrix<Type> bP = bC;
+    if (d.observed(tx, t)) {
+      matrix<Type> B = H * P[t];
+      matrix<Type> e = vec2mat(tx, p, 1, d.Y + t * p) - H * m[t];
+      matrix<Type> v = Si[t] * e;
+      matrix<Type> SiB = Si[t] * B;
+      matrix<Type> bv = B * ba;
+      matrix<Type> Sibv = Si[t] * bv;
+      /* ll_t = -log|S|/2 - e'S^{-1}e/2 */
+      matrix<Type> bS = matrix<Type>(SiB * bC) * SiB.transpose()
+        - Sibv * v.transpose()
+        + Type(.5) * (v * v.transpose() - Si[t]);
+      matrix<Type> be = Sibv - v;
+      matrix<Type> bB = v * ba.transpose()
+        - SiB * matrix<Type>(bC + matrix<Type>(bC.transpose()))
+        + bS * H;
+      bR += bS;
+      bH += bB * P[t].transpose() + bS.transpose() * B
+        - be * m[t].transpose();
+      bP += Ht * bB;
+      bm -= Ht * be;
+      for (int i = 0; i < p; i++) px[d.Y + t * p + i] = w * be(i);
+    }
+    if (t > 0) {
+      matrix<Type> bPsym = bP + matrix<Type>(bP.transpose());
+      bF += bm * a[t - 1].transpose() + matrix<Type>(bPsym * F) * C[t - 1];
+      bQ += bP;
+      ba = Ft * bm;
+      bC = matrix<Type>(Ft * bP) * F;
+    } else {
+      bP = sym(bP);
+      for (int i = 0; i < n; i++) px[d.m0 + i] = w * bm(i);
+      for (int i = 0; i < n * n; i++) px[d.P0 + i] = w * bP(i);
+    }
+  }
+  bQ = sym(bQ);
+  bR = sym(bR);
+  for (int i = 0; i < n * n; i++) {
+    px[d.F + i] = w * bF(i);
+    px[d.Q + i] = w * bQ(i);
+  }
+  for (int i = 0; i < p * n; i++) px[d.H + i] = w * bH(i);
+  for (int i = 0; i < p * p; i++) px[d.R + i] = w * bR(i);
+}
+}  // End namespace kalman
+
+/** \brief Atomic log likelihood of a linear Gaussian state space
+    model (see kalman_filter).
+    \param x Input vector [n, p, T, m0, P0, F, Q, H, R, Y] (see
+    kalman::dim_t).
+    \return Vector of length 1.
+*/
+TMB_ATOMIC_VECTOR_FUNCTION(
+			   // ATOMIC_NAME
+			   kalman_filter
+			   ,
+			   // OUTPUT_DIM
+			   1
+			   ,
+			   // ATOMIC_DOUBLE
+			   ty[0] = kalman::value(tx);
+			   ,
+			   // ATOMIC_REVERSE
+			   kalman::gradient(tx, py[0], px);
+			   )
+
+}  // End namespace atomic
+
+/** \name Fused log densities
+    \ingroup R_style_distribution
+    Sum of log densities of a data vector, e.g. dpois_sum(x, lambda)
+    equals dpois(x, lambda, true).sum(). The sum is a single node on
+    the tape.
+    @{
+*/
+#define TMB_FUSED_ARG(Type) const typename atomic::fused::arg<Type>::type&
+/** \brief Sum of normal log densities. */
+template<class Type>
+Type dnorm_sum(const vector<Type> &x, TMB_FUSED_ARG(Type) mean,
+               TMB_FUSED_ARG(Type) sd) {
+  if (x.size() == 0) return Type(0);
+  return atomic::fused_dnorm(atomic::fused::stack(x, &mean, &sd))[0];
+}
+/** \brief Sum of Poisson log probabilities. */
+template<class Type>
+Type dpois_sum(const vector<Type> &x, TMB_FUSED_ARG(Type) lambda) {
+  if (x.size() == 0) return Type(0);
+  return atomic::fused_dpois(atomic::fused::stack(x, &lambda))[0];
+}
+/** \brief Sum of gamma log densities (shape and scale parameterization). */
+template<class Type>
+Type dgamma_sum(const vector<Type> &y, TMB_FUSED_ARG(Type) shape,
+                TMB_FUSED_ARG(Type) scale) {
+  if (y.size() == 0) return Type(0);
+  return atomic::fused_dgamma(atomic::fused::stack(y, &shape, &scale))[0];
+}
+/** \brief Sum of negative binomial log probabilities (size and prob). */
+template<class Type>
+Type dnbinom_sum(const vector<Type> &x, TMB_FUSED_ARG(Type) size,
+                 TMB_FUSED_ARG(Type) prob) {
+  if (x.size() == 0) return Type(0);
+  return atomic::fused_dnbinom(atomic::fused::stack(x, &size, &prob))[0];
+}
+/** \brief Sum of negative binomial log probabilities (mean and variance). */
+template<class Type>
+Type dnbinom2_sum(const vector<Type> &x, TMB_FUSED_ARG(Type) mu,
+                  TMB_FUSED_ARG(Type) var) {
+  if (x.size() == 0) return Type(0);
+  return atomic::fused_dnbinom2(atomic::fused::stack(x, &mu, &var))[0];
+}
+/** \brief Sum of zero-inflated Poisson log probabilities. */
+template<class Type>
+Type dzipois_sum(const vector<Type> &x, TMB_FUSED_ARG(Type) lambda,
+                 TMB_FUSED_ARG(Type) zip) {
+  if (x.size() == 0) return Type(0);
+  return atomic::fused_dzipois(atomic::fused::stack(x, &lambda, &zip))[0];
+}
+/** \brief Sum of zero-inflated negative binomial log probabilities
+    (size and prob). */
+template<class Type>
+Type dzinbinom_sum(const vector<Type> &x, TMB_FUSED_ARG(Type) size,
+                   TMB_FUSED_ARG(Type) prob, TMB_FUSED_ARG(Type) zip) {
+  if (x.size() == 0) return Type(0);
+  return atomic::fused_dzinbinom(atomic::fused::stack(x, &size, &prob, &zip))[0];
+}
+/** \brief Sum of zero-inflated negative binomial log probabilities
+    (mean and variance). */
+template<class Type>
+Type dzinbinom2_sum(const vector<Type> &x, TMB_FUSED_ARG(Type) mu,
+                    TMB_FUSED_ARG(Type) var, TMB_FUSED_ARG(Type) zip) {
+  if (x.size() == 0) return Type(0);
+  return atomic::fused_dzinbinom2(atomic::fused::stack(x, &mu, &var, &zip))[0];
+}
+#undef TMB_FUSED_ARG
+/** @} */
+
+/** \brief Log likelihood of a hidden Markov model with time varying
+    transition matrices by the scaled forward algorithm. A single node
+    on the tape.
+    \param logdens Emission log densities (states x time).
+    \param delta Initial distribution (of the state at the first time
+    point).
+    \param Gamma Transition matrices, Gamma[k](i,j) is the
+    probability of a transition from state i to state j.
+    \param idx Gamma[idx[t-1]] is the transition into time t (zero
+    based, length equal to the number of time points minus one).
+*/
+template<class Type>
+Type dhmm(const matrix<Type> &logdens, const vector<Type> &delta,
+          const vector<matrix<Type> > &Gamma, const vector<int> &idx) {
+  int m = logdens.rows();
+  int T = logdens.cols();
+  int K = Gamma.size();
+  if (delta.size() != m) error("dhmm: Non-conformable arguments");
+  if (T > 0 && idx.size() != T - 1) error("dhmm: 'idx' must have length T-1");
+  CppAD::vector<Type> tx(3 + std::max(T - 1, 0) + m + K * m * m + m * T);
+  tx[0] = Type(m);
+  tx[1] = Type(T);
+  tx[2] = Type(K);
+  size_t pos = 3;
+  for (int t = 0; t < T - 1; t++) {
+    if (idx[t] < 0 || idx[t] >= K) error("dhmm: 'idx' out of range");
+    tx[pos++] = Type(idx[t]);
+  }
+  for (int i = 0; i < m; i++) tx[pos++] = delta[i];
+  for (int k = 0; k < K; k++) {
+    if (Gamma[k].rows() != m || Gamma[k].cols() != m)
+      error("dhmm: Non-conformable arguments");
+    for (int i = 0; i < m * m; i++) tx[pos++] = Gamma[k](i);
+  }
+  for (int i = 0; i < m * T; i++) tx[pos++] = logdens(i);
+  return atomic::hmm_forward(tx)[0];
+}
+/** \brief Log likelihood of a hidden Markov model with constant
+    transition matrix Gamma (see above). */
+template<class Type>
+Type dhmm(const matrix<Type> &logdens, const vector<Type> &delta,
+          const matrix<Type> &Gamma) {
+  vector<matrix<Type> > G(1);
+  G[0] = Gamma;
+  vector<int> idx(std::max((int) logdens.cols() - 1, 0));
+  idx.setZero();
+  return dhmm(logdens, delta, G, idx);
+}
+
+/* Stack the arguments of the Kalman filter (see atomic::kalman::dim_t) */
+template<class Type>
+CppAD::vector<Type> kalman_arg(const vector<Type> &m0, const matrix<Type> &P0,
+                               const matrix<Type> &F, const matrix<Type> &Q,
+                               const matrix<Type> &H, const matrix<Type> &R,
+                               const matrix<Type> &Y) {
+  int n = m0.size();
+  int p = Y.rows();
+  int T = Y.cols();
+  if (P0.rows() != n || P0.cols() != n || F.rows() != n || F.cols() != n ||
+      Q.rows() != n || Q.cols() != n || H.rows() != p || H.cols() != n ||
+      R.rows() != p || R.cols() != p)
+    error("kalman_filter: Non-conformable arguments");
+  CppAD::vector<Type> tx(3 + n + 3 * n * n + p * n + p * p + p * T);
+  tx[0] = Type(n);
+  tx[1] = Type(p);
+  tx[2] = Type(T);
+  size_t pos = 3;
+  for (int i = 0; i < n; i++) tx[pos++] = m0[i];
+  for (int i = 0; i < n * n; i++) tx[pos++] = P0(i);
+  for (int i = 0; i < n * n; i++) tx[pos++] = F(i);
+  for (int i = 0; i < n * n; i++) tx[pos++] = Q(i);
+  for (int i = 0; i < p * n; i++) tx[pos++] = H(i);
+  for (int i = 0; i < p * p; i++) tx[pos++] = R(i);
+  for (int i = 0; i < p * T; i++) tx[pos++] = Y(i);
+  return tx;
+}
+/** \brief Log likelihood of a linear Gaussian state space model
+    \f[ x_1 \sim N(m_0, P_0),\quad x_t = F x_{t-1} + w_t,\quad
+        y_t = H x_t + v_t \f]
+    with \f$w_t \sim N(0, Q)\f$ and \f$v_t \sim N(0, R)\f$, evaluated
+    by a square root Kalman filter as a single tape node. Use it
+    instead of states as random effects when the model is linear
+    Gaussian.
+    \note P0 and Q need only be positive semi-definite (e.g. an AR(p)
+    process in companion form), whereas the innovation covariances
+    \f$HP_tH'+R\f$ must be positive definite.
+    \param Y Observations (observation x time). Time points where
+    the observation vector contains NaN are unobserved.
+*/
+template<class Type>
+Type kalman_filter(const vector<Type> &m0, const matrix<Type> &P0,
+                   const matrix<Type> &F, const matrix<Type> &Q,
+                   const matrix<Type> &H, const matrix<Type> &R,
+                   const matrix<Type> &Y) {
+  return atomic::kalman_filter(kalman_arg(m0, P0, F, Q, H, R, Y))[0];
+}
+/** \brief Smoothed state means (state x time) of the model of
+    kalman_filter. The smoothed standard deviations are stored in
+    'sd'. Intended for reporting. */
+template<class Type>
+matrix<Type> kalman_smoother(const vector<Type> &m0, const matrix<Type> &P0,
+                             const matrix<Type> &F, const matrix<Type> &Q,
+                             const matrix<Type> &H, const matrix<Type> &R,
+                             const matrix<Type> &Y, matrix<Type> &sd) {
+  atomic::kalman::smoother_t<Type> K(kalman_arg(m0, P0, F, Q, H, R, Y));
+  sd.resize(K.d.n, K.d.T);
+  for (int t = 0; t < K.d.T; t++)
+    sd.col(t) = K.Ps[t].diagonal().array().sqrt().matrix();
+  return K.ms;
+}
+/** \brief Smoothed state means (state x time) of the model of
+    kalman_filter. */
+template<class Type>
+matrix<Type> kalman_smoother(const vector<Type> &m0, const matrix<Type> &P0,
+                             const matrix<Type> &F, const matrix<Type> &Q,
+                             const matrix<Type> &H, const matrix<Type> &R,
+                             const matrix<Type> &Y) {
+  matrix<Type> sd;
+  return kalman_smoother(m0, P0, F, Q, H, R, Y, sd);
+}
@@ -4,9 +4,473 @@
 /* Flag to detect if any atomic functions have been created */
 TMB_EXTERN bool atomicFunctionGenerated CSKIP(= false;)
 
+/** \brief Sparsity policies of atomic vector functions.
+
+    A policy is passed to TMB_ATOMIC_VECTOR_FUNCTION_SPARSE and is an
+    object of the atomic class. It must provide
+
+    - record(tx, m): Called when the atomic is recorded on a tape
+      (may collect information from the inputs, e.g. dimensions).
+    - forward(vx, vy): Variable outputs given variable inputs.
+    - for_sparse_jac(q, r, s): Forward Jacobian sparsity.
+    - rev_sparse_jac(q, rt, st): Reverse Jacobian sparsity.
+    - rev_sparse_hes(vx, s, t, q, r, u, v): Reverse Hessian sparsity.
+
+    using the 'bool' sparsity layout of CppAD::atomic_base. The
+    Hessian patterns are conservative in the sense that each output is
+    treated as non-linear in all of its inputs.
+*/
+struct sparsity_base {
+  template<class T>
+  void record(const CppAD::vector<T>& tx, size_t m) {}
+};
+
+/** \brief Sparsity of an atomic function where every output depends
+    on every input (used by TMB_ATOMIC_VECTOR_FUNCTION). */
+struct dense_sparsity : sparsity_base {
+  static void forward(const CppAD::vector<bool>& vx,
+                      CppAD::vector<bool>& vy) {
+    bool anyvx = false;
+    for (size_t i = 0; i < vx.size(); i++) anyvx |= vx[i];
+    for (size_t i = 0; i < vy.size(); i++) vy[i] = anyvx;
+  }
+  static void for_sparse_jac(size_t q, const CppAD::vector<bool>& r,
+                             CppAD::vector<bool>& s) {
+    size_t n = r.size() / q, m = s.size() / q;
+    for (size_t k = 0; k < q; k++) {
+      bool anyr = false;
+      for (size_t j = 0; j < n; j++) anyr |= r[j * q + k];
+      for (size_t i = 0; i < m; i++) s[i * q + k] = anyr;
+    }
+  }
+  static void rev_sparse_jac(size_t q, const CppAD::vector<bool>& rt,
+                             CppAD::vector<bool>& st) {
+    bool anyrt = false;
+    for (size_t i = 0; i < rt.size(); i++) anyrt |= rt[i];
+    for (size_t i = 0; i < st.size(); i++) st[i] = anyrt;
+  }
+  static bool rev_sparse_hes(const CppAD::vector<bool>& vx,
+                             const CppAD::vector<bool>& s,
+                             CppAD::vector<bool>& t, size_t q,
+                             const CppAD::vector<bool>& r,
+                             const CppAD::vector<bool>& u,
+                             CppAD::vector<bool>& v) {
+    size_t n = vx.size(), m = s.size();
+    bool anys = false;
+    for (size_t i = 0; i < m; i++) anys |= s[i];
+    for (size_t j = 0; j < n; j++) t[j] = anys;
+    for (size_t k = 0; k < q; k++) {
+      bool anyr = false, anyu = false;
+      for (size_t j = 0; j < n; j++) anyr |= r[j * q + k];
+      for (size_t i = 0; i < m; i++) anyu |= u[i * q + k];
+      for (size_t j = 0; j < n; j++) v[j * q + k] = anyu | (anys & anyr);
+    }
+    return true;
+  }
+};
+
+/** \brief Sparsity given the inputs of each output.
+
+    The atomic function has n inputs and m outputs, and output i
+    depends on inputs 'inputs(i)'. Derived classes implement
+
+    void inputs(size_t n, size_t m, size_t i, std::vector<size_t>& in)
+
+    (called through 'Derived'). The generic (and slow) Hessian pattern
+    is computed from those lists.
+*/
+template<class Derived>
+struct inputs_sparsity : sparsity_base {
+  Derived& derived() { return static_cast<Derived&>(*this); }
+  void forward(const CppAD::vector<bool>& vx, CppAD::vector<bool>& vy) {
+    size_t n = vx.size(), m = vy.size();
+    std::vector<size_t> in;
+    for (size_t i = 0; i < m; i++) {
+      derived().inputs(n, m, i, in);
+      vy[i] = false;
+      for (size_t l = 0; l < in.size(); l++) vy[i] = vy[i] | vx[in[l]];
+    }
+  }
+  void for_sparse_jac(size_t q, const CppAD::vector<bool>& r,
+                      CppAD::vector<bool>& s) {
+    size_t n = r.size() / q, m = s.size() / q;
+    std::vector<size_t> in;
+    for (size_t i = 0; i < m; i++) {
+      derived().inputs(n, m, i, in);
+      for (size_t k = 0; k < q; k++) {
+        bool any = false;
+        for (size_t l = 0; l < in.size(); l++) any |= r[in[l] * q + k];
+        s[i * q + k] = any;
+      }
+    }
+  }
+  void rev_sparse_jac(size_t q, const CppAD::vector<bool>& rt,
+                      CppAD::vector<bool>& st) {
+    size_t m = rt.size() / q, n = st.size() / q;
+    std::vector<size_t> in;
+    for (size_t j = 0; j < n * q; j++) st[j] = false;
+    for (size_t i = 0; i < m; i++) {
+      bool any = false;
+      for (size_t k = 0; k < q; k++) any |= rt[i * q + k];
+      if (!any) continue;
+      derived().inputs(n, m, i, in);
+      for (size_t l = 0; l < in.size(); l++)
+        for (size_t k = 0; k < q; k++)
+          st[in[l] * q + k] = st[in[l] * q + k] | rt[i * q + k];
+    }
+  }
+  bool rev_sparse_hes(const CppAD::vector<bool>& vx,
+                      const CppAD::vector<bool>& s,
+                      CppAD::vector<bool>& t, size_t q,
+                      const CppAD::vector<bool>& r,
+                      const CppAD::vector<bool>& u,
+                      CppAD::vector<bool>& v) {
+    size_t n = vx.size(), m = s.size();
+    for (size_t j = 0; j < n * q; j++) v[j] = false;
+    for (size_t j = 0; j < n; j++) t[j] = false;
+    std::vector<size_t> in;
+    CppAD::vector<bool> ri(q);  /* Joint forward pattern of the inputs */
+    for (size_t i = 0; i < m; i++) {
+      derived().inputs(n, m, i, in);
+      for (size_t k = 0; k < q; k++) {
+        ri[k] = false;
+        for (size_t l = 0; l < in.size(); l++) ri[k] = ri[k] | r[in[l] * q + k];
+      }
+      for (size_t l = 0; l < in.size(); l++) {
+        size_t j = in[l];
+        t[j] = t[j] | s[i];
+        for (size_t k = 0; k < q; k++)
+          v[j * q + k] = v[j * q + k] | u[i * q + k] | (s[i] & ri[k]);
+      }
+    }
+    return true;
+  }
+};
+
+/** \brief Sparsity of an elementwise atomic function.
+
+    The input is the concatenation of a number of vectors of length
+    m = dim(y) followed by NSHARED inputs that are shared by all
+    outputs, i.e. y[i] depends on x[i], x[m+i], x[2*m+i], ... and on
+    the shared inputs. The Jacobian is (block) diagonal so Hessian
+    patterns stay sparse.
+*/
+template<int NSHARED>
+struct elementwise_sparsity :
+    inputs_sparsity<elementwise_sparsity<NSHARED> > {
+  void inputs(size_t n, size_t m, size_t i, std::vector<size_t>& in) {
+    in.resize(0);
+    for (size_t j = i; j < n - NSHARED; j += m) in.push_back(j);
+    for (size_t j = n - NSHARED; j < n; j++) in.push_back(j);
+  }
+};
+
+/** \brief Sparsity of an atomic function whose input and output are
+    both NARG stacked vectors of length n, where entry i of every
+    output vector only depends on entry i of the input vectors (e.g.
+    the gradient of a sum of independent terms). */
+template<int NARG>
+struct stacked_sparsity : inputs_sparsity<stacked_sparsity<NARG> > {
+  void inputs(size_t n, size_t m, size_t i, std::vector<size_t>& in) {
+    size_t len = n / NARG;
+    in.resize(0);
+    for (size_t a = 0; a < NARG; a++) in.push_back(a * len + i % len);
+  }
+};
+
+/** \brief Sparsity of a scalar atomic function of NARG stacked
+    vectors of length n which is a sum of terms depending on entry i
+    of the input vectors only. The Jacobian is dense while the Hessian
+    is block diagonal. */
+template<int NARG>
+struct stacked_sum_sparsity : sparsity_base {
+  static void forward(const CppAD::vector<bool>& vx,
+                      CppAD::vector<bool>& vy) {
+    dense_sparsity::forward(vx, vy);
+  }
+  static void for_sparse_jac(size_t q, const CppAD::vector<bool>& r,
+                             CppAD::vector<bool>& s) {
+    dense_sparsity::for_sparse_jac(q, r, s);
+  }
+  static void rev_sparse_jac(size_t q, const CppAD::vector<bool>& rt,
+                             CppAD::vector<bool>& st) {
+    for (size_t j = 0; j < st.size() / q; j++)
+      for (size_t k = 0; k < q; k++) st[j * q + k] = rt[k];
+  }
+  static bool rev_sparse_hes(const CppAD::vector<bool>& vx,
+                             const CppAD::vector<bool>& s,
+                             CppAD::vector<bool>& t, size_t q,
+                             const CppAD::vector<bool>& r,
+                             const CppAD::vector<bool>& u,
+                             CppAD::vector<bool>& v) {
+    size_t n = vx.size() / NARG;
+    CppAD::vector<bool> ri(q);
+    for (size_t i = 0; i < n; i++) {
+      for (size_t k = 0; k < q; k++) ri[k] = false;
+      for (size_t a = 0; a < NARG; a++)
+        for (size_t k = 0; k < q; k++) ri[k] = ri[k] | r[(a * n + i) * q + k];
+      for (size_t a = 0; a < NARG; a++) {
+        size_t j = a * n + i;
+        t[j] = s[0];
+        for (size_t k = 0; k < q; k++) v[j * q + k] = u[k] | (s[0] & ri[k]);
+      }
+    }
+    return true;
+  }
+};
+
+/** \brief Sparsity depending on integer inputs (e.g. dimensions).
+
+    PATTERN provides
+
+    - template<class T> static void signature(const CppAD::vector<T>& tx,
+      std::vector<int>& sig): The integer inputs determining the
+      pattern (e.g. matrix dimensions stored in tx).
+    - static void inputs(const std::vector<int>& sig, size_t i,
+      std::vector<size_t>& in): Inputs of output i.
+
+    The sparsity callbacks of CppAD do not see the input values, so
+    the signature is stored by input/output dimension when the atomic
+    is recorded. If two recordings with the same dimensions have
+    different signatures the pattern falls back to dense.
+*/
+template<class PATTERN>
+struct signature_sparsity : inputs_sparsity<signature_sparsity<PATTERN> > {
+  typedef std::pair<size_t, size_t> key_t;
+  std::map<key_t, std::vector<int> > table;
+  std::set<key_t> ambiguous;
+  template<class T>
+  void record(const CppAD::vector<T>& tx, size_t m) {
+    key_t key(tx.size(), m);
+    std::vector<int> sig;
+    PATTERN::signature(tx, sig);
+#ifdef _OPENMP
+#pragma omp critical (signature_sparsity)
+#endif
+    {
+      typename std::map<key_t, std::vector<int> >::iterator it = table.find(key);
+      if (it == table.end()) table[key] = sig;
+      else if (it->second != sig) ambiguous.insert(key);
+    }
+  }
+  void inputs(size_t n, size_t m, size_t i, std::vector<size_t>& in) {
+    key_t key(n, m);
+    /* Entries of 'table' are never modified once inserted, and map
+       insertion does not invalidate pointers to other entries, so
+       only the lookup itself needs the lock. */
+    const std::vector<int>* sig = NULL;
+#ifdef _OPENMP
+#pragma omp critical (signature_sparsity)
+#endif
+    {
+      typename std::map<key_t, std::vector<int> >::iterator it = table.find(key);
+      if (it != table.end() && ambiguous.count(key) == 0) sig = &(it->second);
+    }
+    if (sig == NULL) {
+      /* Unknown signature: dense */
+      in.resize(n);
+      for (size_t j = 0; j < n; j++) in[j] = j;
+      return;
+    }
+    PATTERN::inputs(*sig, i, in);
+  }
+};
+
+/** \brief Forward mode of order 1 and 2 obtained from the reverse mode.
+
+    The reverse mode of an atomic function gives the map
+    \f$G(x,w)=f'(x)^T w\f$. Taping G (nested AD) gives
+
+    - the first order Taylor coefficient \f$y_1=f'(x_0)x_1\f$ as the
+      w-gradient of \f$x_1^T G(x_0,w)\f$ (one reverse sweep of G), and
+    - the second order Taylor coefficient
+      \f$y_2=f'(x_0)x_2+\frac{1}{2}(x_1^T f_i''(x_0)x_1)_i\f$ by a
+      forward sweep of a tape of \f$(x,v)\rightarrow f'(x)v\f$.
+
+    Each atomic function owns an instance of this class. The tapes of
+    G and K are kept per thread together with the point \f$x_0\f$ they
+    were recorded at, and are re-used as long as \f$x_0\f$ does not
+    change. This is the typical situation for Hessian-vector products
+    and ForTwo, where many directions are evaluated at the same
+    point. The tapes are not re-used at a different \f$x_0\f$, because
+    the reverse code of an atomic may branch on the input values.
+
+    Limitations:
+    - Only available for the double version of the atomic function
+      (i.e. the outer tape must be an ADFun<double>). Other types
+      signal an error.
+    - Order at most 2.
+    - The reverse mode of order > 0 (thus RevTwo and Hessian) is not
+      available.
+
+    F provides 'eval' and 'reverse' for all AD types (see
+    TMB_ATOMIC_VECTOR_FUNCTION_GENERAL).
+*/
+struct taylor_by_reverse {
+  /** \brief Tapes recorded at a given point */
+  struct cache_t {
+    CppAD::vector<double> x0;
+    CppAD::ADFun<double> G; /* (x,w) -> f'(x)^T w, zero order sweep done at x0 */
+    CppAD::ADFun<double> K; /* (x,v) -> f'(x) v */
+    bool G_ok, K_ok;
+    cache_t() : G_ok(false), K_ok(false) {}
+    /* Invalidate unless recorded at x */
+    void set_point(const CppAD::vector<double>& x) {
+      bool same = (x0.size() == x.size());
+      for (size_t j = 0; same && j < x.size(); j++) same = (x0[j] == x[j]);
+      if (!same) {
+        x0 = x;
+        G_ok = false;
+        K_ok = false;
+      }
+    }
+  };
+  std::vector<cache_t*> cache;
+  ~taylor_by_reverse() {
+    for (size_t i = 0; i < cache.size(); i++) delete cache[i];
+  }
+  /* Cache of the current thread */
+  cache_t& get_cache() {
+    size_t thread = 0;
+    cache_t* tcache;
+#ifdef _OPENMP
+    thread = omp_get_thread_num();
+#pragma omp critical (atomic_taylor_by_reverse)
+#endif
+    {
+      if (cache.size() <= thread) cache.resize(thread + 1, NULL);
+      if (cache[thread] == NULL) cache[thread] = new cache_t();
+      tcache = cache[thread];
+    }
+    return *tcache;
+  }
+  template<class F, class Type>
+  void forward(size_t p, size_t q, const CppAD::vector<Type>& tx,
+               CppAD::vector<Type>& ty) {
+    error("Atomic forward mode of order > 0 only available for double");
+  }
+  /* Tape G(x,w) = f'(x)^T w and do the zero order sweep at x0 */
+  template<class F>
+  static void tape_G(const CppAD::vector<double>& x0, size_t m,
+                     CppAD::ADFun<double>& G) {
+    typedef AD<double> AD1;
+    size_t n = x0.size();
+    CppAD::vector<AD1> xw(n + m);
+    CppAD::vector<AD1> ax(n);
+    CppAD::vector<AD1> aw(m);
+    for (size_t j = 0; j < n; j++) xw[j] = x0[j];
+    for (size_t i = 0; i < m; i++) xw[n + i] = 0;
+    CppAD::Independent(xw);
+    for (size_t j = 0; j < n; j++) ax[j] = xw[j];
+    for (size_t i = 0; i < m; i++) aw[i] = xw[n + i];
+    CppAD::vector<AD1> ay = F::eval(ax);
+    CppAD::vector<AD1> px(n);
+    F::reverse(ax, ay, px, aw);
+    G.Dependent(xw, px);
+    CppAD::vector<double> xw0(n + m);
+    for (size_t j = 0; j < n; j++) xw0[j] = x0[j];
+    for (size_t i = 0; i < m; i++) xw0[n + i] = 0;
+    G.Forward(0, xw0);
+  }
+  /* Tape K(x,v) = f'(x) v */
+  template<class F>
+  static void tape_K(const CppAD::vector<double>& x0, size_t m,
+                     CppAD::ADFun<double>& K) {
+    typedef AD<double> AD1;
+    typedef AD<AD1> AD2;
+    size_t n = x0.size();
+    CppAD::vector<AD1> xv(2 * n);
+    for (size_t j = 0; j < n; j++) { xv[j] = x0[j]; xv[n + j] = 0; }
+    CppAD::Independent(xv);
+    CppAD::vector<AD2> xw(n + m);
+    CppAD::vector<AD2> ax(n);
+    CppAD::vector<AD2> aw(m);
+    for (size_t j = 0; j < n; j++) xw[j] = xv[j];
+    for (size_t i = 0; i < m; i++) xw[n + i] = AD1(0);
+    CppAD::Independent(xw);
+    for (size_t j = 0; j < n; j++) ax[j] = xw[j];
+    for (size_t i = 0; i < m; i++) aw[i] = xw[n + i];
+    CppAD::vector<AD2> ay = F::eval(ax);
+    CppAD::vector<AD2> px(n);
+    F::reverse(ax, ay, px, aw);
+    CppAD::ADFun<AD1> G(xw, px);
+    CppAD::vector<AD1> xw0(n + m);
+    CppAD::vector<AD1> v(n);
+    for (size_t j = 0; j < n; j++) { xw0[j] = xv[j]; v[j] = xv[n + j]; }
+    for (size_t i = 0; i < m; i++) xw0[n + i] = AD1(0);
+    G.Forward(0, xw0);
+    CppAD::vector<AD1> d = G.Reverse(1, v);
+    CppAD::vector<AD1> Jv(m);
+    for (size_t i = 0; i < m; i++) Jv[i] = d[n + i];
+    K.Dependent(xv, Jv);
+  }
+  template<class F>
+  void forward(size_t p, size_t q, const CppAD::vector<double>& tx,
+               CppAD::vector<double>& ty) {
+    if (q > 2) error("Atomic forward mode of order > 2 not implemented");
+    size_t n = tx.size() / (q + 1), m = ty.size() / (q + 1);
+    std::vector<CppAD::vector<double> > x(q + 1, CppAD::vector<double>(n));
+    for (size_t j = 0; j < n; j++)
+      for (size_t k = 0; k <= q; k++) x[k][j] = tx[j * (q + 1) + k];
+    if (p == 0) {
+      CppAD::vector<double> y0 = F::eval(x[0]);
+      for (size_t i = 0; i < m; i++) ty[i * (q + 1)] = y0[i];
+    }
+    cache_t& C = get_cache();
+    C.set_point(x[0]);
+    if (q == 1) {
+      /* Sweep back through G(x0,.) with weight x1 */
+      if (!C.G_ok) {
+        tape_G<F>(x[0], m, C.G);
+        C.G_ok = true;
+      }
+      CppAD::vector<double> d = C.G.Reverse(1, x[1]);
+      for (size_t i = 0; i < m; i++) ty[i * (q + 1) + 1] = d[n + i];
+      return;
+    }
+    if (!C.K_ok) {
+      tape_K<F>(x[0], m, C.K);
+      C.K_ok = true;
+    }
+    CppAD::ADFun<double>& K = C.K;
+    /* y1 = f'(x0) x1 */
+    CppAD::vector<double> arg(2 * n);
+    for (size_t j = 0; j < n; j++) { arg[j] = x[0][j]; arg[n + j] = x[1][j]; }
+    CppAD::vector<double> y1 = K.Forward(0, arg);
+    /* d/dt f'(x0 + t x1) x1 = (x1' f_i'' x1)_i */
+    for (size_t j = 0; j < n; j++) { arg[j] = x[1][j]; arg[n + j] = 0; }
+    CppAD::vector<double> h = K.Forward(1, arg);
+    /* f'(x0) x2 */
+    for (size_t j = 0; j < n; j++) { arg[j] = x[0][j]; arg[n + j] = x[2][j]; }
+    CppAD::vector<double> y2 = K.Forward(0, arg);
+    for (size_t i = 0; i < m; i++) {
+      if (p <= 1) ty[i * (q + 1) + 1] = y1[i];
+      ty[i * (q + 1) + 2] = y2[i] + .5 * h[i];
+    }
+  }
+};
+
 /** \brief Construct atomic vector function based on known derivatives */
 #define TMB_ATOMIC_VECTOR_FUNCTION(ATOMIC_NAME, OUTPUT_DIM, ATOMIC_DOUBLE,    \
                                    ATOMIC_REVERSE)                            \
+  TMB_ATOMIC_VECTOR_FUNCTION_SPARSE(ATOMIC_NAME, OUTPUT_DIM, ATOMIC_DOUBLE,   \
+                                    ATOMIC_REVERSE, atomic::dense_sparsity)
+
+/** \brief Construct atomic vector function based on known derivatives
+    and a given sparsity structure (e.g. elementwise_sparsity) */
+#define TMB_ATOMIC_VECTOR_FUNCTION_SPARSE(ATOMIC_NAME, OUTPUT_DIM,            \
+                                          ATOMIC_DOUBLE, ATOMIC_REVERSE,      \
+                                          SPARSITY)                           \
+  TMB_ATOMIC_VECTOR_FUNCTION_GENERAL(ATOMIC_NAME, OUTPUT_DIM, ATOMIC_DOUBLE,  \
+                                     ATOMIC_REVERSE, SPARSITY,                \
+                                     atomic::taylor_by_reverse)
+
+/** \brief Construct atomic vector function based on known derivatives,
+    a sparsity structure and a policy for forward mode of order > 0
+    (e.g. taylor_by_reverse). */
+#define TMB_ATOMIC_VECTOR_FUNCTION_GENERAL(ATOMIC_NAME, OUTPUT_DIM,           \
+                                           ATOMIC_DOUBLE, ATOMIC_REVERSE,     \
+                                           SPARSITY, TAYLOR)                  \
   void ATOMIC_NAME(const CppAD::vector<double>& tx,                           \
                    CppAD::vector<double>& ty) CSKIP({                         \
     ATOMIC_DOUBLE;                                                            \
@@ -22,6 +486,25 @@ TMB_EXTERN bool atomicFunctionGenerated CSKIP(= false;)
   template <class Type>                                                       \
   CppAD::vector<AD<Type> > ATOMIC_NAME(const CppAD::vector<AD<Type> >& tx);   \
   template <class Type>                                                       \
+  void ATOMIC_NAME##_reverse(const CppAD::vector<Type>& tx,                   \
+                             const CppAD::vector<Type>& ty,                   \
+                             CppAD::vector<Type>& px,                         \
+                             const CppAD::vector<Type>& py) {                 \
+    ATOMIC_REVERSE;                                                           \
+  }                                                                           \
+  struct ATOMIC_NAME##_functor {                                              \
+    template <class T>                                                        \
+    static CppAD::vector<T> eval(const CppAD::vector<T>& tx) {                \
+      return ATOMIC_NAME(tx);                                                 \
+    }                                                                         \
+    template <class T>                                                        \
+    static void reverse(const CppAD::vector<T>& tx,                           \
+                        const CppAD::vector<T>& ty, CppAD::vector<T>& px,     \
+                        const CppAD::vector<T>& py) {                         \
+      ATOMIC_NAME##_reverse(tx, ty, px, py);                                  \
+    }                                                                         \
+  };                                                                          \
+  template <class Type>                                                       \
   class atomic##ATOMIC_NAME : public CppAD::atomic_base<Type> {               \
    public:                                                                    \
     atomic##ATOMIC_NAME(const char* name) : CppAD::atomic_base<Type>(name) {  \
@@ -32,15 +515,19 @@ TMB_EXTERN bool atomicFunctionGenerated CSKIP(= false;)
     }                                                                         \
                                                                               \
    private:                                                                   \
+    SPARSITY sparsity;                                                        \
+    TAYLOR taylor;                                                            \
     virtual bool forward(size_t p, size_t q, const CppAD::vector<bool>& vx,   \
                          CppAD::vector<bool>& vy,                             \
                          const CppAD::vector<Type>& tx,                       \
                          CppAD::vector<Type>& ty) {                           \
-      if (q > 0) error("Atomic '" #ATOMIC_NAME "' order not implemented.\n"); \
+      if (q > 0) {                                                            \
+        taylor.template forward<ATOMIC_NAME##_functor>(p, q, tx, ty);         \
+        return true;                                                          \
+      }                                                                       \
       if (vx.size() > 0) {                                                    \
-        bool anyvx = false;                                                   \
-        for (size_t i = 0; i < vx.size(); i++) anyvx |= vx[i];                \
-        for (size_t i = 0; i < vy.size(); i++) vy[i] = anyvx;                 \
+        sparsity.record(tx, ty.size());                                       \
+        sparsity.forward(vx, vy);                                             \
       }                                                                       \
       ATOMIC_NAME(tx, ty);                                                    \
       return true;                                                            \
@@ -50,20 +537,38 @@ TMB_EXTERN bool atomicFunctionGenerated CSKIP(= false;)
                          CppAD::vector<Type>& px,                             \
                          const CppAD::vector<Type>& py) {                     \
       if (q > 0) error("Atomic '" #ATOMIC_NAME "' order not implemented.\n"); \
-      ATOMIC_REVERSE;                                                         \
+      ATOMIC_NAME##_reverse(tx, ty, px, py);                                  \
+      return true;                                                            \
+    }                                                                         \
+    virtual bool for_sparse_jac(size_t q, const CppAD::vector<bool>& r,       \
+                                CppAD::vector<bool>& s) {                     \
+      sparsity.for_sparse_jac(q, r, s);                                       \
       return true;                                                            \
     }                                                                         \
+    virtual bool for_sparse_jac(size_t q,                                     \
+                                const CppAD::vector<std::set<size_t> >& r,    \
+                                CppAD::vector<std::set<size_t> >& s) {        \
+      error("Should not be called");                                          \
+      return false;                                                           \
+    }                                                                         \
     virtual bool rev_sparse_jac(size_t q, const CppAD::vector<bool>& rt,      \
                                 CppAD::vector<bool>& st) {                    \
-      bool anyrt = false;                                                     \
-      for (size_t i = 0; i < rt.size(); i++) anyrt |= rt[i];                  \
-      for (size_t i = 0; i < st.size(); i++) st[i] = anyrt;                   \
+      sparsity.rev_sparse_jac(q, rt, st);                                     \
       return true;                                                            \
     }                                                                         \
     virtual bool rev_sparse_jac(size_t q,                                     \
                                 const CppAD::vector<std::set<size_t> >& rt,   \
                                 CppAD::vector<std::set<size_t> >& st) {       \
       error("Should not be called");                                          \
+      return false;                                                           \
+    }                                                                         \
+    virtual bool rev_sparse_hes(const CppAD::vector<bool>& vx,                \
+                                const CppAD::vector<bool>& s,                 \
+                                CppAD::vector<bool>& t, size_t q,             \
+                                const CppAD::vector<bool>& r,                 \
+                                const CppAD::vector<bool>& u,                 \
+                                CppAD::vector<bool>& v) {                     \
+      return sparsity.rev_sparse_hes(vx, s, t, q, r, u, v);                   \
     }                                                                         \
   };                                                                          \
   template <class Type>                                                       \
@@ -18,6 +18,8 @@
    - New symbols can be added by advanced users. First option is to
    code the reverse mode derivatives by hand using the
    TMB_ATOMIC_VECTOR_FUNCTION macro, see source code for examples.
+   The variant TMB_ATOMIC_VECTOR_FUNCTION_SPARSE additionally takes a
+   sparsity policy (see atomic_macro.hpp).
    Second option is to generate reverse mode derivatives automatically
    using the macro REGISTER_ATOMIC.
 */
@@ -50,6 +52,7 @@ namespace Rmath {
     double	Rf_pgamma(double, double, double, int, int);
     double	Rf_qgamma(double, double, double, int, int);
     double	Rf_lgammafn(double);
+    double	Rf_gammafn(double);
     double	Rf_psigamma(double, double);
     double	Rf_fmin2(double, double);
   }
@@ -59,6 +62,8 @@ namespace Rmath {
   #include <R_ext/Applic.h>
 #ifdef WITH_LIBTMB
   void integrand_D_incpl_gamma_shape(double *x, int nx, void *ex);
+  bool warning_allowed();
+  double D_incpl_gamma_shape_integrate(double x, double shape, double n, double logc);
   double D_incpl_gamma_shape(double x, double shape, double n, double logc);
   double inv_incpl_gamma(double y, double shape, double logc);
   double D_lgamma(double x, double n);
@@ -72,11 +77,17 @@ namespace Rmath {
       x[i] = exp( -exp(x[i]) + shape * x[i] + logc ) * pow(x[i], n);
     }
   }
-  /* n'th order derivative of (scaled) incomplete gamma wrt. shape parameter */
-  double D_incpl_gamma_shape(double x, double shape, double n, double logc){
-    if(n<.5){
-      return exp(logc + Rf_lgammafn(shape)) * Rf_pgamma(x, shape, 1.0, 1, 0);
-    }
+  /* Warnings from R are not thread safe */
+  bool warning_allowed(){
+#ifdef _OPENMP
+    return !omp_in_parallel();
+#else
+    return true;
+#endif
+  }
+  /* D_incpl_gamma_shape by numerical integration (reentrant: work
+     arrays on the stack) */
+  double D_incpl_gamma_shape_integrate(double x, double shape, double n, double logc){
     double epsabs=1e-10;
     double epsrel=1e-10;
     double result1=0;
@@ -87,8 +98,8 @@ namespace Rmath {
     int limit=100;
     int lenw = 4 * limit;
     int last=0;
-    int* iwork = (int*)malloc(limit * sizeof(int));
-    double* work = (double*)malloc(lenw * sizeof(double));
+    int iwork[100];
+    double work[400];
     double ex[3];
     ex[0] = shape;
     ex[1] = n;
@@ -101,10 +112,8 @@ namespace Rmath {
 	   &epsabs, &epsrel,
 	   &result1, &abserr, &neval, &ier,
 	   &limit, &lenw, &last, iwork, work);
-    if(ier!=0){
-#ifndef _OPENMP
+    if(ier!=0 && warning_allowed()){
       warning("incpl_gamma (indef) integrate unreliable: x=%f shape=%f n=%f ier=%i", x, shape, n, ier);
-#endif
     }
     /* integrate min(log(x),log(shape))...log(x) */
     if(x>shape){
@@ -115,16 +124,178 @@ namespace Rmath {
 	     &epsabs, &epsrel,
 	     &result2, &abserr, &neval, &ier,
 	     &limit, &lenw, &last, iwork, work);
-      if(ier!=0){
-#ifndef _OPENMP
+      if(ier!=0 && warning_allowed()){
 	warning("incpl_gamma (def) integrate unreliable: x=%f shape=%f n=%f ier=%i", x, shape, n, ier);
-#endif
       }
     }
-    free(iwork);
-    free(work);
     return result1 + result2;
   }
+  /* Truncated Taylor series in the shape parameter: c[j] is the j'th
+     Taylor coefficient (j < order) */
+  struct jet_t {
+    static const int max_order = 9;
+    int order;
+    double c[max_order];
+    jet_t(int order_, double c0 = 0, double c1 = 0) : order(order_) {
+      for(int j=0; j<order; j++) c[j] = 0;
+      c[0] = c0;
+      if(order > 1) c[1] = c1;
+    }
+    jet_t operator+(const jet_t &y) const {
+      jet_t z(*this);
+      for(int j=0; j<order; j++) z.c[j] += y.c[j];
+      return z;
+    }
+    jet_t operator-(const jet_t &y) const {
+      jet_t z(*this);
+      for(int j=0; j<order; j++) z.c[j] -= y.c[j];
+      return z;
+    }
+    jet_t operator*(double y) const {
+      jet_t z(*this);
+      for(int j=0; j<order; j++) z.c[j] *= y;
+      return z;
+    }
+    jet_t operator*(const jet_t &y) const {
+      jet_t z(order);
+      for(int j=0; j<order; j++)
+        for(int i=0; i<=j; i++) z.c[j] += c[i] * y.c[j-i];
+      return z;
+    }
+    jet_t inverse() const {
+      jet_t z(order);
+      z.c[0] = 1. / c[0];
+      for(int j=1; j<order; j++){
+        double s = 0;
+        for(int i=1; i<=j; i++) s += c[i] * z.c[j-i];
+        z.c[j] = -s * z.c[0];
+      }
+      return z;
+    }
+    jet_t exp_() const {
+      jet_t z(order);
+      z.c[0] = exp(c[0]);
+      for(int j=1; j<order; j++){
+        double s = 0;
+        for(int i=1; i<=j; i++) s += i * c[i] * z.c[j-i];
+        z.c[j] = s / j;
+      }
+      return z;
+    }
+    double norm() const {
+      double s = 0;
+      for(int j=0; j<order; j++) s = std::max(s, fabs(c[j]));
+      return s;
+    }
+  };
+  /* Lower incomplete gamma function exp(logc)*gamma(shape, x) as a
+     jet in the shape parameter. Series for x < shape + 1, otherwise
+     continued fraction for the upper part (Numerical Recipes
+     'gser'/'gcf' carried out in jet arithmetic). Returns false if
+     not converged. */
+  bool incpl_gamma_jet(double x, double shape, double logc, jet_t &ans){
+    const int maxit = 100000;
+    const double eps = 1e-16, fpmin = 1e-300;
+    int order = ans.order;
+    double L = log(x);
+    /* exp(logc - x) * x^(shape + delta) */
+    jet_t pre = jet_t(order, logc - x + shape * L, L).exp_();
+    if(x < shape + 1.){
+      jet_t term = jet_t(order, shape, 1).inverse();
+      jet_t sum = term;
+      int k;
+      for(k=1; k<maxit; k++){
+        term = term * jet_t(order, shape + k, 1).inverse() * x;
+        sum = sum + term;
+        if(term.norm() <= eps * sum.norm()) break;
+      }
+      if(k == maxit) return false;
+      ans = pre * sum;
+    } else {
+      jet_t b(order, x + 1. - shape, -1);
+      jet_t c(order, 1. / fpmin);
+      jet_t d = b.inverse();
+      jet_t h = d;
+      int i;
+      for(i=1; i<maxit; i++){
+        jet_t an(order, -i * (i - shape), i);
+        b.c[0] += 2.;
+        d = an * d + b;
+        if(fabs(d.c[0]) < fpmin) d.c[0] = fpmin;
+        c = b + an * c.inverse();
+        if(fabs(c.c[0]) < fpmin) c.c[0] = fpmin;
+        d = d.inverse();
+        jet_t del = d * c;
+        h = h * del;
+        del.c[0] -= 1.;
+        if(del.norm() <= eps) break;
+      }
+      if(i == maxit) return false;
+      /* exp(logc) * Gamma(shape + delta) */
+      jet_t lgam(order, logc + Rf_lgammafn(shape));
+      for(int j=1; j<order; j++)
+        lgam.c[j] = Rf_psigamma(shape, j - 1) / Rf_gammafn(j + 1);
+      ans = lgam.exp_() - pre * h;
+    }
+    return true;
+  }
+  /* Recently used values of D_incpl_gamma_shape (per thread) */
+  struct incpl_gamma_memo_t {
+    static const int size = 64;
+    double key[size][4];
+    double value[size];
+    incpl_gamma_memo_t() {
+      for(int i=0; i<size; i++) key[i][0] = -1; /* x < 0 never used */
+    }
+    int slot(const double *k) {
+      size_t h = 0;
+      for(int j=0; j<4; j++){
+        unsigned char *b = (unsigned char*) &k[j];
+        for(size_t i=0; i<sizeof(double); i++) h = h * 31 + b[i];
+      }
+      return h % size;
+    }
+  };
+  incpl_gamma_memo_t& incpl_gamma_memo(){
+    static std::vector<incpl_gamma_memo_t*> memo;
+    size_t thread = 0;
+    incpl_gamma_memo_t* ans;
+#ifdef _OPENMP
+    thread = omp_get_thread_num();
+#pragma omp critical (atomic_incpl_gamma_memo)
+#endif
+    {
+      if (memo.size() <= thread) memo.resize(thread + 1, NULL);
+      if (memo[thread] == NULL) memo[thread] = new incpl_gamma_memo_t();
+      ans = memo[thread];
+    }
+    return *ans;
+  }
+  /* n'th order derivative of (scaled) incomplete gamma wrt. shape parameter */
+  double D_incpl_gamma_shape(double x, double shape, double n, double logc){
+    if(n<.5){
+      return exp(logc + Rf_lgammafn(shape)) * Rf_pgamma(x, shape, 1.0, 1, 0);
+    }
+    if(x == 0) return 0;
+    double k[4] = {x, shape, n, logc};
+    incpl_gamma_memo_t &memo = incpl_gamma_memo();
+    int i = memo.slot(k);
+    if(memo.key[i][0] == x && memo.key[i][1] == shape &&
+       memo.key[i][2] == n && memo.key[i][3] == logc) return memo.value[i];
+    double ans;
+    int order = (int) (n + .5) + 1;
+    jet_t jet(order);
+    if(x > 0 && shape > 0 && order <= jet_t::max_order &&
+       incpl_gamma_jet(x, shape, logc, jet)){
+      ans = jet.c[order - 1] * Rf_gammafn(order);
+      if(!R_FINITE(ans)) ans = D_incpl_gamma_shape_integrate(x, shape, n, logc);
+    } else {
+      ans = D_incpl_gamma_shape_integrate(x, shape, n, logc);
+    }
+    for(int j=0; j<4; j++) memo.key[i][j] = k[j];
+    memo.value[i] = ans;
+    return ans;
+  }
   double inv_incpl_gamma(double y, double shape, double logc){
     double logp = log(y) - Rf_lgammafn(shape) - logc;
     double scale = 1.0;
@@ -386,6 +557,27 @@ matrix<double> matmul(matrix<double> x, matrix<double> y)CSKIP({
 })
 /** \endcond */
 
+/** \brief Sparsity of matmul: entry (i,j) of the result depends on
+    row i of the first matrix and column j of the second matrix. */
+struct matmul_pattern {
+  template<class T>
+  static void signature(const CppAD::vector<T>& tx, std::vector<int>& sig) {
+    int n1 = CppAD::Integer(tx[0]);
+    int n3 = CppAD::Integer(tx[1]);
+    int n2 = (n1 + n3 > 0 ? (tx.size() - 2) / (n1 + n3) : 0);
+    sig.resize(3);
+    sig[0] = n1; sig[1] = n2; sig[2] = n3;
+  }
+  static void inputs(const std::vector<int>& sig, size_t i,
+                     std::vector<size_t>& in) {
+    size_t n1 = sig[0], n2 = sig[1];
+    size_t row = i % n1, col = i / n1;
+    in.resize(0);
+    for (size_t k = 0; k < n2; k++) in.push_back(2 + row + n1 * k);
+    for (size_t k = 0; k < n2; k++) in.push_back(2 + n1 * n2 + k + n2 * col);
+  }
+};
+
 /** \brief Atomic version of matrix multiply.
     Multiplies n1-by-n2 matrix with n2-by-n3 matrix.
     \param x Input vector of length 2+n1*n2+n2*n3 containing the
@@ -394,7 +586,7 @@ matrix<double> matmul(matrix<double> x, matrix<double> y)CSKIP({
     \return Vector of length n1*n3 containing result of matrix
     multiplication.
 */
-TMB_ATOMIC_VECTOR_FUNCTION(
+TMB_ATOMIC_VECTOR_FUNCTION_SPARSE(
 			   // ATOMIC_NAME
 			   matmul
 			   ,
@@ -425,6 +617,9 @@ TMB_ATOMIC_VECTOR_FUNCTION(
 			   res1 = matmul(W, Yt); // W*Y^T
 			   res2 = matmul(Xt, W); // X^T*W
 			   px[0] = 0; px[1] = 0;
+			   ,
+			   // SPARSITY
+			   signature_sparsity<matmul_pattern>
 			   )
 
 /** \brief Atomic version of matrix inversion.
@@ -458,6 +653,80 @@ TMB_ATOMIC_VECTOR_FUNCTION(
 			   res = -matmul(Yt, tmp);             // -f(X)^T*W*f(X)^T
 			   )
 
+/** \brief Solver of the discrete Lyapunov equation \f$V = AVA^T + Q\f$
+    (Bartels-Stewart). */
+namespace lyapunov {
+/* With the complex Schur decomposition A = U T U^* the equation becomes
+   X = T X T^* + U^* Q U with T upper triangular. Column j of X is
+   found from the columns l > j by an upper triangular solve with
+   (I - conj(T_jj) T). Total work O(n^3). */
+inline Eigen::MatrixXd solve(const Eigen::MatrixXd& A,
+                             const Eigen::MatrixXd& Q) {
+  typedef std::complex<double> cplx;
+  typedef Eigen::Matrix<cplx, Eigen::Dynamic, Eigen::Dynamic> cmatrix;
+  typedef Eigen::Matrix<cplx, Eigen::Dynamic, 1> cvector;
+  int n = A.rows();
+  Eigen::ComplexSchur<Eigen::MatrixXd> schur(A);
+  const cmatrix& T = schur.matrixT();
+  const cmatrix& U = schur.matrixU();
+  cmatrix C = U.adjoint() * Q.cast<cplx>() * U;
+  cmatrix X(n, n), Y(n, n); /* Y = T X (solved columns) */
+  cmatrix M(n, n);
+  for (int j = n - 1; j >= 0; j--) {
+    int k = n - 1 - j;
+    cvector r = C.col(j);
+    if (k > 0) r += Y.rightCols(k) * T.row(j).tail(k).adjoint();
+    M = -std::conj(T(j, j)) * T;
+    M.diagonal().array() += cplx(1, 0);
+    X.col(j) = M.triangularView<Eigen::Upper>().solve(r);
+    Y.col(j) = T.triangularView<Eigen::Upper>() * X.col(j);
+  }
+  return (U * X * U.adjoint()).real();
+}
+} // End namespace lyapunov
+
+/** \brief Atomic solution of the discrete Lyapunov equation
+    \f$V = AVA^T + Q\f$ for n-by-n matrices.
+    The reverse mode solves the transposed equation
+    \f$S = A^TSA + W\f$ and gives \f$SAV^T + S^TAV\f$ (wrt. A) and
+    \f$S\f$ (wrt. Q).
+    \param x Input vector [A (n*n), Q (n*n)].
+    \return Vector of length n*n.
+*/
+TMB_ATOMIC_VECTOR_FUNCTION(
+			   // ATOMIC_NAME
+			   discrLyap
+			   ,
+			   // OUTPUT_DIM
+			   tx.size() / 2
+			   ,
+			   // ATOMIC_DOUBLE
+			   typedef TypeDefs<double>::MapMatrix MapMatrix_t;
+			   typedef TypeDefs<double>::ConstMapMatrix ConstMapMatrix_t;
+			   int n = sqrt((double)tx.size() / 2.);
+			   ConstMapMatrix_t A(&tx[0    ], n, n);
+			   ConstMapMatrix_t Q(&tx[n * n], n, n);
+			   MapMatrix_t      V(&ty[0    ], n, n);
+			   V = lyapunov::solve(A, Q);
+			   ,
+			   // ATOMIC_REVERSE
+			   typedef typename TypeDefs<Type>::MapMatrix MapMatrix_t;
+			   int n = sqrt((double)ty.size());
+			   matrix<Type> A = vec2mat(tx, n, n);
+			   matrix<Type> V = vec2mat(ty, n, n);
+			   CppAD::vector<Type> arg(2 * n * n);
+			   for(int i=0; i<n; i++) for(int j=0; j<n; j++) arg[i + j * n] = tx[j + i * n];
+			   for(int i=0; i<n * n; i++) arg[n * n + i] = py[i];
+			   CppAD::vector<Type> s = discrLyap(arg);
+			   matrix<Type> S = vec2mat(s, n, n);
+			   MapMatrix_t PA(&px[0    ], n, n);
+			   MapMatrix_t PQ(&px[n * n], n, n);
+			   matrix<Type> St = S.transpose();
+			   matrix<Type> Vt = V.transpose();
+			   PA = matmul(matmul(S, A), Vt) + matmul(St, matmul(A, V));
+			   PQ = S;
+			   )
+
 /** \brief Atomic version of log determinant of positive definite n-by-n matrix.
     \param x Input vector of length n*n.
     \return Vector of length 1.
@@ -520,10 +789,602 @@ TMB_ATOMIC_VECTOR_FUNCTION(
 			   px=mat2vec(res);
 			   )
 
+/** \brief Atomic elementwise exponential of a vector.
+    Occupies a single tape node independent of the vector length.
+    \param x Input vector of length n.
+    \return Vector of length n.
+*/
+TMB_ATOMIC_VECTOR_FUNCTION_SPARSE(
+			   // ATOMIC_NAME
+			   vexp
+			   ,
+			   // OUTPUT_DIM
+			   tx.size()
+			   ,
+			   // ATOMIC_DOUBLE
+			   for(size_t i=0; i<tx.size(); i++) ty[i] = std::exp(tx[i]);
+			   ,
+			   // ATOMIC_REVERSE
+			   for(size_t i=0; i<tx.size(); i++) px[i] = ty[i] * py[i];
+			   ,
+			   // SPARSITY
+			   elementwise_sparsity<0>
+			   )
+
+/** \brief Atomic elementwise logarithm of a vector.
+    \param x Input vector of length n.
+    \return Vector of length n.
+*/
+TMB_ATOMIC_VECTOR_FUNCTION_SPARSE(
+			   // ATOMIC_NAME
+			   vlog
+			   ,
+			   // OUTPUT_DIM
+			   tx.size()
+			   ,
+			   // ATOMIC_DOUBLE
+			   for(size_t i=0; i<tx.size(); i++) ty[i] = std::log(tx[i]);
+			   ,
+			   // ATOMIC_REVERSE
+			   for(size_t i=0; i<tx.size(); i++) px[i] = py[i] / tx[i];
+			   ,
+			   // SPARSITY
+			   elementwise_sparsity<0>
+			   )
+
+/** \brief Atomic elementwise square root of a vector.
+    \param x Input vector of length n.
+    \return Vector of length n.
+*/
+TMB_ATOMIC_VECTOR_FUNCTION_SPARSE(
+			   // ATOMIC_NAME
+			   vsqrt
+			   ,
+			   // OUTPUT_DIM
+			   tx.size()
+			   ,
+			   // ATOMIC_DOUBLE
+			   for(size_t i=0; i<tx.size(); i++) ty[i] = std::sqrt(tx[i]);
+			   ,
+			   // ATOMIC_REVERSE
+			   for(size_t i=0; i<tx.size(); i++) px[i] = Type(.5) * py[i] / ty[i];
+			   ,
+			   // SPARSITY
+			   elementwise_sparsity<0>
+			   )
+
+/** \brief Atomic elementwise power \f$x_i^{y_i}\f$ of two vectors.
+    \param x Input vector of length 2n (concatenation of x and y).
+    \return Vector of length n.
+*/
+TMB_ATOMIC_VECTOR_FUNCTION_SPARSE(
+			   // ATOMIC_NAME
+			   vpow
+			   ,
+			   // OUTPUT_DIM
+			   tx.size() / 2
+			   ,
+			   // ATOMIC_DOUBLE
+			   size_t n = tx.size() / 2;
+			   for(size_t i=0; i<n; i++) ty[i] = std::pow(tx[i], tx[n+i]);
+			   ,
+			   // ATOMIC_REVERSE
+			   // At x=0 and y>0 use the limit d/dy x^y = 0, with
+			   // x-slope lim x^(y-1) (1 + y log(x)) = -Inf for
+			   // y<=1 (written as -sqrt(x)). Also d/dx x^0 = 0.
+			   // The log and sqrt are taken of 1 where they are
+			   // not used, and (as for CppAD's operators) a zero
+			   // py has no effect, so that no NaN enters higher
+			   // orders.
+			   size_t n = ty.size();
+			   CppAD::vector<Type> arg(2*n);
+			   CppAD::vector<Type> x(n);
+			   for(size_t i=0; i<n; i++){
+			     x[i] = CppAD::CondExpEq(tx[i], Type(0),
+						     CppAD::CondExpGt(tx[n+i], Type(0), Type(1), tx[i]),
+						     tx[i]);
+			     arg[i] = tx[i];
+			     arg[n+i] = tx[n+i] - Type(1);
+			   }
+			   CppAD::vector<Type> dx = vpow(arg); // x^(y-1)
+			   CppAD::vector<Type> logx = vlog(x);
+			   for(size_t i=0; i<n; i++){
+			     Type y = tx[n+i];
+			     Type slope = -sqrt(CppAD::CondExpGt(y, Type(1), Type(1), tx[i]));
+			     Type dy = ty[i] * logx[i];
+			     Type dy0 = CppAD::CondExpGt(y, Type(1), Type(0), slope);
+			     px[i] = CppAD::CondExpEq(y, Type(0), Type(0),
+						      y * dx[i] * py[i]);
+			     px[n+i] = CppAD::CondExpEq(tx[i], Type(0),
+							CppAD::CondExpGt(y, Type(0), dy0, dy),
+							dy) * py[i];
+			     px[i] = CppAD::CondExpEq(py[i], Type(0), Type(0), px[i]);
+			     px[n+i] = CppAD::CondExpEq(py[i], Type(0), Type(0), px[n+i]);
+			   }
+			   ,
+			   // SPARSITY
+			   elementwise_sparsity<0>
+			   )
+
+/** \brief Atomic elementwise derivative of log gamma function of a
+    vector (see D_lgamma).
+    \param x Input vector of length n+1: x[0..n-1] are the arguments
+    and x[n] is the derivative order.
+    \return Vector of length n.
+*/
+TMB_ATOMIC_VECTOR_FUNCTION_SPARSE(
+			   // ATOMIC_NAME
+			   vD_lgamma
+			   ,
+			   // OUTPUT_DIM
+			   tx.size() - 1
+			   ,
+			   // ATOMIC_DOUBLE
+			   size_t n = tx.size() - 1;
+			   for(size_t i=0; i<n; i++) ty[i] = Rmath::D_lgamma(tx[i], tx[n]);
+			   ,
+			   // ATOMIC_REVERSE
+			   size_t n = ty.size();
+			   CppAD::vector<Type> tx_(tx);
+			   tx_[n] = tx_[n] + Type(1.0);
+			   CppAD::vector<Type> D = vD_lgamma(tx_);
+			   for(size_t i=0; i<n; i++) px[i] = D[i] * py[i];
+			   px[n] = Type(0);
+			   ,
+			   // SPARSITY
+			   elementwise_sparsity<1>
+			   )
+
 /**
     @}
 */
 
+namespace sorting {
+/* Strict ordering of indices by value (NaN last, ties in order of
+   appearance) */
+struct index_less {
+  const double* x;
+  index_less(const double* x_) : x(x_) {}
+  bool operator()(int i, int j) const {
+    bool ni = ISNAN(x[i]);
+    bool nj = ISNAN(x[j]);
+    if (ni || nj) return (ni == nj ? i < j : nj);
+    return x[i] < x[j] || (x[i] == x[j] && i < j);
+  }
+};
+/** \brief Zero based ranks of x[0], ..., x[n-1] (O(n log n)) */
+inline std::vector<int> ranks(const double* x, int n) {
+  std::vector<int> ord(n);
+  std::vector<int> rank(n);
+  for (int i = 0; i < n; i++) ord[i] = i;
+  std::sort(ord.begin(), ord.end(), index_less(x));
+  for (int r = 0; r < n; r++) rank[ord[r]] = r;
+  return rank;
+}
+/* Move block i (of length k) of 'from' to block rank[i] of 'to' or
+   the reverse */
+template<class Type>
+void permute(const std::vector<int>& rank, const Type* from, Type* to,
+             int k, bool inverse) {
+  for (size_t i = 0; i < rank.size(); i++)
+    for (int j = 0; j < k; j++) {
+      if (inverse) to[i * k + j] = from[rank[i] * k + j];
+      else to[rank[i] * k + j] = from[i * k + j];
+    }
+}
+} // End namespace sorting
+
+/** \brief Atomic ranks (zero based) of a vector. Ties are ranked in
+    order of appearance. The ranks are piecewise constant, so the
+    derivative is zero.
+    \param x Input vector of length n.
+    \return Vector of length n.
+*/
+TMB_ATOMIC_VECTOR_FUNCTION(
+			   // ATOMIC_NAME
+			   sort_rank
+			   ,
+			   // OUTPUT_DIM
+			   tx.size()
+			   ,
+			   // ATOMIC_DOUBLE
+			   std::vector<int> r = sorting::ranks(&tx[0], tx.size());
+			   for(size_t i=0; i<tx.size(); i++) ty[i] = r[i];
+			   ,
+			   // ATOMIC_REVERSE
+			   for(size_t i=0; i<tx.size(); i++) px[i] = Type(0);
+			   )
+
+CppAD::vector<double> sort_unpermute(const CppAD::vector<double>& tx);
+template <class Type>
+CppAD::vector<AD<Type> > sort_unpermute(const CppAD::vector<AD<Type> >& tx);
+
+/** \brief Atomic permutation of n blocks by the ranks of a key vector:
+    block i of z becomes block rank(x)[i] of the result. The
+    derivative wrt. z is the inverse permutation of the adjoints and
+    the derivative wrt. the key is zero.
+    \param x Input vector [n, x (n), z (n*k)].
+    \return Vector of length n*k.
+*/
+TMB_ATOMIC_VECTOR_FUNCTION(
+			   // ATOMIC_NAME
+			   sort_permute
+			   ,
+			   // OUTPUT_DIM
+			   tx.size() - 1 - CppAD::Integer(tx[0])
+			   ,
+			   // ATOMIC_DOUBLE
+			   int n = CppAD::Integer(tx[0]);
+			   std::vector<int> r = sorting::ranks(&tx[1], n);
+			   sorting::permute(r, &tx[1 + n], &ty[0], ty.size() / n, false);
+			   ,
+			   // ATOMIC_REVERSE
+			   int n = CppAD::Integer(tx[0]);
+			   CppAD::vector<Type> arg(tx.size());
+			   for(int i=0; i<=n; i++) arg[i] = tx[i];
+			   for(size_t i=0; i<py.size(); i++) arg[1 + n + i] = py[i];
+			   CppAD::vector<Type> pz = sort_unpermute(arg);
+			   for(int i=0; i<=n; i++) px[i] = Type(0);
+			   for(size_t i=0; i<pz.size(); i++) px[1 + n + i] = pz[i];
+			   )
+
+/** \brief Atomic inverse of sort_permute: block rank(x)[i] of z
+    becomes block i of the result.
+    \param x Input vector [n, x (n), z (n*k)].
+    \return Vector of length n*k.
+*/
+TMB_ATOMIC_VECTOR_FUNCTION(
+			   // ATOMIC_NAME
+			   sort_unpermute
+			   ,
+			   // OUTPUT_DIM
+			   tx.size() - 1 - CppAD::Integer(tx[0])
+			   ,
+			   // ATOMIC_DOUBLE
+			   int n = CppAD::Integer(tx[0]);
+			   std::vector<int> r = sorting::ranks(&tx[1], n);
+			   sorting::permute(r, &tx[1 + n], &ty[0], ty.size() / n, true);
+			   ,
+			   // ATOMIC_REVERSE
+			   int n = CppAD::Integer(tx[0]);
+			   CppAD::vector<Type> arg(tx.size());
+			   for(int i=0; i<=n; i++) arg[i] = tx[i];
+			   for(size_t i=0; i<py.size(); i++) arg[1 + n + i] = py[i];
+			   CppAD::vector<Type> pz = sort_permute(arg);
+			   for(int i=0; i<=n; i++) px[i] = Type(0);
+			   for(size_t i=0; i<pz.size(); i++) px[1 + n + i] = pz[i];
+			   )
+
+namespace spline {
+/** \brief Interval lookup in sorted knots: the largest i with
+    x[i] <= u (0 if u < x[0]). Uniform knots are indexed directly,
+    otherwise binary search is used. */
+struct knots_t {
+  const double* x;
+  int n;
+  bool uniform;
+  double h;
+  knots_t(const double* x_, int n_) : x(x_), n(n_), uniform(false), h(0) {
+    if (n < 2) return;
+    h = (x[n - 1] - x[0]) / (n - 1);
+    uniform = (h > 0);
+    double eps = 1e-12 * (fabs(x[0]) + fabs(x[n - 1]));
+    for (int i = 1; uniform && i < n; i++)
+      uniform = (fabs(x[i] - (x[0] + i * h)) <= eps);
+  }
+  int index(double u) const {
+    int i;
+    if (uniform) {
+      double r = floor((u - x[0]) / h);
+      i = (r < 0 ? 0 : (r > n - 1 ? n - 1 : (int) r));
+      /* Correct rounding near knots */
+      while (i + 1 < n && x[i + 1] <= u) i++;
+      while (i > 0 && x[i] > u) i--;
+    } else {
+      i = std::upper_bound(x, x + n, u) - x - 1;
+      if (i < 0) i = 0;
+    }
+    return i;
+  }
+};
+/* k'th derivative of c0 + c1 dx + c2 dx^2 + c3 dx^3 */
+inline double poly(double c0, double c1, double c2, double c3, double dx,
+                   int k) {
+  switch (k) {
+  case 0: return c0 + dx * (c1 + dx * (c2 + dx * c3));
+  case 1: return c1 + dx * (2. * c2 + 3. * dx * c3);
+  case 2: return 2. * c2 + 6. * dx * c3;
+  case 3: return 6. * c3;
+  default: return 0;
+  }
+}
+/* j! / (j-k)! */
+inline double falling(int j, int k) {
+  double ans = 1;
+  for (int i = 0; i < k; i++) ans *= j - i;
+  return ans;
+}
+} // End namespace spline
+
+CppAD::vector<double> spline_adjoint(const CppAD::vector<double>& tx);
+template <class Type>
+CppAD::vector<AD<Type> > spline_adjoint(const CppAD::vector<AD<Type> >& tx);
+
+/** \brief Atomic evaluation of a cubic spline (or its k'th
+    derivative) at many points: interval i of the knots x is the
+    polynomial \f$y_i + b_i d + c_i d^2 + d_i d^3\f$ with
+    \f$d = u - x_i\f$.
+    \param x Input vector [n, k, x (n), y (n), b (n), c (n), d (n), u (nu)].
+    \return Vector of length nu.
+*/
+TMB_ATOMIC_VECTOR_FUNCTION(
+			   // ATOMIC_NAME
+			   spline_eval
+			   ,
+			   // OUTPUT_DIM
+			   tx.size() - 2 - 5 * CppAD::Integer(tx[0])
+			   ,
+			   // ATOMIC_DOUBLE
+			   int n = CppAD::Integer(tx[0]);
+			   int k = CppAD::Integer(tx[1]);
+			   const double* x = &tx[2];
+			   const double* c = &tx[2 + n];
+			   const double* u = &tx[2 + 5 * n];
+			   spline::knots_t K(x, n);
+			   for(size_t l=0; l<ty.size(); l++) {
+			     int i = K.index(u[l]);
+			     ty[l] = spline::poly(c[i], c[n + i], c[2 * n + i], c[3 * n + i], u[l] - x[i], k);
+			   }
+			   ,
+			   // ATOMIC_REVERSE
+			   int n = CppAD::Integer(tx[0]);
+			   int k = CppAD::Integer(tx[1]);
+			   size_t nu = py.size();
+			   size_t U = 2 + 5 * n;
+			   CppAD::vector<Type> arg(tx);
+			   arg[1] = Type(k + 1);
+			   CppAD::vector<Type> dv = spline_eval(arg);
+			   CppAD::vector<Type> adj(2 + n + 2 * nu);
+			   adj[0] = Type(n);
+			   adj[1] = tx[1];
+			   for(int i=0; i<n; i++) adj[2 + i] = tx[2 + i];
+			   for(size_t l=0; l<nu; l++) adj[2 + n + l] = tx[U + l];
+			   for(size_t l=0; l<nu; l++) adj[2 + n + nu + l] = py[l];
+			   CppAD::vector<Type> A = spline_adjoint(adj);
+			   px[0] = Type(0); px[1] = Type(0);
+			   for(int i=0; i<n; i++) {
+			     Type pxi = Type(0);
+			     for(int j=0; j<4; j++) {
+			       px[2 + (j + 1) * n + i] = (j >= k ? Type(spline::falling(j, k)) * A[(j - k) * n + i] : Type(0));
+			       if (j > k) pxi -= Type(spline::falling(j, k + 1)) * tx[2 + (j + 1) * n + i] * A[(j - k - 1) * n + i];
+			     }
+			     px[2 + i] = pxi;
+			   }
+			   for(size_t l=0; l<nu; l++) px[U + l] = py[l] * dv[l];
+			   )
+
+/** \brief Atomic adjoint of spline_eval with respect to the
+    coefficients: for each interval i of the knots and power p=0..3
+    the sum of \f$w_l (u_l - x_i)^p\f$ over the points \f$u_l\f$ in
+    interval i.
+    \param x Input vector [n, unused, x (n), u (nu), w (nu)].
+    \return Vector of length 4*n (power major).
+*/
+TMB_ATOMIC_VECTOR_FUNCTION(
+			   // ATOMIC_NAME
+			   spline_adjoint
+			   ,
+			   // OUTPUT_DIM
+			   4 * CppAD::Integer(tx[0])
+			   ,
+			   // ATOMIC_DOUBLE
+			   int n = CppAD::Integer(tx[0]);
+			   size_t nu = (tx.size() - 2 - n) / 2;
+			   const double* x = &tx[2];
+			   const double* u = &tx[2 + n];
+			   const double* w = &tx[2 + n + nu];
+			   spline::knots_t K(x, n);
+			   for(size_t i=0; i<ty.size(); i++) ty[i] = 0;
+			   for(size_t l=0; l<nu; l++) {
+			     int i = K.index(u[l]);
+			     double dx = u[l] - x[i];
+			     double wp = w[l];
+			     for(int p=0; p<4; p++) { ty[p * n + i] += wp; wp *= dx; }
+			   }
+			   ,
+			   // ATOMIC_REVERSE
+			   int n = CppAD::Integer(tx[0]);
+			   size_t nu = (tx.size() - 2 - n) / 2;
+			   size_t U = 2 + n;
+			   size_t W = 2 + n + nu;
+			   /* The adjoint py acts as spline coefficients */
+			   CppAD::vector<Type> arg(2 + 5 * n + nu);
+			   arg[0] = Type(n);
+			   arg[1] = Type(0);
+			   for(int i=0; i<n; i++) arg[2 + i] = tx[2 + i];
+			   for(int i=0; i<4 * n; i++) arg[2 + n + i] = py[i];
+			   for(size_t l=0; l<nu; l++) arg[2 + 5 * n + l] = tx[U + l];
+			   CppAD::vector<Type> pw = spline_eval(arg);
+			   arg[1] = Type(1);
+			   CppAD::vector<Type> g = spline_eval(arg);
+			   CppAD::vector<Type> adj(tx);
+			   for(size_t l=0; l<nu; l++) adj[W + l] = tx[W + l] * g[l];
+			   CppAD::vector<Type> A = spline_adjoint(adj);
+			   px[0] = Type(0); px[1] = Type(0);
+			   for(int i=0; i<n; i++) px[2 + i] = -A[i];
+			   for(size_t l=0; l<nu; l++) {
+			     px[U + l] = tx[W + l] * g[l];
+			     px[W + l] = pw[l];
+			   }
+			   )
+
+/** \brief Atomic number of whole periods of a periodic spline:
+    \f$\lfloor (u_l - x_0) / p \rfloor\f$ for each point \f$u_l\f$,
+    evaluated in double at every evaluation (not frozen on the
+    tape). Piecewise constant, so the derivatives are zero.
+    \param x Input vector [u (nu), x0, p].
+    \return Vector of length nu.
+*/
+TMB_ATOMIC_VECTOR_FUNCTION_SPARSE(
+			   // ATOMIC_NAME
+			   spline_period
+			   ,
+			   // OUTPUT_DIM
+			   tx.size() - 2
+			   ,
+			   // ATOMIC_DOUBLE
+			   size_t nu = ty.size();
+			   double x0 = tx[nu];
+			   double period = tx[nu + 1];
+			   for(size_t l=0; l<nu; l++) ty[l] = floor((tx[l] - x0) / period);
+			   ,
+			   // ATOMIC_REVERSE
+			   for(size_t i=0; i<px.size(); i++) px[i] = Type(0);
+			   ,
+			   // SPARSITY
+			   elementwise_sparsity<2>
+			   )
+
+/** \brief 21 point Kronrod rule of QUADPACK's 'dqk21' used by
+    gauss_kronrod::integrate. Integrand values of a subinterval are
+    stored in the order \f$f(c-hx_0), f(c+hx_0), \ldots, f(c-hx_9),
+    f(c+hx_9), f(c)\f$ where \f$c\f$ is the center, \f$h\f$ the half
+    length and \f$x_j\f$ the Kronrod nodes.
+*/
+namespace kronrod21 {
+  /* Kronrod nodes (xgk) and weights (wgk) and Gauss weights (wg).
+     Gauss nodes are xgk[1], xgk[3], ..., xgk[9]. */
+  static const double xgk[11] = {
+    0.995657163025808080735527280689003, 0.973906528517171720077964012084452,
+    0.930157491355708226001207180059508, 0.865063366688984510732096688423493,
+    0.780817726586416897063717578345042, 0.679409568299024406234327365114874,
+    0.562757134668604683339000099272694, 0.433395394129247190799265943165784,
+    0.294392862701460198131126603103866, 0.148874338981631210884826001129720,
+    0.0 };
+  static const double wgk[11] = {
+    0.011694638867371874278064396062192, 0.032558162307964727478818972459390,
+    0.054755896574351996031381300244580, 0.075039674810919952767043140916190,
+    0.093125454583697605535065465083366, 0.109387158802297641899210590325805,
+    0.123491976262065851077208795961577, 0.134709217311473325928054001771707,
+    0.142775938577060080797094273138717, 0.147739104901338491374841515972068,
+    0.149445554002916905664936468389821 };
+  static const double wg[5] = {
+    0.066671344308688137593568809893332, 0.149451349150580593145776339657697,
+    0.219086362515982043995534934228163, 0.269266719309996355091226921569469,
+    0.295524224714752870173892994651338 };
+  /* Kronrod weight of value number i */
+  inline double weight(int i) { return (i == 20 ? wgk[10] : wgk[i / 2]); }
+  /* Kronrod estimate (result) and dqk21 error estimate (return value)
+     of a subinterval with half length 'half' */
+  inline double error(const double *fx, double half, double *result) {
+    double resk = wgk[10] * fx[20], resg = 0;
+    double resabs = fabs(resk);
+    for (int j = 0; j < 10; j++) {
+      double fsum = fx[2 * j] + fx[2 * j + 1];
+      resk += wgk[j] * fsum;
+      resabs += wgk[j] * (fabs(fx[2 * j]) + fabs(fx[2 * j + 1]));
+      if (j % 2 == 1) resg += wg[j / 2] * fsum;
+    }
+    double reskh = 0.5 * resk;
+    double resasc = wgk[10] * fabs(fx[20] - reskh);
+    for (int j = 0; j < 10; j++)
+      resasc += wgk[j] * (fabs(fx[2 * j] - reskh) + fabs(fx[2 * j + 1] - reskh));
+    double h = fabs(half);
+    resabs *= h;
+    resasc *= h;
+    *result = resk * half;
+    double err = fabs((resk - resg) * h);
+    if (resasc != 0 && err != 0)
+      err = resasc * std::min(1., pow(200. * err / resasc, 1.5));
+    double epmach = std::numeric_limits<double>::epsilon();
+    if (resabs > std::numeric_limits<double>::min() / (50. * epmach))
+      err = std::max(epmach * 50. * resabs, err);
+    if (!(err == err)) err = INFINITY; /* NaN integrand */
+    return err;
+  }
+  /* Warning flags of taped integrals (see kronrod_sum). A new flag
+     is allocated per integral when the tape is recorded. Only
+     accessed within the critical section 'kronrod21_flags'. */
+  inline std::vector<bool>& warned() {
+    static std::vector<bool> flags;
+    return flags;
+  }
+  inline int new_flag() {
+    int ans;
+#ifdef _OPENMP
+#pragma omp critical (kronrod21_flags)
+#endif
+    {
+      warned().push_back(false);
+      ans = warned().size() - 1;
+    }
+    return ans;
+  }
+  /* Should an integral with flag 'i' warn? True the first time only.
+     Negative flags (untaped integrals) always warn. */
+  inline bool first_warning(int i) {
+    if (i < 0) return true;
+    bool ans;
+#ifdef _OPENMP
+#pragma omp critical (kronrod21_flags)
+#endif
+    {
+      ans = !warned()[i];
+      warned()[i] = true;
+    }
+    return ans;
+  }
+}
+
+/** \brief Atomic sum of the 21 point Kronrod rules of the final
+    subintervals of an adaptive quadrature. The dqk21 error estimate
+    of the subdivision is re-computed at every evaluation and a
+    warning is issued if it exceeds the tolerance, i.e. if the
+    subdivision selected when the tape was recorded is no longer
+    adequate at the current parameters. The warning is issued once
+    per integral (all nested integrals share the 'flag' of the
+    outer integral) rather than at every evaluation of the tape.
+    \param x Input vector [flag, abstol, reltol, h (n), f (21*n)] with
+    half lengths h and integrand values f of the n subintervals.
+    \return The integral.
+*/
+TMB_ATOMIC_VECTOR_FUNCTION(
+			   // ATOMIC_NAME
+			   kronrod_sum
+			   ,
+			   // OUTPUT_DIM
+			   1
+			   ,
+			   // ATOMIC_DOUBLE
+			   size_t n = (tx.size() - 3) / 22;
+			   double ans = 0;
+			   double err = 0;
+			   for(size_t i=0; i<n; i++) {
+			     double resk;
+			     err += kronrod21::error(&tx[3 + n + 21 * i], tx[3 + i], &resk);
+			     ans += resk;
+			   }
+			   ty[0] = ans;
+			   double tol = std::max(tx[1], tx[2] * fabs(ans));
+			   if(!(err <= tol) && Rmath::warning_allowed() &&
+			      kronrod21::first_warning((int) tx[0])){
+			     warning("gauss_kronrod: estimated error %g exceeds tolerance %g (subdivision of the tape). Not repeated for this integral.", err, tol);
+			   }
+			   ,
+			   // ATOMIC_REVERSE
+			   size_t n = (tx.size() - 3) / 22;
+			   px[0] = Type(0); px[1] = Type(0); px[2] = Type(0);
+			   for(size_t i=0; i<n; i++) {
+			     Type s(0);
+			     for(int j=0; j<21; j++) {
+			       Type w(kronrod21::weight(j));
+			       s += w * tx[3 + n + 21 * i + j];
+			       px[3 + n + 21 * i + j] = py[0] * w * tx[3 + i];
+			     }
+			     px[3 + i] = py[0] * s;
+			   }
+			   )
+
 /* ================================== INTERFACES
 */
 
@@ -562,6 +1423,15 @@ Type logdet(matrix<Type> x){
   return logdet(mat2vec(x))[0];
 }
 
+/** \brief Solution V of the discrete Lyapunov equation V = A V A^T + Q */
+template<class Type>
+matrix<Type> discrLyap(matrix<Type> A, matrix<Type> Q){
+  int n=A.rows();
+  CppAD::vector<Type> arg(2*n*n);
+  for(int i=0;i<n*n;i++){arg[i]=A(i); arg[n*n+i]=Q(i);}
+  return vec2mat(discrLyap(arg),n,n);
+}
+
 /* Temporary test of dmvnorm implementation based on atomic symbols.
    Should reduce tape size from O(n^3) to O(n^2).
 */
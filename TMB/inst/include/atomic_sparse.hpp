@@ -0,0 +1,1326 @@
+// License: GPL-2
+
+/** \file
+    \brief Atomic functions of sparse matrices.
+
+    The sparsity pattern of the matrix is passed to the atomic
+    functions as part of the argument vector so the pattern is fixed
+    for a given tape (including explicitly stored zeros).
+
+    1. Log determinant
+    ==================
+    logdet(Q) for Eigen::SparseMatrix<Type> occupies a single tape node
+    instead of recording every flop of a sparse factorization. The
+    matrix is passed to the atomic functions as its lower triangle in
+    compressed column form
+
+    \verbatim
+    tx = [n, nnz, outer (n+1), inner (nnz), values (nnz)]
+    \endverbatim
+
+    The symbolic analysis (fill reducing ordering and structure of the
+    Cholesky factor) is carried out once per pattern and cached per
+    thread. The numerical factorization is redone only when the values
+    change.
+
+    Derivatives:
+
+    - \f$\partial \log|Q| / \partial Q_{ij} = (Q^{-1})_{ij}\f$ is needed
+      on the pattern of Q only. It is computed from the Cholesky factor
+      by selected inversion (Takahashi recursions) at roughly the cost
+      of the factorization.
+    - The derivatives of the selected inverse are the mixed directional
+      derivatives
+      \f[ D_k(Q;W_1,...,W_k) = \frac{\partial^k}{\partial\epsilon_1
+      \cdots\partial\epsilon_k} (Q - \textstyle\sum_i \epsilon_i
+      W_i)^{-1} \f]
+      on the pattern (e.g. \f$D_1(Q;W)=Q^{-1}WQ^{-1}\f$). They are
+      obtained by running the numerical factorization and the
+      Takahashi recursions on truncated Taylor polynomials in
+      \f$\epsilon_1,...,\epsilon_k\f$ over the pattern of L, i.e. at
+      \f$3^k\f$ times the cost of the selected inverse. By symmetry of
+      the trace the reverse mode of \f$D_k\f$ is expressed by
+      \f$D_{k+1}\f$ and \f$D_k\f$, so derivatives of all orders (up
+      to 'max_order') are available.
+
+    2. Matrix-vector products
+    =========================
+    matvec(A, x) and quadform(Q, x) pass the full matrix in compressed
+    column form. The index arrays are stored once per sparsity pattern
+    outside the tape (csc_register) and the argument vector only holds
+    the index of the pattern
+
+    \verbatim
+    tx = [pattern, values (nnz), x]
+    \endverbatim
+
+    The derivatives are closed under the three bilinear atomics
+    sparse_matvec (Ax), sparse_tmatvec (A'w) and sparse_outer
+    (\f$a_ib_j\f$ on the pattern), so all orders are available with
+    exact sparsity patterns.
+
+    3. Matrix exponential times vector
+    ==================================
+    expmv(A, v, t) computes \f$\exp(tA)v\f$ for a sparse (e.g.
+    generator) matrix A without forming the matrix exponential, by
+    the shifted and truncated Taylor series of Al-Mohy and Higham
+    (2011): \f$\exp(A)v = e^{\mu}(T_m(B/s))^sv\f$ with
+    \f$B = A - \mu I\f$. The number of substeps s and the degree m
+    are chosen from bounds of \f$\|B^p\|^{1/p}\f$ so that the
+    backward error is at unit roundoff. The cost is s*m sparse
+    matrix-vector products (proportional to the norm of B for stiff
+    matrices) and the series is accurate for any matrix.
+
+    Derivatives: The reverse mode (the gradient of \f$w'\exp(A)v\f$
+    with respect to A, v and w) stores the vectors at the substep
+    boundaries and recomputes the terms of each substep while
+    sweeping backwards. Higher derivatives are mixed directional
+    derivatives of this gradient (sparse_expmv_dir), evaluated by the
+    same sweep on truncated Taylor polynomials, so derivatives of all
+    orders (up to 5) are available.
+*/
+
+namespace atomic {
+namespace sparse {
+
+typedef Eigen::SparseMatrix<double> spmat;
+
+/** \brief Offset of the values in the argument vector */
+template<class T>
+size_t values_offset(const CppAD::vector<T>& tx) {
+  int n = CppAD::Integer(tx[0]);
+  int nnz = CppAD::Integer(tx[1]);
+  return 2 + (n + 1) + nnz;
+}
+
+/** \brief Truncated Taylor polynomial in K directions: c[m] is the
+    coefficient of \f$\prod_{i\in m}\epsilon_i\f$ (m a bit mask) with
+    \f$\epsilon_i^2=0\f$. The top coefficient is the mixed partial
+    derivative. */
+template<int K>
+struct jet {
+  enum { N = 1 << K };
+  double c[N];
+  jet() {}
+  jet(double x) {
+    c[0] = x;
+    for (int m = 1; m < N; m++) c[m] = 0;
+  }
+  jet& operator+=(const jet& y) {
+    for (int m = 0; m < N; m++) c[m] += y.c[m];
+    return *this;
+  }
+  jet& operator-=(const jet& y) {
+    for (int m = 0; m < N; m++) c[m] -= y.c[m];
+    return *this;
+  }
+  jet& operator*=(double y) {
+    for (int m = 0; m < N; m++) c[m] *= y;
+    return *this;
+  }
+  jet operator-() const {
+    jet z;
+    for (int m = 0; m < N; m++) z.c[m] = -c[m];
+    return z;
+  }
+};
+template<int K>
+jet<K> operator*(double x, jet<K> y) { return y *= x; }
+template<int K>
+jet<K> operator*(jet<K> x, double y) { return x *= y; }
+template<int K>
+jet<K> operator+(jet<K> x, const jet<K>& y) { return x += y; }
+template<int K>
+jet<K> operator-(jet<K> x, const jet<K>& y) { return x -= y; }
+template<int K>
+jet<K> operator*(const jet<K>& x, const jet<K>& y) {
+  jet<K> z;
+  for (int m = 0; m < jet<K>::N; m++) {
+    double s = 0;
+    for (int a = m; ; a = (a - 1) & m) {  /* Subsets of m */
+      s += x.c[a] * y.c[m ^ a];
+      if (a == 0) break;
+    }
+    z.c[m] = s;
+  }
+  return z;
+}
+template<int K>
+jet<K> operator/(const jet<K>& x, const jet<K>& y) {
+  jet<K> r;                             /* 1 / y */
+  r.c[0] = 1. / y.c[0];
+  for (int m = 1; m < jet<K>::N; m++) {
+    double s = 0;
+    for (int a = m; a > 0; a = (a - 1) & m) s += y.c[a] * r.c[m ^ a];
+    r.c[m] = -s * r.c[0];
+  }
+  return x * r;
+}
+template<int K>
+jet<K> sqrt(const jet<K>& x) {
+  jet<K> z;
+  z.c[0] = std::sqrt(x.c[0]);
+  for (int m = 1; m < jet<K>::N; m++) {
+    double s = x.c[m];
+    for (int a = (m - 1) & m; a > 0; a = (a - 1) & m) s -= z.c[a] * z.c[m ^ a];
+    z.c[m] = s / (2. * z.c[0]);
+  }
+  return z;
+}
+
+/** \brief Cholesky factorization of a fixed sparsity pattern.
+
+    The symbolic analysis is carried out by 'analyze' and is reused by
+    all subsequent calls to 'factorize'.
+*/
+struct factor_t {
+  /** \brief Highest order of the directional derivatives */
+  static const int max_order = 4;
+  int n;
+  std::vector<int> outer, inner;   /* Pattern of lower triangle of Q */
+  spmat Q;                         /* Template matrix (lower triangle) */
+  std::vector<int> Qpos;           /* Entries of the pattern in storage of Q */
+  Eigen::SimplicialLLT<spmat> llt;
+  std::vector<int> Lpos;           /* Entries of Q in storage of L */
+  std::vector<int> Rp, Rk, Rq;     /* Row j of strict lower L: columns Rk[Rp[j]:Rp[j+1]]
+                                      at positions Rq in storage of L */
+  std::vector<double> values;      /* Values of the current factorization */
+  bool factorized;
+  std::vector<double> Z;           /* Selected inverse (storage of L) */
+  bool Z_ok;
+  bool ok;
+  /* Same pattern as the argument vector? */
+  bool match(const CppAD::vector<double>& tx) {
+    int n_ = (int) tx[0];
+    int nnz = (int) tx[1];
+    if (n_ != n || nnz != (int) inner.size()) return false;
+    for (int j = 0; j <= n; j++)
+      if ((int) tx[2 + j] != outer[j]) return false;
+    for (int k = 0; k < nnz; k++)
+      if ((int) tx[3 + n + k] != inner[k]) return false;
+    return true;
+  }
+  void analyze(const CppAD::vector<double>& tx) {
+    n = (int) tx[0];
+    int nnz = (int) tx[1];
+    outer.resize(n + 1);
+    inner.resize(nnz);
+    for (int j = 0; j <= n; j++) outer[j] = (int) tx[2 + j];
+    for (int k = 0; k < nnz; k++) inner[k] = (int) tx[3 + n + k];
+    std::vector<Eigen::Triplet<double> > T;
+    for (int j = 0; j < n; j++)
+      for (int k = outer[j]; k < outer[j + 1]; k++)
+        T.push_back(Eigen::Triplet<double>(inner[k], j, 1));
+    Q.resize(n, n);
+    Q.setFromTriplets(T.begin(), T.end());
+    Q.makeCompressed();
+    if (Q.nonZeros() != nnz) error("sparse::factor_t: Duplicated entries");
+    Qpos.resize(nnz);
+    for (int j = 0; j < n; j++)
+      for (int k = outer[j]; k < outer[j + 1]; k++)
+        Qpos[k] = position(j, inner[k]);
+    llt.analyzePattern(Q);
+    Lpos.resize(0);
+    factorized = false;
+    Z_ok = false;
+  }
+  /* Numerical factorization (skipped if the values are unchanged) */
+  void factorize(const CppAD::vector<double>& tx) {
+    size_t offset = values_offset(tx);
+    size_t nnz = Qpos.size();
+    if (factorized && values.size() == nnz &&
+        std::equal(values.begin(), values.end(), &tx[0] + offset)) return;
+    values.assign(&tx[0] + offset, &tx[0] + offset + nnz);
+    for (size_t k = 0; k < nnz; k++)
+      Q.valuePtr()[Qpos[k]] = values[k];
+    llt.factorize(Q);
+    ok = (llt.info() == Eigen::Success);
+    if (ok && Lpos.size() == 0) locate();
+    factorized = true;
+    Z_ok = false;
+  }
+  /* Position of entry (i,j) in the storage of Q */
+  int position(int j, int i) {
+    const int* begin = Q.innerIndexPtr() + Q.outerIndexPtr()[j];
+    const int* end = Q.innerIndexPtr() + Q.outerIndexPtr()[j + 1];
+    return std::lower_bound(begin, end, i) - Q.innerIndexPtr();
+  }
+  const spmat& L() const { return llt.matrixL().nestedExpression(); }
+  /* Position of permuted entry (i,j) (i>=j) in the storage of L.
+     The rows of L are sorted within columns (diagonal first). Also
+     the row structure of L. */
+  void locate() {
+    const spmat& L_ = L();
+    const int* Lp = L_.outerIndexPtr();
+    const int* Li = L_.innerIndexPtr();
+    const int* perm = llt.permutationP().indices().data();
+    Lpos.resize(inner.size());
+    for (int j = 0; j < n; j++) {
+      for (int k = outer[j]; k < outer[j + 1]; k++) {
+        int r = perm[inner[k]], c = perm[j];
+        if (r < c) std::swap(r, c);
+        Lpos[k] = std::lower_bound(Li + Lp[c], Li + Lp[c + 1], r) - Li;
+      }
+    }
+    Rp.assign(n + 1, 0);
+    for (int c = 0; c < n; c++)
+      for (int q = Lp[c] + 1; q < Lp[c + 1]; q++) Rp[Li[q] + 1]++;
+    for (int j = 0; j < n; j++) Rp[j + 1] += Rp[j];
+    Rk.resize(Rp[n]);
+    Rq.resize(Rp[n]);
+    std::vector<int> pos(Rp.begin(), Rp.end() - 1);
+    for (int c = 0; c < n; c++) {
+      for (int q = Lp[c] + 1; q < Lp[c + 1]; q++) {
+        int r = pos[Li[q]]++;
+        Rk[r] = c;
+        Rq[r] = q;
+      }
+    }
+  }
+  double logdet() {
+    if (!ok) return NAN;
+    const spmat& L_ = L();
+    double ans = 0;
+    for (int j = 0; j < n; j++) ans += std::log(L_.valuePtr()[L_.outerIndexPtr()[j]]);
+    return 2. * ans;
+  }
+  /** \brief Left looking Cholesky factorization on the pattern of L.
+      On input Lx holds the permuted lower triangle of Q (zero in fill
+      entries) in the storage order of L. */
+  template<class T>
+  void cholesky(T* Lx) const {
+    using std::sqrt;
+    const spmat& L_ = L();
+    const int* Lp = L_.outerIndexPtr();
+    const int* Li = L_.innerIndexPtr();
+    std::vector<T> x(n, T(0));
+    for (int j = 0; j < n; j++) {
+      for (int p = Lp[j]; p < Lp[j + 1]; p++) x[Li[p]] = Lx[p];
+      for (int r = Rp[j]; r < Rp[j + 1]; r++) {
+        /* Subtract column k of L times L(j,k) */
+        int k = Rk[r];
+        T f = Lx[Rq[r]];
+        for (int p = Rq[r]; p < Lp[k + 1]; p++) x[Li[p]] -= Lx[p] * f;
+      }
+      T d = sqrt(x[j]);
+      Lx[Lp[j]] = d;
+      x[j] = T(0);
+      for (int p = Lp[j] + 1; p < Lp[j + 1]; p++) {
+        Lx[p] = x[Li[p]] / d;
+        x[Li[p]] = T(0);
+      }
+    }
+  }
+  /** \brief Selected inverse: the entries of \f$(LL')^{-1}\f$ on the
+      pattern of L (Takahashi recursions), in the storage order of L. */
+  template<class T>
+  std::vector<T> takahashi(const T* Lx) const {
+    const spmat& L_ = L();
+    const int* Lp = L_.outerIndexPtr();
+    const int* Li = L_.innerIndexPtr();
+    std::vector<T> Z(L_.nonZeros());
+    std::vector<int> pos(n, -1);
+    std::vector<T> acc;
+    for (int j = n - 1; j >= 0; j--) {
+      int m = Lp[j + 1] - Lp[j] - 1; /* Number of strict lower entries */
+      const int* s = Li + Lp[j] + 1;
+      const T* l = Lx + Lp[j] + 1;
+      T Ljj = Lx[Lp[j]];
+      acc.assign(m, T(0));
+      for (int a = 0; a < m; a++) pos[s[a]] = a;
+      /* acc[a] = sum_k L(k,j) * Z(s[a],k) over k in struct(j) */
+      for (int b = 0; b < m; b++) {
+        int k = s[b];
+        acc[b] += l[b] * Z[Lp[k]];
+        for (int q = Lp[k] + 1; q < Lp[k + 1]; q++) {
+          int a = pos[Li[q]];
+          if (a >= 0) {
+            acc[a] += l[b] * Z[q];
+            acc[b] += l[a] * Z[q];
+          }
+        }
+      }
+      T sum = T(0);
+      for (int a = 0; a < m; a++) {
+        Z[Lp[j] + 1 + a] = -acc[a] / Ljj;
+        sum += l[a] * Z[Lp[j] + 1 + a];
+        pos[s[a]] = -1;
+      }
+      Z[Lp[j]] = T(1) / (Ljj * Ljj) - sum / Ljj;
+    }
+    return Z;
+  }
+  /** \brief Entries of \f$Q^{-1}\f$ on the pattern of Q */
+  void inverse_subset(double* ans) {
+    if (!ok) {
+      for (size_t p = 0; p < inner.size(); p++) ans[p] = NAN;
+      return;
+    }
+    if (!Z_ok) {
+      Z = takahashi(L().valuePtr());
+      Z_ok = true;
+    }
+    for (size_t p = 0; p < inner.size(); p++) ans[p] = Z[Lpos[p]];
+  }
+  /* Directional derivative of order K (see 'directional' below) */
+  template<int K>
+  void directional(const double* q, const double* w, double* ans) const {
+    size_t nnz = inner.size();
+    std::vector<jet<K> > Lx(L().nonZeros(), jet<K>(0.));
+    for (size_t p = 0; p < nnz; p++) {
+      jet<K>& a = Lx[Lpos[p]];
+      a.c[0] = q[p];
+      for (int i = 0; i < K; i++) a.c[1 << i] = -w[i * nnz + p];
+    }
+    cholesky(&Lx[0]);
+    std::vector<jet<K> > Zk = takahashi(&Lx[0]);
+    for (size_t p = 0; p < nnz; p++) ans[p] = Zk[Lpos[p]].c[jet<K>::N - 1];
+  }
+  /** \brief Mixed directional derivative
+      \f$D_k(Q;W_1,...,W_k)\f$ of the selected inverse on the pattern
+      of Q, where tx = [pattern, values, w_1, ..., w_k] and \f$W_i\f$
+      is the symmetric matrix with lower triangle \f$w_i\f$. */
+  void directional(const CppAD::vector<double>& tx, double* ans) const {
+    size_t offset = values_offset(tx);
+    size_t nnz = inner.size();
+    if (nnz == 0) return;
+    int k = (tx.size() - offset) / nnz - 1;
+    const double* w = &tx[0] + offset + nnz;
+    bool zero = false;                  /* Multilinear in w_1, ..., w_k */
+    for (int i = 0; i < k && !zero; i++) {
+      zero = true;
+      for (size_t p = 0; p < nnz; p++) zero = zero && (w[i * nnz + p] == 0);
+    }
+    if (zero || !ok) {
+      for (size_t p = 0; p < nnz; p++) ans[p] = (zero ? 0 : NAN);
+      return;
+    }
+    const double* q = &tx[0] + offset;
+    switch (k) {
+    case 1: directional<1>(q, w, ans); break;
+    case 2: directional<2>(q, w, ans); break;
+    case 3: directional<3>(q, w, ans); break;
+    case 4: directional<4>(q, w, ans); break;
+    default: error("sparse_invsubset: Derivative order not implemented");
+    }
+  }
+};
+
+/** \brief Factorization of the argument vector 'tx'.
+
+    Each thread keeps the factorizations of the most recently used
+    patterns so that the symbolic analysis is only done once per
+    pattern. The numerical factorization is redone only if the values
+    differ from the previous call for the same pattern.
+*/
+inline factor_t& factor(const CppAD::vector<double>& tx) {
+  typedef std::vector<factor_t*> list_t;
+  static const size_t max_cached = 8;
+  static std::vector<list_t*> cache;
+  list_t* tcache;
+  size_t thread = 0;
+#ifdef _OPENMP
+  thread = omp_get_thread_num();
+#pragma omp critical (atomic_sparse_factor)
+#endif
+  {
+    if (cache.size() <= thread) cache.resize(thread + 1, NULL);
+    if (cache[thread] == NULL) cache[thread] = new list_t();
+    tcache = cache[thread];
+  }
+  /* Most recently used first */
+  size_t i = 0;
+  while (i < tcache->size() && !(*tcache)[i]->match(tx)) i++;
+  if (i == tcache->size()) {
+    if (tcache->size() >= max_cached) {
+      delete tcache->back();
+      tcache->pop_back();
+    }
+    factor_t* F = new factor_t();
+    F->analyze(tx);
+    tcache->insert(tcache->begin(), F);
+  } else {
+    std::rotate(tcache->begin(), tcache->begin() + i, tcache->begin() + i + 1);
+  }
+  factor_t& F = *(*tcache)[0];
+  F.factorize(tx);
+  return F;
+}
+
+/** \brief Which entries of the lower triangle pattern are diagonal */
+template<class T>
+std::vector<bool> diagonal_entries(const CppAD::vector<T>& tx) {
+  int n = CppAD::Integer(tx[0]);
+  std::vector<bool> diag(CppAD::Integer(tx[1]));
+  for (int j = 0; j < n; j++)
+    for (int k = CppAD::Integer(tx[2 + j]); k < CppAD::Integer(tx[3 + j]); k++)
+      diag[k] = (CppAD::Integer(tx[3 + n + k]) == j);
+  return diag;
+}
+
+} // End namespace sparse
+
+/** \brief Directional derivatives of sparse_invsubset.
+    \param x Input vector [n, nnz, outer, inner, values, w_1, ..., w_k]
+    where \f$w_i\f$ is the lower triangle of a symmetric matrix
+    \f$W_i\f$ on the pattern.
+    \return \f$D_k(Q;W_1,...,W_k)\f$ on the pattern (length nnz), see
+    atomic_sparse.hpp. In particular \f$D_1(Q;W)=Q^{-1}WQ^{-1}\f$.
+*/
+TMB_ATOMIC_VECTOR_FUNCTION(
+			   // ATOMIC_NAME
+			   sparse_invsubset_dir
+			   ,
+			   // OUTPUT_DIM
+			   CppAD::Integer(tx[1])
+			   ,
+			   // ATOMIC_DOUBLE
+			   sparse::factor(tx).directional(tx, &ty[0]);
+			   ,
+			   // ATOMIC_REVERSE
+			   /* Q: -D_{k+1}(Q;W,V), W_i: D_k(Q;W_{-i},V) where V
+			      is the symmetric matrix of the adjoint py */
+			   size_t offset = sparse::values_offset(tx);
+			   size_t nnz = py.size();
+			   for(size_t i=0; i<tx.size(); i++) px[i] = Type(0);
+			   if(nnz == 0) return;
+			   size_t k = (tx.size() - offset) / nnz - 1;
+			   std::vector<bool> diag = sparse::diagonal_entries(tx);
+			   CppAD::vector<Type> arg(tx.size() + nnz);
+			   for(size_t i=0; i<tx.size(); i++) arg[i] = tx[i];
+			   for(size_t p=0; p<nnz; p++) arg[tx.size()+p] = (diag[p] ? py[p] : Type(.5) * py[p]);
+			   CppAD::vector<Type> S = sparse_invsubset_dir(arg);
+			   for(size_t p=0; p<nnz; p++) px[offset+p] = -(diag[p] ? Type(1) : Type(2)) * S[p];
+			   for(size_t i=1; i<=k; i++){
+			     CppAD::vector<Type> argi(tx.size());
+			     for(size_t j=0; j<tx.size(); j++) argi[j] = tx[j];
+			     for(size_t p=0; p<nnz; p++) argi[offset+i*nnz+p] = arg[tx.size()+p];
+			     S = sparse_invsubset_dir(argi);
+			     for(size_t p=0; p<nnz; p++) px[offset+i*nnz+p] = (diag[p] ? Type(1) : Type(2)) * S[p];
+			   }
+			   )
+
+/** \brief Atomic selected inverse of a sparse positive definite matrix.
+    \param x Input vector [n, nnz, outer, inner, values] of the lower
+    triangle (see atomic_sparse.hpp).
+    \return Entries of the inverse on the pattern of x (length nnz).
+*/
+TMB_ATOMIC_VECTOR_FUNCTION(
+			   // ATOMIC_NAME
+			   sparse_invsubset
+			   ,
+			   // OUTPUT_DIM
+			   CppAD::Integer(tx[1])
+			   ,
+			   // ATOMIC_DOUBLE
+			   sparse::factor(tx).inverse_subset(&ty[0]);
+			   ,
+			   // ATOMIC_REVERSE  (-Q^-1 V Q^-1 on the pattern)
+			   size_t offset = sparse::values_offset(tx);
+			   size_t nnz = py.size();
+			   for(size_t i=0; i<offset; i++) px[i] = Type(0);
+			   if(nnz == 0) return;
+			   std::vector<bool> diag = sparse::diagonal_entries(tx);
+			   CppAD::vector<Type> arg(offset + 2 * nnz);
+			   for(size_t i=0; i<offset + nnz; i++) arg[i] = tx[i];
+			   for(size_t p=0; p<nnz; p++) arg[offset+nnz+p] = (diag[p] ? py[p] : Type(.5) * py[p]);
+			   CppAD::vector<Type> S = sparse_invsubset_dir(arg);
+			   for(size_t p=0; p<nnz; p++) px[offset+p] = -(diag[p] ? Type(1) : Type(2)) * S[p];
+			   )
+
+/** \brief Atomic log determinant of a sparse positive definite matrix.
+    \param x Input vector [n, nnz, outer, inner, values] of the lower
+    triangle (see atomic_sparse.hpp).
+    \return Vector of length 1.
+*/
+TMB_ATOMIC_VECTOR_FUNCTION(
+			   // ATOMIC_NAME
+			   sparse_logdet
+			   ,
+			   // OUTPUT_DIM
+			   1
+			   ,
+			   // ATOMIC_DOUBLE
+			   ty[0] = sparse::factor(tx).logdet();
+			   ,
+			   // ATOMIC_REVERSE  (tr(Q^-1 dQ))
+			   size_t offset = sparse::values_offset(tx);
+			   int n = CppAD::Integer(tx[0]);
+			   CppAD::vector<Type> S = sparse_invsubset(tx);
+			   for(size_t i=0; i<offset; i++) px[i] = Type(0);
+			   for(int j=0, p=0; j<n; j++){
+			     for(int k=CppAD::Integer(tx[2+j]); k<CppAD::Integer(tx[3+j]); k++, p++){
+			       Type w = (CppAD::Integer(tx[3+n+k]) == j ? Type(1) : Type(2));
+			       px[offset+p] = w * S[p] * py[0];
+			     }
+			   }
+			   )
+
+/** \brief Pack the lower triangle of a sparse matrix (see atomic_sparse.hpp) */
+template<class Type>
+CppAD::vector<Type> sparse_arg(const Eigen::SparseMatrix<Type> &Q) {
+  typedef typename Eigen::SparseMatrix<Type>::InnerIterator Iterator;
+  int n = Q.cols();
+  std::vector<int> outer(n + 1), inner;
+  std::vector<Type> values;
+  outer[0] = 0;
+  for (int j = 0; j < n; j++) {
+    for (Iterator it(Q, j); it; ++it) {
+      if (it.row() >= j) {
+        inner.push_back(it.row());
+        values.push_back(it.value());
+      }
+    }
+    outer[j + 1] = inner.size();
+  }
+  int nnz = inner.size();
+  CppAD::vector<Type> arg(2 + (n + 1) + 2 * nnz);
+  arg[0] = Type(n);
+  arg[1] = Type(nnz);
+  for (int j = 0; j <= n; j++) arg[2 + j] = Type(outer[j]);
+  for (int k = 0; k < nnz; k++) arg[3 + n + k] = Type(inner[k]);
+  for (int k = 0; k < nnz; k++) arg[3 + n + nnz + k] = values[k];
+  return arg;
+}
+
+/** \brief Log determinant of a sparse positive definite matrix.
+
+    Only the lower triangle of Q is used. The result occupies one
+    node on the tape. The sparsity pattern (including explicitly
+    stored zeros) is taken as fixed.
+*/
+template<class Type>
+Type logdet(const Eigen::SparseMatrix<Type> &Q) {
+  if (Q.rows() != Q.cols()) error("logdet: Matrix must be square");
+  return sparse_logdet(sparse_arg(Q))[0];
+}
+
+/** \brief Diagonal of the inverse of a sparse positive definite
+    matrix, e.g. the marginal variances of a GMRF with precision Q.
+
+    Computed by selected inversion (sparse_invsubset) at roughly the
+    cost of the Cholesky factorization instead of a dense inverse.
+    Only the lower triangle of Q is used. Derivatives up to order
+    four are available (sparse_invsubset_dir) and cost a few sparse
+    triangular sweeps each, i.e. the Hessian tape does not contain a
+    dense inverse.
+*/
+template<class Type>
+vector<Type> inverse_diagonal(const Eigen::SparseMatrix<Type> &Q) {
+  if (Q.rows() != Q.cols()) error("inverse_diagonal: Matrix must be square");
+  CppAD::vector<Type> arg = sparse_arg(Q);
+  CppAD::vector<Type> S = sparse_invsubset(arg);
+  int n = Q.cols();
+  vector<Type> ans(n);
+  for (int j = 0; j < n; j++) {
+    /* Diagonal is the first entry of column j of the lower triangle */
+    int k = CppAD::Integer(arg[2 + j]);
+    if (k == CppAD::Integer(arg[3 + j]) || CppAD::Integer(arg[3 + n + k]) != j)
+      error("inverse_diagonal: Diagonal entries missing from pattern");
+    ans[j] = S[k];
+  }
+  return ans;
+}
+
+namespace sparse {
+
+/** \brief Compressed column patterns [nrow, ncol, nnz, outer (ncol+1),
+    inner (nnz)] referred to by the argument vectors of the matrix-vector
+    atomics. A pattern is registered once (when a tape is recorded) and
+    is never removed, so references to it remain valid. */
+struct csc_registry_t {
+  std::map<std::vector<int>, int> index;
+  std::vector<const std::vector<int>*> pattern;
+  std::vector<int> transposed;     /* Index of the transpose (-1: not yet known) */
+};
+/* The registry must only be touched inside the critical section */
+inline csc_registry_t& csc_registry() {
+  static csc_registry_t registry;
+  return registry;
+}
+/** \brief Index of a pattern (registered if new) */
+inline int csc_register(const std::vector<int>& pattern) {
+  int id;
+#ifdef _OPENMP
+#pragma omp critical (atomic_sparse_csc)
+#endif
+  {
+    csc_registry_t& R = csc_registry();
+    std::map<std::vector<int>, int>::iterator it = R.index.find(pattern);
+    if (it == R.index.end()) {
+      id = R.pattern.size();
+      it = R.index.insert(std::make_pair(pattern, id)).first;
+      R.pattern.push_back(&(it->first));
+      R.transposed.push_back(-1);
+    } else {
+      id = it->second;
+    }
+  }
+  return id;
+}
+/** \brief Pattern with index 'id' */
+inline const std::vector<int>& csc_lookup(int id) {
+  const std::vector<int>* ans;
+#ifdef _OPENMP
+#pragma omp critical (atomic_sparse_csc)
+#endif
+  {
+    csc_registry_t& R = csc_registry();
+    ans = (id >= 0 && id < (int) R.pattern.size() ? R.pattern[id] : NULL);
+  }
+  if (ans == NULL) error("atomic_sparse: Unknown sparsity pattern");
+  return *ans;
+}
+/** \brief Offset of the values in the argument vector */
+static const size_t csc_values = 1;
+/** \brief Dimension 'i' (0: nrow, 1: ncol, 2: nnz) of the pattern of
+    an argument vector */
+template<class T>
+int csc_dim(const CppAD::vector<T>& tx, int i) {
+  return csc_lookup(CppAD::Integer(tx[0]))[i];
+}
+
+/** \brief Compressed column pattern referred to by an argument vector
+    [pattern, ...] (see csc_register) */
+template<class T>
+struct csc_t {
+  const CppAD::vector<T>& tx;
+  int id;
+  const int* P;                    /* [nrow, ncol, nnz, outer, inner] */
+  int nrow, ncol, nnz;
+  size_t V;                        /* Offset of the data after the pattern */
+  csc_t(const CppAD::vector<T>& tx_) : tx(tx_) {
+    id = CppAD::Integer(tx[0]);
+    P = &csc_lookup(id)[0];
+    nrow = P[0];
+    ncol = P[1];
+    nnz = P[2];
+    V = csc_values;
+  }
+  int outer(int j) const { return P[3 + j]; }
+  int inner(int k) const { return P[4 + ncol + k]; }
+  /* Index of the transposed pattern */
+  int transposed() const {
+    int ans;
+#ifdef _OPENMP
+#pragma omp critical (atomic_sparse_csc)
+#endif
+    ans = csc_registry().transposed[id];
+    if (ans >= 0) return ans;
+    std::vector<int> pattern(4 + nrow + nnz);
+    int* pos = &pattern[3];
+    pattern[0] = ncol; pattern[1] = nrow; pattern[2] = nnz;
+    for (int k = 0; k < nnz; k++) pos[inner(k) + 1]++;
+    for (int i = 0; i < nrow; i++) pos[i + 1] += pos[i];
+    std::vector<int> next(pos, pos + nrow);
+    for (int j = 0; j < ncol; j++)
+      for (int k = outer(j); k < outer(j + 1); k++)
+        pattern[4 + nrow + next[inner(k)]++] = j;
+    ans = csc_register(pattern);
+#ifdef _OPENMP
+#pragma omp critical (atomic_sparse_csc)
+#endif
+    csc_registry().transposed[id] = ans;
+    return ans;
+  }
+  /* y = A x where A has values a */
+  void matvec(const T* a, const T* x, T* y) const {
+    for (int i = 0; i < nrow; i++) y[i] = T(0);
+    for (int j = 0; j < ncol; j++)
+      for (int k = outer(j); k < outer(j + 1); k++) y[inner(k)] += a[k] * x[j];
+  }
+  /* y = A' w where A has values a */
+  void tmatvec(const T* a, const T* w, T* y) const {
+    for (int j = 0; j < ncol; j++) {
+      T s = T(0);
+      for (int k = outer(j); k < outer(j + 1); k++) s += a[k] * w[inner(k)];
+      y[j] = s;
+    }
+  }
+  /* y[k] = a[i] * b[j] for entry k=(i,j) of the pattern */
+  void outer_product(const T* a, const T* b, T* y) const {
+    for (int j = 0; j < ncol; j++)
+      for (int k = outer(j); k < outer(j + 1); k++) y[k] = a[inner(k)] * b[j];
+  }
+  /* Pattern of tx followed by u[u0 + (0:nu-1)] and v[v0 + (0:nv-1)] */
+  CppAD::vector<T> join(const CppAD::vector<T>& u, size_t u0, size_t nu,
+                        const CppAD::vector<T>& v, size_t v0, size_t nv) const {
+    CppAD::vector<T> ans(V + nu + nv);
+    for (size_t i = 0; i < V; i++) ans[i] = tx[i];
+    for (size_t i = 0; i < nu; i++) ans[V + i] = u[u0 + i];
+    for (size_t i = 0; i < nv; i++) ans[V + nu + i] = v[v0 + i];
+    return ans;
+  }
+  /* Pattern and values of the transpose followed by u[u0 + (0:nu-1)] */
+  CppAD::vector<T> transpose_join(const CppAD::vector<T>& u, size_t u0,
+                                  size_t nu) const {
+    size_t Vt = csc_values;
+    CppAD::vector<T> ans(Vt + nnz + nu);
+    std::vector<int> pos(nrow + 1, 0);
+    for (int k = 0; k < nnz; k++) pos[inner(k) + 1]++;
+    for (int i = 0; i < nrow; i++) pos[i + 1] += pos[i];
+    ans[0] = T(transposed());
+    for (int j = 0; j < ncol; j++) {
+      for (int k = outer(j); k < outer(j + 1); k++) {
+        int p = pos[inner(k)]++;
+        ans[Vt + p] = tx[V + k];
+      }
+    }
+    for (size_t i = 0; i < nu; i++) ans[Vt + nnz + i] = u[u0 + i];
+    return ans;
+  }
+};
+
+/** \brief Sparsity of sparse_matvec (KIND=0), sparse_tmatvec (KIND=1)
+    and sparse_outer (KIND=2) (see signature_sparsity). The signature
+    holds the pattern in both column and row compressed form. */
+template<int KIND>
+struct csc_pattern {
+  template<class T>
+  static void signature(const CppAD::vector<T>& tx, std::vector<int>& sig) {
+    csc_t<T> P(tx);
+    /* [nrow, ncol, nnz, outer, inner, rowptr, rowk, colk] */
+    sig.resize(3 + (P.ncol + 1) + P.nnz + (P.nrow + 1) + 2 * P.nnz);
+    sig[0] = P.nrow; sig[1] = P.ncol; sig[2] = P.nnz;
+    int* outer = &sig[3];
+    int* inner = outer + P.ncol + 1;
+    int* rowptr = inner + P.nnz;
+    int* rowk = rowptr + P.nrow + 1;
+    int* colk = rowk + P.nnz;
+    for (int j = 0; j <= P.ncol; j++) outer[j] = P.outer(j);
+    for (int i = 0; i <= P.nrow; i++) rowptr[i] = 0;
+    for (int j = 0; j < P.ncol; j++) {
+      for (int k = outer[j]; k < outer[j + 1]; k++) {
+        inner[k] = P.inner(k);
+        colk[k] = j;
+        rowptr[inner[k] + 1]++;
+      }
+    }
+    for (int i = 0; i < P.nrow; i++) rowptr[i + 1] += rowptr[i];
+    std::vector<int> pos(rowptr, rowptr + P.nrow);
+    for (int k = 0; k < P.nnz; k++) rowk[pos[inner[k]]++] = k;
+  }
+  static void inputs(const std::vector<int>& sig, size_t i,
+                     std::vector<size_t>& in) {
+    int nrow = sig[0], ncol = sig[1], nnz = sig[2];
+    const int* outer = &sig[3];
+    const int* inner = outer + ncol + 1;
+    const int* rowptr = inner + nnz;
+    const int* rowk = rowptr + nrow + 1;
+    const int* colk = rowk + nnz;
+    size_t V = csc_values;
+    in.resize(0);
+    if (KIND == 0) {        /* Row i of A x */
+      for (int p = rowptr[i]; p < rowptr[i + 1]; p++) {
+        in.push_back(V + rowk[p]);
+        in.push_back(V + nnz + colk[rowk[p]]);
+      }
+    } else if (KIND == 1) { /* Column i of A' w */
+      for (int k = outer[i]; k < outer[i + 1]; k++) {
+        in.push_back(V + k);
+        in.push_back(V + nnz + inner[k]);
+      }
+    } else {                /* Entry i of the pattern */
+      in.push_back(V + inner[i]);
+      in.push_back(V + nrow + colk[i]);
+    }
+  }
+};
+
+} // End namespace sparse
+
+/* Forward declarations (the derivatives are mutually recursive) */
+CppAD::vector<double> sparse_tmatvec(const CppAD::vector<double>& tx);
+template <class Type>
+CppAD::vector<AD<Type> > sparse_tmatvec(const CppAD::vector<AD<Type> >& tx);
+CppAD::vector<double> sparse_outer(const CppAD::vector<double>& tx);
+template <class Type>
+CppAD::vector<AD<Type> > sparse_outer(const CppAD::vector<AD<Type> >& tx);
+
+/** \brief Atomic sparse matrix-vector product.
+    \param x Input vector [pattern, values, x] (see atomic_sparse.hpp).
+    \return Vector of length nrow.
+*/
+TMB_ATOMIC_VECTOR_FUNCTION_SPARSE(
+			   // ATOMIC_NAME
+			   sparse_matvec
+			   ,
+			   // OUTPUT_DIM
+			   sparse::csc_dim(tx, 0)
+			   ,
+			   // ATOMIC_DOUBLE
+			   sparse::csc_t<double> P(tx);
+			   P.matvec(&tx[P.V], &tx[P.V + P.nnz], &ty[0]);
+			   ,
+			   // ATOMIC_REVERSE
+			   sparse::csc_t<Type> P(tx);
+			   size_t X = P.V + P.nnz;
+			   CppAD::vector<Type> pa = sparse_outer(P.join(py, 0, P.nrow, tx, X, P.ncol));
+			   CppAD::vector<Type> pw = sparse_tmatvec(P.join(tx, P.V, P.nnz, py, 0, P.nrow));
+			   for(size_t i=0; i<P.V; i++) px[i] = Type(0);
+			   for(int k=0; k<P.nnz; k++) px[P.V + k] = pa[k];
+			   for(int j=0; j<P.ncol; j++) px[X + j] = pw[j];
+			   ,
+			   // SPARSITY
+			   signature_sparsity<sparse::csc_pattern<0> >
+			   )
+
+/** \brief Atomic transposed sparse matrix-vector product.
+    \param x Input vector [pattern, values, w] (see atomic_sparse.hpp).
+    \return Vector of length ncol.
+*/
+TMB_ATOMIC_VECTOR_FUNCTION_SPARSE(
+			   // ATOMIC_NAME
+			   sparse_tmatvec
+			   ,
+			   // OUTPUT_DIM
+			   sparse::csc_dim(tx, 1)
+			   ,
+			   // ATOMIC_DOUBLE
+			   sparse::csc_t<double> P(tx);
+			   P.tmatvec(&tx[P.V], &tx[P.V + P.nnz], &ty[0]);
+			   ,
+			   // ATOMIC_REVERSE
+			   sparse::csc_t<Type> P(tx);
+			   size_t W = P.V + P.nnz;
+			   CppAD::vector<Type> pa = sparse_outer(P.join(tx, W, P.nrow, py, 0, P.ncol));
+			   CppAD::vector<Type> pw = sparse_matvec(P.join(tx, P.V, P.nnz, py, 0, P.ncol));
+			   for(size_t i=0; i<P.V; i++) px[i] = Type(0);
+			   for(int k=0; k<P.nnz; k++) px[P.V + k] = pa[k];
+			   for(int i=0; i<P.nrow; i++) px[W + i] = pw[i];
+			   ,
+			   // SPARSITY
+			   signature_sparsity<sparse::csc_pattern<1> >
+			   )
+
+/** \brief Atomic outer product on a sparsity pattern.
+    \param x Input vector [pattern, a, b] with a of length nrow and b
+    of length ncol (see atomic_sparse.hpp).
+    \return Vector of length nnz with entry a[i]*b[j] for each entry
+    (i,j) of the pattern.
+*/
+TMB_ATOMIC_VECTOR_FUNCTION_SPARSE(
+			   // ATOMIC_NAME
+			   sparse_outer
+			   ,
+			   // OUTPUT_DIM
+			   sparse::csc_dim(tx, 2)
+			   ,
+			   // ATOMIC_DOUBLE
+			   sparse::csc_t<double> P(tx);
+			   P.outer_product(&tx[P.V], &tx[P.V + P.nrow], &ty[0]);
+			   ,
+			   // ATOMIC_REVERSE
+			   sparse::csc_t<Type> P(tx);
+			   size_t B = P.V + P.nrow;
+			   CppAD::vector<Type> pa = sparse_matvec(P.join(py, 0, P.nnz, tx, B, P.ncol));
+			   CppAD::vector<Type> pb = sparse_tmatvec(P.join(py, 0, P.nnz, tx, P.V, P.nrow));
+			   for(size_t i=0; i<P.V; i++) px[i] = Type(0);
+			   for(int i=0; i<P.nrow; i++) px[P.V + i] = pa[i];
+			   for(int j=0; j<P.ncol; j++) px[B + j] = pb[j];
+			   ,
+			   // SPARSITY
+			   signature_sparsity<sparse::csc_pattern<2> >
+			   )
+
+/** \brief Atomic quadratic form x'Qx of a square sparse matrix.
+    \param x Input vector [pattern, values, x] (see atomic_sparse.hpp).
+    \return Vector of length 1.
+*/
+TMB_ATOMIC_VECTOR_FUNCTION(
+			   // ATOMIC_NAME
+			   sparse_quadform
+			   ,
+			   // OUTPUT_DIM
+			   1
+			   ,
+			   // ATOMIC_DOUBLE
+			   sparse::csc_t<double> P(tx);
+			   const double* x = &tx[P.V + P.nnz];
+			   std::vector<double> Qx(P.nrow);
+			   P.matvec(&tx[P.V], x, &Qx[0]);
+			   double s = 0;
+			   for(int i=0; i<P.nrow; i++) s += x[i] * Qx[i];
+			   ty[0] = s;
+			   ,
+			   // ATOMIC_REVERSE  (x x' on the pattern and (Q+Q')x)
+			   sparse::csc_t<Type> P(tx);
+			   size_t X = P.V + P.nnz;
+			   CppAD::vector<Type> wx(P.ncol);
+			   for(int j=0; j<P.ncol; j++) wx[j] = py[0] * tx[X + j];
+			   CppAD::vector<Type> pa = sparse_outer(P.join(wx, 0, P.nrow, tx, X, P.ncol));
+			   CppAD::vector<Type> Qx = sparse_matvec(P.join(tx, P.V, P.nnz, wx, 0, P.ncol));
+			   CppAD::vector<Type> Qtx = sparse_tmatvec(P.join(tx, P.V, P.nnz, wx, 0, P.nrow));
+			   for(size_t i=0; i<P.V; i++) px[i] = Type(0);
+			   for(int k=0; k<P.nnz; k++) px[P.V + k] = pa[k];
+			   for(int j=0; j<P.ncol; j++) px[X + j] = Qx[j] + Qtx[j];
+			   )
+
+namespace sparse {
+
+/** \brief Truncated Taylor approximation of \f$\exp(A)\f$ acting on
+    vectors (Al-Mohy and Higham, 2011): With the shift
+    \f$\mu = \mathrm{tr}(A)/n\f$ and \f$B = A - \mu I\f$,
+    \f[ \exp(A)v = e^{\mu} \left(T_m(B/s)\right)^s v \f]
+    where \f$T_m\f$ is the Taylor polynomial of degree m. The number of
+    substeps s and the degree m minimize the number of matrix-vector
+    products s*m subject to a backward error bound of unit roundoff.
+
+    The shift, s and m are chosen from A (symmetrically in A and A')
+    and are constants of the approximation. The derivatives are
+    those of the polynomial, so all orders are consistent. If A has
+    non-finite entries the result and all derivatives are NaN. Member
+    functions are templated by the scalar type of the values (double
+    or jet). */
+struct taylor_expmv_t {
+  int n;
+  std::vector<int> outer, inner;
+  double mu;               /* Shift */
+  int s, m;                /* Number of substeps and Taylor degree */
+  double eta;              /* exp(mu/s) */
+  bool finite;             /* Finite norm bound of A? */
+  template<class T>
+  taylor_expmv_t(const csc_t<T>& C, const double* a) {
+    n = C.nrow;
+    outer.resize(C.ncol + 1);
+    inner.resize(C.nnz);
+    for (int j = 0; j <= C.ncol; j++) outer[j] = C.outer(j);
+    for (int k = 0; k < C.nnz; k++) inner[k] = C.inner(k);
+    mu = 0;
+    for (int j = 0; j < n; j++)
+      for (int k = outer[j]; k < outer[j + 1]; k++)
+        if (inner[k] == j) mu += a[k];
+    mu = (n > 0 ? mu / n : 0);
+    select(a);
+    eta = exp(mu / s);
+  }
+  /* y = |B| x (or |B|' x) for the norm bounds */
+  void abs_apply(const double* a, const double* x, double* y,
+                 bool transpose) const {
+    for (int i = 0; i < n; i++) y[i] = fabs(mu) * x[i];
+    for (int j = 0; j < n; j++) {
+      for (int k = outer[j]; k < outer[j + 1]; k++) {
+        int i = inner[k];
+        double b = (i == j ? fabs(a[k] - mu) - fabs(mu) : fabs(a[k]));
+        if (transpose) y[j] += b * x[i]; else y[i] += b * x[j];
+      }
+    }
+  }
+  /* Upper bound of max(||B^p||_1, ||B^p||_inf)^(1/p) */
+  double norm_bound(const double* a, int p) const {
+    double ans = 0;
+    std::vector<double> x(n), y(n);
+    for (int t = 0; t < 2; t++) {
+      std::fill(x.begin(), x.end(), 1.);
+      for (int r = 0; r < p; r++) {
+        abs_apply(a, &x[0], &y[0], t == 0);
+        x.swap(y);
+      }
+      for (int i = 0; i < n; i++) ans = std::max(ans, x[i]);
+    }
+    return pow(ans, 1. / p);
+  }
+  /* Choice of s and m (Al-Mohy and Higham, 2011, Algorithm 3.2 without
+     early termination) */
+  void select(const double* a) {
+    /* theta_m for double precision */
+    static const int nm = 35;
+    static const int mm[nm] = { 1,  2,  3,  4,  5,  6,  7,  8,  9, 10,
+                               11, 12, 13, 14, 15, 16, 17, 18, 19, 20,
+                               21, 22, 23, 24, 25, 26, 27, 28, 29, 30,
+                               35, 40, 45, 50, 55};
+    static const double theta[nm] = {
+      2.29e-16, 2.58e-8, 1.39e-5, 3.40e-4, 2.40e-3, 9.07e-3, 2.38e-2,
+      5.00e-2, 8.96e-2, 1.44e-1, 2.14e-1, 3.00e-1, 4.00e-1, 5.14e-1,
+      6.41e-1, 7.81e-1, 9.31e-1, 1.09, 1.26, 1.44, 1.62, 1.82, 2.01,
+      2.22, 2.43, 2.64, 2.86, 3.08, 3.31, 3.54, 4.7, 6.0, 7.2, 8.5, 9.9};
+    const int p_max = 8, m_max = 55;
+    double norm = norm_bound(a, 1);
+    s = 1; m = 0;
+    finite = R_FINITE(norm);
+    if (norm == 0 || !finite) return;
+    double best = R_PosInf;
+    if (norm <= 2. * 2. * p_max * (p_max + 3) * theta[nm - 1] / m_max) {
+      for (int i = 0; i < nm; i++) {
+        double si = ceil(norm / theta[i]);
+        if (mm[i] * si < best) { best = mm[i] * si; m = mm[i]; s = (int) si; }
+      }
+    } else {
+      /* alpha_p = max(d_p, d_(p+1)) with d_p bounds of ||B^p||^(1/p) */
+      std::vector<double> d(p_max + 2);
+      for (int p = 2; p <= p_max + 1; p++) d[p] = norm_bound(a, p);
+      for (int p = 2; p <= p_max; p++) {
+        double alpha = std::max(d[p], d[p + 1]);
+        for (int i = 0; i < nm; i++) {
+          if (mm[i] < p * (p - 1) - 1) continue;
+          double si = ceil(alpha / theta[i]);
+          if (mm[i] * si < best) { best = mm[i] * si; m = mm[i]; s = (int) si; }
+        }
+      }
+    }
+    s = std::max(s, 1);
+  }
+  /* y = c * B x (or c * B' x) */
+  template<class T>
+  void apply(const T* a, const T* x, T* y, double c, bool transpose) const {
+    for (int i = 0; i < n; i++) y[i] = (-mu) * x[i];
+    for (int j = 0; j < n; j++) {
+      for (int k = outer[j]; k < outer[j + 1]; k++) {
+        if (transpose) y[j] += a[k] * x[inner[k]];
+        else y[inner[k]] += a[k] * x[j];
+      }
+    }
+    for (int i = 0; i < n; i++) y[i] *= c;
+  }
+  /* Terms u_j = (B/s)^j x / j!, j = 0, ..., m of a substep */
+  template<class T>
+  void terms(const T* a, const T* x, std::vector<std::vector<T> >& u,
+             bool transpose) const {
+    u.resize(m + 1, std::vector<T>(n));
+    std::copy(x, x + n, u[0].begin());
+    for (int j = 1; j <= m; j++)
+      apply(a, &u[j - 1][0], &u[j][0], 1. / (s * j), transpose);
+  }
+  /* y = exp(A) x (or exp(A') x) */
+  template<class T>
+  void expmv(const T* a, const T* x, T* y, bool transpose) const {
+    if (!finite) {
+      std::fill(y, y + n, T(R_NaN));
+      return;
+    }
+    std::vector<std::vector<T> > u;
+    std::copy(x, x + n, y);
+    for (int r = 0; r < s; r++) {
+      terms(a, y, u, transpose);
+      for (int i = 0; i < n; i++) {
+        y[i] = u[0][i];
+        for (int j = 1; j <= m; j++) y[i] += u[j][i];
+        y[i] *= eta;
+      }
+    }
+  }
+  /** \brief Gradient of \f$w'\exp(A)v\f$ with respect to the values
+      of A (ga), v (gv) and w (gw). The substep boundaries are stored
+      (checkpoints) and the terms of each substep are recomputed in
+      the reverse sweep. */
+  template<class T>
+  void gradient(const T* a, const T* v, const T* w,
+                T* ga, T* gv, T* gw) const {
+    std::vector<std::vector<T> > b(s + 1, std::vector<T>(n)), u;
+    std::copy(v, v + n, b[0].begin());
+    for (int r = 0; r < s; r++) {
+      terms(a, &b[r][0], u, false);
+      for (int i = 0; i < n; i++) {
+        b[r + 1][i] = u[0][i];
+        for (int j = 1; j <= m; j++) b[r + 1][i] += u[j][i];
+        b[r + 1][i] *= eta;
+      }
+    }
+    std::copy(b[s].begin(), b[s].end(), gw);
+    for (size_t k = 0; k < inner.size(); k++) ga[k] = T(0);
+    std::vector<T> wr(w, w + n), ub(n), Bub(n);
+    for (int r = s - 1; r >= 0; r--) {
+      terms(a, &b[r][0], u, false);
+      /* Adjoint of u_j = c_j B u_(j-1) with c_j = 1/(s j) */
+      for (int i = 0; i < n; i++) ub[i] = eta * wr[i];
+      for (int j = m; j >= 1; j--) {
+        double c = 1. / (s * j);
+        for (int l = 0; l < n; l++) {
+          T cu = c * u[j - 1][l];
+          for (int k = outer[l]; k < outer[l + 1]; k++)
+            ga[k] += ub[inner[k]] * cu;
+        }
+        apply(a, &ub[0], &Bub[0], c, true);
+        for (int i = 0; i < n; i++) ub[i] = eta * wr[i] + Bub[i];
+      }
+      wr = ub;
+    }
+    std::copy(wr.begin(), wr.end(), gv);
+  }
+  /* Directional derivative of order K (see 'directional' below) */
+  template<int K>
+  void directional(const double* x, const double* d, double* ans) const {
+    size_t nnz = inner.size(), N = nnz + 2 * n;
+    std::vector<jet<K> > X(N, jet<K>(0.)), G(N);
+    for (size_t p = 0; p < N; p++) {
+      X[p].c[0] = x[p];
+      for (int i = 0; i < K; i++) X[p].c[1 << i] = d[i * N + p];
+    }
+    gradient(&X[0], &X[nnz], &X[nnz + n], &G[0], &G[nnz], &G[nnz + n]);
+    for (size_t p = 0; p < N; p++) ans[p] = G[p].c[jet<K>::N - 1];
+  }
+  /** \brief Mixed directional derivative of the gradient of
+      \f$\phi(a,v,w)=w'\exp(A)v\f$, where tx = [pattern, a, v, w,
+      d_1, ..., d_k] and the directions \f$d_i\f$ are of the same
+      length as (a, v, w). */
+  void directional(const CppAD::vector<double>& tx, double* ans) const {
+    size_t nnz = inner.size(), N = nnz + 2 * n;
+    size_t X = csc_values;
+    int k = (tx.size() - X) / N - 1;
+    const double* x = &tx[0] + X;
+    const double* d = x + N;
+    if (!finite) {
+      for (size_t p = 0; p < N; p++) ans[p] = R_NaN;
+      return;
+    }
+    bool zero = false;                  /* Multilinear in d_1, ..., d_k */
+    for (int i = 0; i < k && !zero; i++) {
+      zero = true;
+      for (size_t p = 0; p < N; p++) zero = zero && (d[i * N + p] == 0);
+    }
+    if (zero) {
+      for (size_t p = 0; p < N; p++) ans[p] = 0;
+      return;
+    }
+    switch (k) {
+    case 0: gradient(x, x + nnz, x + nnz + n, ans, ans + nnz, ans + nnz + n); break;
+    case 1: directional<1>(x, d, ans); break;
+    case 2: directional<2>(x, d, ans); break;
+    case 3: directional<3>(x, d, ans); break;
+    case 4: directional<4>(x, d, ans); break;
+    default: error("sparse_expmv_dir: Derivative order not implemented");
+    }
+  }
+};
+
+} // End namespace sparse
+
+CppAD::vector<double> sparse_expmv_dir(const CppAD::vector<double>& tx);
+template <class Type>
+CppAD::vector<AD<Type> > sparse_expmv_dir(const CppAD::vector<AD<Type> >& tx);
+
+/** \brief Atomic matrix exponential of a sparse square matrix times
+    a vector.
+    \param x Input vector [pattern, values, v] (see atomic_sparse.hpp).
+    \return exp(A)v (length n).
+*/
+TMB_ATOMIC_VECTOR_FUNCTION(
+			   // ATOMIC_NAME
+			   sparse_expmv
+			   ,
+			   // OUTPUT_DIM
+			   sparse::csc_dim(tx, 0)
+			   ,
+			   // ATOMIC_DOUBLE
+			   sparse::csc_t<double> P(tx);
+			   sparse::taylor_expmv_t E(P, &tx[P.V]);
+			   E.expmv(&tx[P.V], &tx[P.V + P.nnz], &ty[0], false);
+			   ,
+			   // ATOMIC_REVERSE  (gradient of py'exp(A)v)
+			   sparse::csc_t<Type> P(tx);
+			   CppAD::vector<Type> g = sparse_expmv_dir(P.join(tx, P.V, P.nnz + P.ncol, py, 0, P.nrow));
+			   for(size_t i=0; i<P.V; i++) px[i] = Type(0);
+			   for(int k=0; k<P.nnz + P.ncol; k++) px[P.V + k] = g[k];
+			   )
+
+/** \brief Directional derivatives of the gradient of w'exp(A)v with
+    respect to (A, v, w).
+    \param x Input vector [pattern, values, v, w, d_1, ..., d_k] (see
+    atomic_sparse.hpp).
+    \return Vector of length nnz+2n.
+*/
+TMB_ATOMIC_VECTOR_FUNCTION(
+			   // ATOMIC_NAME
+			   sparse_expmv_dir
+			   ,
+			   // OUTPUT_DIM
+			   sparse::csc_dim(tx, 2) + 2 * sparse::csc_dim(tx, 0)
+			   ,
+			   // ATOMIC_DOUBLE
+			   sparse::csc_t<double> P(tx);
+			   sparse::taylor_expmv_t E(P, &tx[P.V]);
+			   E.directional(tx, &ty[0]);
+			   ,
+			   // ATOMIC_REVERSE  (D_(k+1) for (A, v, w) and D_k for each d_i)
+			   sparse::csc_t<Type> P(tx);
+			   size_t N = P.nnz + 2 * P.nrow;
+			   int k = (tx.size() - P.V) / N - 1;
+			   CppAD::vector<Type> arg(tx.size() + N);
+			   for(size_t i=0; i<tx.size(); i++) arg[i] = tx[i];
+			   for(size_t p=0; p<N; p++) arg[tx.size() + p] = py[p];
+			   CppAD::vector<Type> g = sparse_expmv_dir(arg);
+			   for(size_t i=0; i<P.V; i++) px[i] = Type(0);
+			   for(size_t p=0; p<N; p++) px[P.V + p] = g[p];
+			   arg.resize(tx.size());
+			   for(int i=0; i<k; i++) {
+			     size_t D = P.V + (i + 1) * N;
+			     for(size_t j=0; j<tx.size(); j++) arg[j] = tx[j];
+			     for(size_t p=0; p<N; p++) arg[D + p] = py[p];
+			     g = sparse_expmv_dir(arg);
+			     for(size_t p=0; p<N; p++) px[D + p] = g[p];
+			   }
+			   )
+
+/** \brief Pack a sparse matrix as the index of its (registered)
+    compressed column pattern and its values followed by 'extra'
+    (uninitialized) entries (see atomic_sparse.hpp). */
+template<class Type>
+CppAD::vector<Type> sparse_csc_arg(const Eigen::SparseMatrix<Type> &A,
+                                   size_t extra) {
+  typedef typename Eigen::SparseMatrix<Type>::InnerIterator Iterator;
+  int nrow = A.rows(), ncol = A.cols();
+  std::vector<int> pattern(4 + ncol);
+  std::vector<Type> values;
+  pattern[0] = nrow;
+  pattern[1] = ncol;
+  pattern[3] = 0;
+  for (int j = 0; j < ncol; j++) {
+    for (Iterator it(A, j); it; ++it) {
+      pattern.push_back(it.row());
+      values.push_back(it.value());
+    }
+    pattern[4 + j] = values.size();
+  }
+  int nnz = values.size();
+  pattern[2] = nnz;
+  size_t V = sparse::csc_values;
+  CppAD::vector<Type> arg(V + nnz + extra);
+  arg[0] = Type(sparse::csc_register(pattern));
+  for (int k = 0; k < nnz; k++) arg[V + k] = values[k];
+  return arg;
+}
+
+/** \brief Sparse matrix-vector product A*x as a single tape node. */
+template<class Type>
+vector<Type> matvec(const Eigen::SparseMatrix<Type> &A, const vector<Type> &x) {
+  if (A.cols() != x.size()) error("matvec: Non-conformable arguments");
+  CppAD::vector<Type> arg = sparse_csc_arg(A, x.size());
+  size_t X = arg.size() - x.size();
+  for (int j = 0; j < x.size(); j++) arg[X + j] = x[j];
+  CppAD::vector<Type> res = sparse_matvec(arg);
+  vector<Type> ans(res.size());
+  for (int i = 0; i < ans.size(); i++) ans[i] = res[i];
+  return ans;
+}
+
+/** \brief Matrix exponential times vector, exp(t*A)*v, of a sparse
+    square matrix (see atomic_sparse.hpp). A single tape node. */
+template<class Type>
+vector<Type> expmv(const Eigen::SparseMatrix<Type> &A, const vector<Type> &v,
+                   Type t = Type(1)) {
+  if (A.rows() != A.cols() || A.cols() != v.size())
+    error("expmv: Non-conformable arguments");
+  CppAD::vector<Type> arg = sparse_csc_arg(A, v.size());
+  sparse::csc_t<Type> P(arg);
+  for (int k = 0; k < P.nnz; k++) arg[P.V + k] = t * arg[P.V + k];
+  size_t X = P.V + P.nnz;
+  for (int j = 0; j < v.size(); j++) arg[X + j] = v[j];
+  CppAD::vector<Type> res = sparse_expmv(arg);
+  vector<Type> ans(res.size());
+  for (int i = 0; i < ans.size(); i++) ans[i] = res[i];
+  return ans;
+}
+
+/** \brief Quadratic form x'*Q*x of a sparse matrix as a single tape
+    node. */
+template<class Type>
+Type quadform(const Eigen::SparseMatrix<Type> &Q, const vector<Type> &x) {
+  if (Q.rows() != Q.cols() || Q.cols() != x.size())
+    error("quadform: Non-conformable arguments");
+  CppAD::vector<Type> arg = sparse_csc_arg(Q, x.size());
+  size_t X = arg.size() - x.size();
+  for (int j = 0; j < x.size(); j++) arg[X + j] = x[j];
+  return sparse_quadform(arg)[0];
+}
+
+} // End namespace atomic
@@ -186,6 +186,19 @@ namespace atomic{
       int level = get_level(tx.size());
       return vpf[THREAD][level]->Forward(0,tx);
     }
+    // Taylor coefficients of order p,...,q (forward sweeps of the tape)
+    void forward(size_t p, size_t q, const CppAD::vector<double> &tx,
+                 CppAD::vector<double> &ty){
+      int level = get_level(tx.size() / (q+1));
+      CppAD::ADFun<double>* pf = vpf[THREAD][level];
+      size_t n = pf->Domain(), m = pf->Range();
+      CppAD::vector<double> xk(n), yk(m);
+      for(size_t k=0; k<=q; k++){
+        for(size_t j=0; j<n; j++) xk[j] = tx[j*(q+1)+k];
+        yk = pf->Forward(k, xk);
+        if(k >= p) for(size_t i=0; i<m; i++) ty[i*(q+1)+k] = yk[i];
+      }
+    }
   }; /* end class forrev_derivatives */
 #undef NTHREADS
 #undef THREAD
@@ -202,7 +215,21 @@ namespace USERFUNCTION##NAMESPACE{					\
     }									\
   };									\
   atomic::forrev_derivatives<UserFunctor> double_version;		\
-  TMB_ATOMIC_VECTOR_FUNCTION(						\
+  struct taylor_t{							\
+    template<class F, class Type>					\
+    static void forward(size_t p, size_t q,				\
+			const CppAD::vector<Type> &tx,			\
+			CppAD::vector<Type> &ty){			\
+      error("Atomic forward mode of order > 0 only available for double"); \
+    }									\
+    template<class F>							\
+    static void forward(size_t p, size_t q,				\
+			const CppAD::vector<double> &tx,		\
+			CppAD::vector<double> &ty){			\
+      double_version.forward(p, q, tx, ty);				\
+    }									\
+  };									\
+  TMB_ATOMIC_VECTOR_FUNCTION_GENERAL(					\
 			     generalized_symbol				\
 			     ,						\
 			     double_version.get_output_dim(tx.size())	\
@@ -213,6 +240,10 @@ namespace USERFUNCTION##NAMESPACE{					\
 			     for(size_t i=0; i < tx.size(); i++) concat[i] = tx[i]; \
 			     for(size_t i=0; i < py.size(); i++) concat[tx.size()+i] = py[i]; \
 			     px = generalized_symbol(concat);		\
+			     ,						\
+			     atomic::dense_sparsity			\
+			     ,						\
+			     taylor_t					\
 			     )						\
   template<class Base>							\
   vector<Base> generalized_symbol(vector<Base> x){			\
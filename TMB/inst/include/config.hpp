@@ -18,6 +18,7 @@
     config.optimize.instantly = true;
     config.optimize.parallel  = false;
     config.tape.parallel      = true;
+    config.stats.collect      = false;
     \endcode
 */
 struct config_struct{
@@ -37,6 +38,9 @@ struct config_struct{
   struct {
     bool parallel;   /**< \brief Enable parallel tape creation */
   } tape;
+  struct {
+    bool collect;    /**< \brief Collect timings and counters (see obj$env$stats) */
+  } stats;
   struct {
     bool getListElement;
   } debug;
@@ -62,6 +66,7 @@ struct config_struct{
     SET(optimize.instantly,true);
     SET(optimize.parallel,false);
     SET(tape.parallel,true);
+    SET(stats.collect,false);
   })
 #undef SET
   config_struct() CSKIP(
@@ -18,6 +18,12 @@ CppAD::vector<bool> user_region_; /* Vector of same length as tp_ (tape_points)
 				  */
 CppAD::vector<size_t> user_region_mark_;  /* user_region_mark_[i] is marked if the i'th tape
 					   point belongs to an already marked user region. */
+CppAD::vector<size_t> user_begin_;        /* user_begin_[i] is the tape_point index of the
+					     "UserOp begin" of the region containing i. */
+CppAD::vector<size_t> user_result_mark_;  /* user_result_mark_[i] is marked if the
+					     dependencies of the user atomic result i have
+					     already been marked. */
+CppAD::vector<bool> user_rt_, user_st_;   /* Work space for atomic sparsity */
 CppAD::vector<bool> constant_tape_point_; /* Vector of same length as tp_ (tape_points) that 
 					     marks all tape_points that only depend on fixed 
 					     effects. */
@@ -332,6 +338,7 @@ void my_next_reverse(
 */
 
 std::vector<size_t> op_mark_index_;
+size_t current_mark_; /* Mark of the current reverse sweep */
 void mark_user_tape_point_index(size_t index, size_t mark){
   if(user_region_mark_[index]!=mark){ /* is region already marked ? */
     tape_point tp=tp_[index];
@@ -352,6 +359,54 @@ void mark_user_tape_point_index(size_t index, size_t mark){
   }
 }
 
+/*
+  mark_user_result_index
+  ======================
+  A result of a user atomic operation has been reached. The entire
+  user region is marked (all of it must be visited by the reverse
+  sweep), but only the arguments that the result depends on are marked
+  as dependencies. These are obtained from the atomic function's
+  rev_sparse_jac (bool sparsity). If not available, all arguments are
+  marked.
+*/
+void mark_user_result_index(size_t index, size_t mark){
+  if(user_result_mark_[index]==mark)return;
+  user_result_mark_[index]=mark;
+  mark_user_tape_point_index(index,mark);
+  size_t begin=user_begin_[index];
+  const addr_t* op_arg=tp_[begin].op_arg;
+  size_t n=op_arg[2], m=op_arg[3];
+  size_t k=index-(begin+1+n);
+  atomic_base<Base>* atom=atomic_base<Base>::class_object(op_arg[0]);
+  bool ok = (atom != CPPAD_NULL) &&
+    (atom->sparsity() == atomic_base<Base>::bool_sparsity_enum);
+  if(ok){
+    user_rt_.resize(m);
+    user_st_.resize(n);
+    for(size_t i=0;i<m;i++)user_rt_[i]=(i==k);
+    ok = atom->rev_sparse_jac(1, user_rt_, user_st_);
+  }
+  for(size_t j=0;j<n;j++){
+    if( ok && !user_st_[j] ) continue;
+    tape_point tp=tp_[begin+1+j];
+    if(tp.op == UsravOp) mark_var_index(tp.op_arg[0],mark);
+  }
+}
+
+/* Mark the operator that created a given variable */
+void mark_var_index(size_t var, size_t mark){
+  size_t op=var2op_[var];
+  if(constant_tape_point_[op])return;
+  if(tp_[op].op == UsrrvOp){
+    mark_user_result_index(op,mark);
+    return;
+  }
+  if(op_mark_[op]!=mark){ // Not already marked
+    op_mark_[op]=mark;
+    op_mark_index_.push_back(op);
+  }
+}
+
 void mark_tape_point_args_index(size_t index, size_t mark){
   tape_point tp1=tp_[index];
   tape_point tp2=tp_[index+1];
@@ -360,12 +415,7 @@ void mark_tape_point_args_index(size_t index, size_t mark){
   int numarg=tp2.op_arg - op_arg;
   for(int i=0;i<numarg;i++){
     if(isDepArg(&op_arg[i])){
-      if(op_mark_[var2op_[op_arg[i]]]!=mark){ // Not already marked
-	if(!constant_tape_point_[var2op_[op_arg[i]]]){ // Not constant
-	  op_mark_[var2op_[op_arg[i]]]=mark;
-	  op_mark_index_.push_back(var2op_[op_arg[i]]);
-	}
-      }
+      mark_var_index(op_arg[i],mark);
     }
   }
 }
@@ -382,19 +432,23 @@ void prepare_reverse_sweep(int col){ /* input: range component */
   /* prepare list of integers */ 
   op_mark_index_.clear();
   op_mark_index_.push_back(op_index);
+  current_mark_=mark;
+  /* Range component is itself a result of a user atomic: Mark the
+     region and its arguments (the loop below skips user regions) */
+  if(tp_[op_index].op == UsrrvOp && !constant_tape_point_[op_index])
+    mark_user_result_index(op_index,mark);
   /* depth first search of operator indices */
   play_.reverse_start(op, op_arg, op_index, var_index);
   for(size_t i=0;i<op_mark_index_.size();i++){ /* Note - op_mark_index_.size() change 
 						  when loop runs ...*/
     if(!constant_tape_point_[op_mark_index_[i]]){
-      // If op is within user atomic region, then mark entire region. 
-      if(user_region_[op_mark_index_[i]]){ /* FIXME: only do once per region !!! - Fixed! */
-	mark_user_tape_point_index(op_mark_index_[i],mark); /* Appends elements to 
+      // Dependencies of a user atomic region are marked when its
+      // results are reached (mark_user_result_index).
+      if(!user_region_[op_mark_index_[i]]){
+	// op is marked - update dependencies
+	mark_tape_point_args_index(op_mark_index_[i],mark); /* Appends elements to 
 							       op_mark_index_ */
       }
-      // op is marked - update dependencies
-      mark_tape_point_args_index(op_mark_index_[i],mark); /* Appends elements to 
-							     op_mark_index_ */
     }
   }
   std::sort(op_mark_index_.begin(),op_mark_index_.end());
@@ -476,6 +530,8 @@ void my_init(vector<bool> keepcol){
   for(size_t i=0;i<op_mark_.size();i++)op_mark_[i]=0;
   user_region_mark_.resize(tp.op_index+1);
   for(size_t i=0;i<user_region_mark_.size();i++)user_region_mark_[i]=0;
+  user_result_mark_.resize(tp.op_index+1);
+  for(size_t i=0;i<user_result_mark_.size();i++)user_result_mark_[i]=0;
   tp_[tp.op_index]=tp;
   /* 1. We need to be able to find out, for a given variable, what operator created 
      the variable. This is easiest done by looping through the _operators_ because for a 
@@ -495,13 +551,17 @@ void my_init(vector<bool> keepcol){
   /* Lookup table: is tape_point within a UserOp region? */
   bool user_within=false;
   user_region_.resize(tp_.size());
+  user_begin_.resize(tp_.size());
+  size_t begin=0;
   for(size_t i=0;i<tp_.size();i++){
     if(tp_[i].op==UserOp){
       user_region_[i]=true;
       user_within=!user_within;	
+      if(user_within)begin=i;
     } else {
       user_region_[i]=user_within;
     }
+    user_begin_[i]=begin;
   }
 
   /* Lookup table: is tape_point a constant (=only fixed effect dependent) ? */
@@ -530,4 +590,5 @@ void my_init(vector<bool> keepcol){
   for(int i=0;i<m;i++)my_pattern(i);
   for(size_t i=0;i<op_mark_.size();i++)op_mark_[i]=0; /* remember to reset marks */
   for(size_t i=0;i<user_region_mark_.size();i++)user_region_mark_[i]=0; /* remember to reset marks */
+  for(size_t i=0;i<user_result_mark_.size();i++)user_result_mark_[i]=0;
 }
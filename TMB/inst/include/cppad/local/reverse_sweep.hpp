@@ -1265,7 +1265,11 @@ void myReverseSweep(
 					CPPAD_ASSERT_KNOWN(false, msg.c_str() );
 				}
 # endif
-				for(j = 0; j < user_n; j++) if( user_ix[j] > 0 )
+				/* Only arguments marked as dependencies of this sweep
+				   (see mark_user_result_index). Other partials are
+				   not reset after the sweep. */
+				for(j = 0; j < user_n; j++) if( user_ix[j] > 0 &&
+				    pf->op_mark_[pf->var2op_[user_ix[j]]] == pf->current_mark_ )
 				{	for(ell = 0; ell < user_k1; ell++)
 						Partial[user_ix[j] * K + ell] +=
 							user_px[j * user_k1 + ell];
@@ -40,6 +40,42 @@ namespace atomic{
     Block<Type>& operator-=(Block<Type> x){ this->A -= x.A; return *this; }
   };
   
+  /* Fixed size version of Block (used for dimensions up to 4). The
+     matrix products are unrolled and the inverse is in closed
+     form. No heap allocation takes place. */
+  template<int N>
+  struct FixedBlock {
+    typedef double ScalarType;
+    typedef Eigen::Matrix<double, N, N, Eigen::DontAlign> matrix_t;
+    matrix_t A;
+    FixedBlock(){}
+    FixedBlock(const matrix_t &A_) : A(A_) {}
+    FixedBlock(const matrix<double> &A_) : A(A_) {}
+    /* Matrix multiply */
+    FixedBlock<N> operator*(const FixedBlock<N> &other){
+      return FixedBlock<N>( matrix_t(this->A * other.A) );
+    }
+    /* Scale matrix */
+    FixedBlock<N> scale(double c){
+      return FixedBlock<N>( matrix_t(c * this->A) );
+    }
+    /* Add identity matrix */
+    FixedBlock<N> addIdentity(){
+      return FixedBlock<N>( matrix_t(this->A + matrix_t::Identity()) );
+    }
+    /* Infinity norm */
+    double norm(){
+      return A.cwiseAbs().rowwise().sum().maxCoeff();
+    }
+    /* Matrix inverse */
+    FixedBlock<N> inverse(){
+      return FixedBlock<N>( matrix_t(this->A.inverse()) );
+    }
+    /* Increment/decrement */
+    FixedBlock<N>& operator+=(const FixedBlock<N> &x){ this->A += x.A; return *this; }
+    FixedBlock<N>& operator-=(const FixedBlock<N> &x){ this->A -= x.A; return *this; }
+  };
+
   /*
     Representation of matrix of the form
     
@@ -116,11 +152,11 @@ namespace atomic{
     with methods required by Pade approximation
     \endverbatim
   */
-  template <int n>
-  struct nestedTriangle : Triangle<nestedTriangle<n-1> >{
+  template <int n, class Block0 = Block<double> >
+  struct nestedTriangle : Triangle<nestedTriangle<n-1, Block0> >{
     typedef double ScalarType;
-    typedef nestedTriangle<n-1> BlockType;
-    typedef Triangle<nestedTriangle<n-1> > Base;
+    typedef nestedTriangle<n-1, Block0> BlockType;
+    typedef Triangle<nestedTriangle<n-1, Block0> > Base;
     nestedTriangle(){}
     nestedTriangle(Base x) : Base(x){}
     nestedTriangle(vector<matrix<double> > args) : Base() {
@@ -130,26 +166,25 @@ namespace atomic{
       vector<matrix<double> > args2(nargs-1);
       for(int i=0;i<nargs-1;i++)args2[i] = zero;
       args2[0] = args[nargs-1];
-      Base::A = nestedTriangle<n-1>(args1);
-      Base::B = nestedTriangle<n-1>(args2);
+      Base::A = nestedTriangle<n-1, Block0>(args1);
+      Base::B = nestedTriangle<n-1, Block0>(args2);
     }
     /* For easy recursive extraction */
     matrix<double> bottomLeftCorner(){
       return this->B.bottomLeftCorner();
     }
   };
-  template <>
-  struct nestedTriangle<0> : Block<double>{
-    typedef Block<double> Base;
-    nestedTriangle<0>(){}
-    nestedTriangle<0>(Base x) : Base(x){}
-    nestedTriangle<0>(vector<matrix<double> > args) : Block<double>(args[0]) {}
+  template <class Block0>
+  struct nestedTriangle<0, Block0> : Block0{
+    typedef Block0 Base;
+    nestedTriangle(){}
+    nestedTriangle(Base x) : Base(x){}
+    nestedTriangle(vector<matrix<double> > args) : Block0(args[0]) {}
     matrix<double> bottomLeftCorner(){
       return this->A;
     }
   };
 
-
   /* 
      Pade approximation of matrix exponential.
      Can be applied to any of the previously implemented matrix 
@@ -189,15 +224,26 @@ namespace atomic{
      Orders from 0 to 3 are compiled and the appropriate order is dispatched
      at run-time.
   */
-  matrix<double> expm(vector<matrix<double> > args)CSKIP({
+  template<class Block0>
+  matrix<double> expm_nested(vector<matrix<double> > args){
     int nargs = args.size();
     matrix<double> ans;
-    if      (nargs==1) ans=expm(nestedTriangle<0>(args)).bottomLeftCorner();
-    else if (nargs==2) ans=expm(nestedTriangle<1>(args)).bottomLeftCorner();
-    else if (nargs==3) ans=expm(nestedTriangle<2>(args)).bottomLeftCorner();
-    else if (nargs==4) ans=expm(nestedTriangle<3>(args)).bottomLeftCorner();
+    if      (nargs==1) ans=expm(nestedTriangle<0, Block0>(args)).bottomLeftCorner();
+    else if (nargs==2) ans=expm(nestedTriangle<1, Block0>(args)).bottomLeftCorner();
+    else if (nargs==3) ans=expm(nestedTriangle<2, Block0>(args)).bottomLeftCorner();
+    else if (nargs==4) ans=expm(nestedTriangle<3, Block0>(args)).bottomLeftCorner();
     else error("expm: order not implemented.");
     return ans;
+  }
+  /* Small matrices (dimension up to 4) use fixed size blocks */
+  matrix<double> expm(vector<matrix<double> > args)CSKIP({
+    switch (args[0].rows()) {
+    case 1: return expm_nested<FixedBlock<1> >(args);
+    case 2: return expm_nested<FixedBlock<2> >(args);
+    case 3: return expm_nested<FixedBlock<3> >(args);
+    case 4: return expm_nested<FixedBlock<4> >(args);
+    default: return expm_nested<Block<double> >(args);
+    }
   })
 
   /* Helper to convert list of matrices to CppAD::vector 
@@ -15,6 +15,16 @@ Type lgamma(Type x){
   return atomic::D_lgamma(tx)[0];
 }
 VECTORIZE1_t(lgamma)
+/** \brief Vectorized lgamma for AD types (a single tape node). */
+template<class T>
+vector<AD<T> > lgamma(const vector<AD<T> > &x){
+  int n = x.size();
+  if (n == 0) return x;
+  CppAD::vector<AD<T> > tx(n + 1);
+  for (int i = 0; i < n; i++) tx[i] = x[i];
+  tx[n] = AD<T>(0);
+  return vector<AD<T> >(atomic::vD_lgamma(tx));
+}
 
 /* Old lgamma approximation */
 template <class Type>
@@ -0,0 +1,405 @@
+// License: GPL-2
+
+/** \file
+    \brief Native Hamiltonian samplers (static HMC and NUTS) operating
+    directly on the taped objective function.
+
+    The samplers work on the log posterior \f$-f(x)\f$ where \f$f\f$ is
+    the negative log density represented by an ADFun object (or a
+    parallelADFun object). Gradients are obtained by a zero order
+    forward sweep followed by a first order reverse sweep, so no R
+    code is involved in the leapfrog steps. Each chain owns a private
+    copy of the tape and a private random number generator, which
+    allows chains to run on separate OpenMP threads.
+*/
+namespace mcmc {
+
+  /** \brief Per chain random number generator.
+
+      R's random number generator is not thread safe. Each chain
+      therefore carries its own xorshift128 state which is seeded from
+      R (so results are reproducible through \c set.seed).
+  */
+  struct rng_t {
+    unsigned int s[4];
+    bool has_spare;
+    double spare;
+    rng_t(unsigned int seed = 1) {
+      /* Fill state using a linear congruential generator */
+      for (int i = 0; i < 4; i++) {
+        seed = 1812433253U * (seed ^ (seed >> 30)) + i + 1;
+        s[i] = seed;
+      }
+      if ((s[0] | s[1] | s[2] | s[3]) == 0) s[0] = 1;
+      has_spare = false;
+    }
+    unsigned int next() {
+      unsigned int t = s[0] ^ (s[0] << 11);
+      s[0] = s[1]; s[1] = s[2]; s[2] = s[3];
+      s[3] = s[3] ^ (s[3] >> 19) ^ t ^ (t >> 8);
+      return s[3];
+    }
+    /** \brief Uniform on the open interval (0,1) with 53 bit resolution */
+    double unif() {
+      double a = next() >> 5, b = next() >> 6;
+      return (a * 67108864.0 + b + 0.5) / 9007199254740992.0;
+    }
+    /** \brief Standard normal (polar Box-Muller) */
+    double norm() {
+      if (has_spare) { has_spare = false; return spare; }
+      double u, v, q;
+      do {
+        u = 2.0 * unif() - 1.0;
+        v = 2.0 * unif() - 1.0;
+        q = u * u + v * v;
+      } while (q >= 1.0 || q == 0.0);
+      q = sqrt(-2.0 * log(q) / q);
+      spare = v * q; has_spare = true;
+      return u * q;
+    }
+  };
+
+  /** \brief Log posterior and gradient evaluated on a tape.
+
+      Non-finite function values or gradients are mapped to a log
+      posterior of minus infinity, which the samplers treat as a
+      divergent transition.
+  */
+  template<class ADFunType>
+  struct target_t {
+    ADFunType* pf;
+    vector<double> w;
+    long int ncalls;
+    target_t(ADFunType* pf_) : pf(pf_), w(1), ncalls(0) { w[0] = 1.0; }
+    double operator()(const vector<double> &x, vector<double> &grad) {
+      ncalls++;
+      vector<double> y = pf->Forward(0, x);
+      double lp = -y[0];
+      if (!R_FINITE(lp)) return -INFINITY;
+      grad = -pf->Reverse(1, w);
+      for (int i = 0; i < grad.size(); i++)
+        if (!R_FINITE(grad[i])) return -INFINITY;
+      return lp;
+    }
+  };
+
+  /** \brief Euclidean metric (inverse mass matrix).
+
+      \c type is 0 (unit), 1 (diagonal) or 2 (dense). For the dense case
+      the lower Cholesky factor \f$L\f$ of the inverse metric is kept so
+      that momenta can be drawn as \f$L^{-T}z\f$.
+  */
+  struct metric_t {
+    int type;
+    vector<double> minv_diag;
+    matrix<double> minv;
+    matrix<double> L;
+    metric_t() : type(0) {}
+    void init(int type_, const matrix<double> &minv_) {
+      type = type_;
+      minv = minv_;
+      minv_diag = minv_.diagonal().array();
+      if (type == 2) {
+        Eigen::LLT<Eigen::MatrixXd> llt(minv);
+        L = llt.matrixL();
+      }
+    }
+    void draw(rng_t &rng, vector<double> &r) {
+      for (int i = 0; i < r.size(); i++) r[i] = rng.norm();
+      if (type == 1) r = r / minv_diag.sqrt();
+      if (type == 2) {
+        Eigen::VectorXd z = r.matrix();
+        L.transpose().triangularView<Eigen::Upper>().solveInPlace(z);
+        r = z.array();
+      }
+    }
+    vector<double> velocity(const vector<double> &r) {
+      if (type == 0) return r;
+      if (type == 1) return minv_diag * r;
+      vector<double> ans = (minv * r.matrix()).array();
+      return ans;
+    }
+    double kinetic(const vector<double> &r) {
+      return 0.5 * (r * velocity(r)).sum();
+    }
+    /** \brief Set metric from a sample covariance with Stan style
+        regularization towards a small multiple of the identity. */
+    void update(const matrix<double> &cov, int nsample) {
+      double a = nsample / (nsample + 5.0);
+      double b = 1e-3 * 5.0 / (nsample + 5.0);
+      matrix<double> m = a * cov;
+      for (int i = 0; i < m.rows(); i++) m(i, i) += b;
+      if (type == 1) {
+        matrix<double> d = m.diagonal().asDiagonal();
+        init(type, d);
+      } else {
+        init(type, m);
+      }
+    }
+  };
+
+  /** \brief Running mean and covariance (Welford's algorithm) */
+  struct welford_t {
+    int n;
+    vector<double> mean;
+    matrix<double> m2;
+    void reset(int dim) {
+      n = 0;
+      mean.resize(dim); mean.setZero();
+      m2.resize(dim, dim); m2.setZero();
+    }
+    void add(const vector<double> &x) {
+      n++;
+      vector<double> d = x - mean;
+      mean += d / double(n);
+      vector<double> d2 = x - mean;
+      m2 += d.matrix() * d2.matrix().transpose();
+    }
+    matrix<double> cov() { return m2 / double(n - 1); }
+  };
+
+  /** \brief Sampler settings shared by all chains */
+  struct control_t {
+    int algorithm;     /* 0 = HMC, 1 = NUTS */
+    int nsim;          /* Total number of iterations (including warmup) */
+    int warmup;        /* Number of adaptation iterations */
+    int L;             /* Leapfrog steps (HMC) */
+    int max_doublings; /* Maximum tree depth (NUTS) */
+    double eps;        /* Step size. Non-finite means adapt. */
+    double delta;      /* Target acceptance rate for dual averaging */
+    int metric;        /* 0 = unit, 1 = diagonal, 2 = dense */
+    int adapt_metric;  /* Estimate metric during warmup? */
+  };
+
+  /** \brief Output of a single chain.
+
+      Draws are written directly into preallocated memory with
+      \c nsim rows and \c n columns (column major, as R).
+  */
+  struct output_t {
+    double* par;       /* nsim x n */
+    int* depth;        /* nsim (leapfrog steps per iteration for HMC) */
+    double* accept;    /* nsim */
+    int* divergent;    /* nsim */
+    double* stepsize;  /* nsim */
+  };
+
+  /** \brief One chain of HMC or NUTS with dual averaging step size
+      adaptation and windowed metric adaptation. */
+  template<class ADFunType>
+  struct chain_t {
+    target_t<ADFunType> target;
+    metric_t metric;
+    rng_t rng;
+    control_t ctrl;
+    int n;
+    /* Dual averaging state */
+    double mu, Hbar, logepsbar;
+    int da_counter;
+    chain_t(ADFunType* pf, const matrix<double> &minv, const control_t &ctrl_,
+            unsigned int seed) : target(pf), rng(seed), ctrl(ctrl_) {
+      n = pf->Domain();
+      metric.init(ctrl.metric, minv);
+    }
+    /* Leapfrog step: x, r and grad are updated in place */
+    double leapfrog(vector<double> &x, vector<double> &r,
+                    vector<double> &grad, double eps) {
+      r += 0.5 * eps * grad;
+      x += eps * metric.velocity(r);
+      double lp = target(x, grad);
+      if (lp == -INFINITY) return lp;
+      r += 0.5 * eps * grad;
+      return lp;
+    }
+    /* Heuristic for a reasonable initial step size (Hoffman and
+       Gelman 2014, Algorithm 4) */
+    double find_epsilon(const vector<double> &x0, double eps) {
+      vector<double> x, r, r0(n), grad0(n), grad;
+      double lp0 = target(x0, grad0);
+      metric.draw(rng, r0);
+      double H0 = lp0 - metric.kinetic(r0);
+      x = x0; r = r0; grad = grad0;
+      double lp = leapfrog(x, r, grad, eps);
+      double logp = lp - metric.kinetic(r) - H0;
+      if (!(logp == logp)) logp = -INFINITY;
+      int a = (logp > log(0.5) ? 1 : -1);
+      for (int k = 0; k < 100; k++) {
+        if (a * logp <= -a * log(2.0)) break;
+        eps = eps * pow(2.0, a);
+        x = x0; r = r0; grad = grad0;
+        lp = leapfrog(x, r, grad, eps);
+        logp = lp - metric.kinetic(r) - H0;
+        if (!(logp == logp)) logp = -INFINITY;
+      }
+      return eps;
+    }
+    void restart_adaptation(double eps) {
+      mu = log(10.0 * eps);
+      Hbar = 0; logepsbar = 0; da_counter = 0;
+    }
+    /* Dual averaging update (Hoffman and Gelman 2014, Algorithm 5).
+       Returns the step size to use next. */
+    double adapt_stepsize(double alpha) {
+      const double gamma = 0.05, t0 = 10, kappa = 0.75;
+      if (!(alpha == alpha)) alpha = 0;
+      da_counter++;
+      double t = da_counter;
+      Hbar = (1.0 - 1.0 / (t + t0)) * Hbar + (ctrl.delta - alpha) / (t + t0);
+      double logeps = mu - sqrt(t) / gamma * Hbar;
+      double w = pow(t, -kappa);
+      logepsbar = w * logeps + (1.0 - w) * logepsbar;
+      return exp(logeps);
+    }
+    /* NUTS tree */
+    struct tree_t {
+      vector<double> xminus, rminus, gminus, xplus, rplus, gplus, xprime;
+      double lpprime;
+      vector<double> gprime;
+      double n, alpha;
+      int s, nalpha, divergent;
+    };
+    bool no_uturn(const vector<double> &xplus, const vector<double> &xminus,
+                  const vector<double> &rplus, const vector<double> &rminus) {
+      vector<double> dx = xplus - xminus;
+      return ((dx * metric.velocity(rminus)).sum() >= 0) &&
+        ((dx * metric.velocity(rplus)).sum() >= 0);
+    }
+    void buildtree(tree_t &T, const vector<double> &x, const vector<double> &r,
+                   const vector<double> &g, double logu, int v, int j,
+                   double eps, double H0) {
+      if (j == 0) {
+        vector<double> x1 = x, r1 = r, g1 = g;
+        double lp = leapfrog(x1, r1, g1, v * eps);
+        double H = lp - metric.kinetic(r1);
+        if (!(H == H)) H = -INFINITY;
+        T.xminus = T.xplus = T.xprime = x1;
+        T.rminus = T.rplus = r1;
+        T.gminus = T.gplus = T.gprime = g1;
+        T.lpprime = lp;
+        T.n = (logu <= H);
+        T.s = (logu < H + 1000.0);
+        T.divergent = !T.s;
+        T.alpha = (H - H0 > 0 ? 1.0 : exp(H - H0));
+        T.nalpha = 1;
+        return;
+      }
+      buildtree(T, x, r, g, logu, v, j - 1, eps, H0);
+      if (!T.s) return;
+      tree_t T2;
+      if (v == -1)
+        buildtree(T2, T.xminus, T.rminus, T.gminus, logu, v, j - 1, eps, H0);
+      else
+        buildtree(T2, T.xplus, T.rplus, T.gplus, logu, v, j - 1, eps, H0);
+      if (v == -1) {
+        T.xminus = T2.xminus; T.rminus = T2.rminus; T.gminus = T2.gminus;
+      } else {
+        T.xplus = T2.xplus; T.rplus = T2.rplus; T.gplus = T2.gplus;
+      }
+      if (T.n + T2.n > 0 && rng.unif() < T2.n / (T.n + T2.n)) {
+        T.xprime = T2.xprime; T.gprime = T2.gprime; T.lpprime = T2.lpprime;
+      }
+      T.alpha += T2.alpha;
+      T.nalpha += T2.nalpha;
+      T.n += T2.n;
+      T.divergent = T2.divergent;
+      T.s = T2.s && no_uturn(T.xplus, T.xminus, T.rplus, T.rminus);
+    }
+    /* Run the chain from x0 writing draws to 'out' */
+    void run(vector<double> x, output_t out) {
+      int nsim = ctrl.nsim;
+      bool adapt_eps = !R_FINITE(ctrl.eps);
+      double eps = (adapt_eps ? find_epsilon(x, 0.1) : ctrl.eps);
+      restart_adaptation(eps);
+      /* Metric adaptation windows (as in Stan) */
+      bool adapt_metric = ctrl.adapt_metric && (ctrl.metric > 0) &&
+        (ctrl.warmup >= 20);
+      int init_buffer = 75, term_buffer = 50, window = 25;
+      if (init_buffer + term_buffer + window > ctrl.warmup) {
+        init_buffer = (int) (0.15 * ctrl.warmup);
+        term_buffer = (int) (0.1 * ctrl.warmup);
+        window = ctrl.warmup - init_buffer - term_buffer;
+      }
+      int window_end = init_buffer + window;
+      welford_t welford;
+      welford.reset(n);
+      vector<double> grad(n), r(n);
+      double lp = target(x, grad);
+      for (int m = 0; m < nsim; m++) {
+        metric.draw(rng, r);
+        double H0 = lp - metric.kinetic(r);
+        double alpha = 0;
+        int depth = 0, divergent = 0;
+        if (ctrl.algorithm == 0) {
+          /* Static HMC */
+          vector<double> x1 = x, r1 = r, g1 = grad;
+          double lp1 = lp;
+          for (int l = 0; l < ctrl.L && lp1 != -INFINITY; l++)
+            lp1 = leapfrog(x1, r1, g1, eps);
+          double H = lp1 - metric.kinetic(r1);
+          if (!(H == H)) H = -INFINITY;
+          divergent = (H - H0 < -1000.0);
+          alpha = (H - H0 > 0 ? 1.0 : exp(H - H0));
+          if (rng.unif() < alpha) { x = x1; grad = g1; lp = lp1; }
+          depth = ctrl.L;
+        } else {
+          /* NUTS with slice variable (Hoffman and Gelman 2014, Algorithm 3) */
+          double logu = H0 + log(rng.unif());
+          tree_t T;
+          T.xminus = T.xplus = x; T.rminus = T.rplus = r;
+          T.gminus = T.gplus = grad;
+          double ntot = 1;
+          int s = 1;
+          while (s) {
+            int v = (rng.unif() < 0.5 ? -1 : 1);
+            tree_t T2;
+            if (v == -1) {
+              buildtree(T2, T.xminus, T.rminus, T.gminus, logu, v, depth, eps, H0);
+              T.xminus = T2.xminus; T.rminus = T2.rminus; T.gminus = T2.gminus;
+            } else {
+              buildtree(T2, T.xplus, T.rplus, T.gplus, logu, v, depth, eps, H0);
+              T.xplus = T2.xplus; T.rplus = T2.rplus; T.gplus = T2.gplus;
+            }
+            if (T2.s && rng.unif() < T2.n / ntot) {
+              x = T2.xprime; grad = T2.gprime; lp = T2.lpprime;
+            }
+            ntot += T2.n;
+            alpha = T2.alpha / T2.nalpha;
+            divergent = T2.divergent;
+            s = T2.s && no_uturn(T.xplus, T.xminus, T.rplus, T.rminus);
+            depth++;
+            if (depth >= ctrl.max_doublings) break;
+          }
+        }
+        /* Store */
+        for (int i = 0; i < n; i++) out.par[m + i * nsim] = x[i];
+        out.depth[m] = depth;
+        out.accept[m] = alpha;
+        out.divergent[m] = divergent;
+        out.stepsize[m] = eps;
+        /* Adapt */
+        if (m < ctrl.warmup) {
+          if (adapt_eps) eps = adapt_stepsize(alpha);
+          if (adapt_metric && m >= init_buffer &&
+              m < ctrl.warmup - term_buffer) {
+            welford.add(x);
+            if (m + 1 == window_end) {
+              metric.update(welford.cov(), welford.n);
+              welford.reset(n);
+              window *= 2;
+              window_end = m + 1 + window;
+              /* Stretch last window to the terminal buffer */
+              if (window_end + 2 * window > ctrl.warmup - term_buffer)
+                window_end = ctrl.warmup - term_buffer;
+              if (adapt_eps) {
+                eps = find_epsilon(x, eps);
+                restart_adaptation(eps);
+              }
+            }
+          }
+          if (adapt_eps && m + 1 == ctrl.warmup) eps = exp(logepsbar);
+        }
+      }
+    }
+  };
+
+}
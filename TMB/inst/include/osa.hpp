@@ -0,0 +1,265 @@
+// License: GPL-2
+
+/** \file
+    \brief Native engine for one-step-ahead (OSA) residuals.
+
+    Observations are processed in order. The Laplace approximation of
+    the marginal likelihood of the first k-1 observations (the "base")
+    is kept in memory: its inner mode and the numerical factorization
+    of the random effect Hessian. Configurations that only differ from
+    the base through observation k (point probability, lower/upper CDF
+    terms and grid values of observation k) are then evaluated
+
+    - starting from the base mode,
+    - using the base factorization corrected by the low rank Hessian
+      contribution of observation k (Woodbury identity and the matrix
+      determinant lemma) - no refactorization is needed.
+
+    After observation k has been processed the base is advanced by a
+    few Newton steps from the previous mode. Only the numerical
+    factorization is redone; the symbolic analysis of the Hessian
+    pattern is carried out once. This also holds for the exact mode
+    (control_t::exact) which refactorizes the Hessian at the final
+    mode of every configuration using a per thread workspace with the
+    analyzed pattern.
+
+    Inner Newton iterations use step halving. A configuration whose
+    iterations do not converge within control_t::maxit evaluates to
+    NaN.
+*/
+namespace osa {
+
+  typedef Eigen::SparseMatrix<double> spmat;
+
+  /** \brief Sparsity structure of the random effect Hessian block */
+  struct pattern_t {
+    int n;                    /* Full parameter dimension */
+    int nr;                   /* Number of random effects */
+    vector<int> random;       /* Random effect indices (0-based) */
+    vector<int> keep;         /* Hessian entries belonging to the random block */
+    vector<int> row, col;     /* Random block row/col of kept entries */
+    vector<int> valueindex;   /* Position in H.valuePtr() of kept entries */
+    spmat H;                  /* Template matrix (lower triangle) */
+    pattern_t(int n_, const vector<int> &random_,
+              const vector<int> &hi, const vector<int> &hj) {
+      n = n_; random = random_; nr = random.size();
+      vector<int> pos(n); pos.setConstant(-1);
+      for (int i = 0; i < nr; i++) pos[random[i]] = i;
+      std::vector<int> k_;
+      for (int k = 0; k < hi.size(); k++)
+        if (pos[hi[k]] >= 0 && pos[hj[k]] >= 0) k_.push_back(k);
+      int m = k_.size();
+      keep.resize(m); row.resize(m); col.resize(m); valueindex.resize(m);
+      /* Distinct (row, col) of the lower triangle. Duplicated entries
+         (e.g. both (i,j) and (j,i)) share a position. */
+      std::map<std::pair<int, int>, int> entry;
+      std::vector<int> uindex(m);
+      std::vector<Eigen::Triplet<double> > T;
+      for (int k = 0; k < m; k++) {
+        keep[k] = k_[k];
+        row[k] = pos[hi[keep[k]]]; col[k] = pos[hj[keep[k]]];
+        if (row[k] < col[k]) std::swap(row[k], col[k]);
+        std::pair<int, int> rc(row[k], col[k]);
+        std::map<std::pair<int, int>, int>::iterator it = entry.find(rc);
+        if (it == entry.end()) {
+          it = entry.insert(std::make_pair(rc, (int) T.size())).first;
+          T.push_back(Eigen::Triplet<double>(row[k], col[k], T.size() + 1));
+        }
+        uindex[k] = it->second;
+      }
+      H.resize(nr, nr);
+      H.setFromTriplets(T.begin(), T.end());
+      /* Locate the kept entries in the compressed storage */
+      std::vector<int> upos(T.size());
+      for (int p = 0; p < H.nonZeros(); p++)
+        upos[(int) H.valuePtr()[p] - 1] = p;
+      for (int k = 0; k < m; k++) valueindex[k] = upos[uindex[k]];
+    }
+  };
+
+  /** \brief Per thread evaluator of the joint negative log likelihood,
+      its random effect gradient and Hessian values. */
+  template<class ADFunType, class HessType>
+  struct evaluator_t {
+    ADFunType* pf;
+    HessType* ph;
+    const pattern_t* pat;
+    vector<double> w;
+    evaluator_t(ADFunType* pf_, HessType* ph_, const pattern_t* pat_) :
+      pf(pf_), ph(ph_), pat(pat_), w(1) { w[0] = 1; }
+    double value(const vector<double> &x) {
+      return pf->Forward(0, x)[0];
+    }
+    /* Gradient wrt. random effects (value returned through f) */
+    vector<double> gradient(const vector<double> &x, double &f) {
+      f = pf->Forward(0, x)[0];
+      vector<double> g = pf->Reverse(1, w);
+      vector<double> ans(pat->nr);
+      for (int i = 0; i < pat->nr; i++) ans[i] = g[pat->random[i]];
+      return ans;
+    }
+    /* Hessian values of the random block (in 'pattern_t' order) */
+    vector<double> hessian(const vector<double> &x) {
+      vector<double> h = ph->Forward(0, x);
+      vector<double> ans(pat->keep.size());
+      for (int k = 0; k < ans.size(); k++) ans[k] = h[pat->keep[k]];
+      return ans;
+    }
+    spmat asMatrix(const vector<double> &h) {
+      spmat H = pat->H;
+      for (int k = 0; k < h.size(); k++) H.valuePtr()[pat->valueindex[k]] = h[k];
+      return H;
+    }
+  };
+
+  /** \brief Base state: Laplace approximation of the first k-1
+      observations. */
+  struct base_t {
+    vector<double> x;     /* Full parameter vector at the mode */
+    vector<double> h;     /* Hessian values at the mode */
+    double f;             /* Joint nll at the mode */
+    double logdetH;
+    Eigen::SimplicialLDLT<spmat> ldlt;
+    bool ok;
+    /* Solve H x = b */
+    vector<double> solve(const vector<double> &b) const {
+      Eigen::VectorXd ans = ldlt.solve(b.matrix());
+      return ans.array();
+    }
+    void factorize(const spmat &H) {
+      ldlt.factorize(H);
+      ok = (ldlt.info() == Eigen::Success);
+      Eigen::VectorXd D = ldlt.vectorD();
+      ok = ok && (D.minCoeff() > 0);
+      logdetH = (ok ? D.array().log().sum() : NAN);
+    }
+  };
+
+  /** \brief Control parameters */
+  struct control_t {
+    int maxit;        /* Max inner iterations */
+    double tol;       /* Convergence tolerance (max abs gradient) */
+    int exact;        /* Refactorize at the final mode of every configuration? */
+  };
+
+  /** \brief Laplace approximation for a configuration 'x' which differs
+      from the base only through observation k.
+
+      The Hessian of the configuration is approximated by
+      \f$H_0 + P D P'\f$ where \f$H_0\f$ is the base Hessian and
+      \f$P\f$ selects the random effects touched by observation k
+      (found from the Hessian difference at the base mode). The small
+      dense block \f$D\f$ is re-evaluated at every inner iterate so
+      the iterations are Newton steps for observation k. The inverse
+      is evaluated by the Woodbury identity and the log determinant by
+      \f$\log|H_0| + \log|I + D P' H_0^{-1} P|\f$. The result is
+      exact when the base terms are quadratic in the random effects.
+      With control_t::exact the log determinant is instead obtained by
+      refactorizing the Hessian at the final mode in the workspace
+      'W' (symbolic analysis of the pattern already done).
+
+      \return Laplace approximation or NaN if the inner iterations
+      did not converge.
+  */
+  template<class ADFunType, class HessType>
+  double lowrank(evaluator_t<ADFunType, HessType> &E, const base_t &B,
+                 vector<double> x, const control_t &ctrl, base_t &W) {
+    const pattern_t &pat = *E.pat;
+    int nr = pat.nr;
+    for (int i = 0; i < nr; i++) x[pat.random[i]] = B.x[pat.random[i]];
+    /* Random effects touched by observation k */
+    vector<double> dh = E.hessian(x) - B.h;
+    std::vector<int> S;
+    vector<int> spos(nr); spos.setConstant(-1);
+    for (int k = 0; k < dh.size(); k++) {
+      if (dh[k] != 0) {
+        int r = pat.row[k], c = pat.col[k];
+        if (spos[r] < 0) { spos[r] = S.size(); S.push_back(r); }
+        if (spos[c] < 0) { spos[c] = S.size(); S.push_back(c); }
+      }
+    }
+    int s = S.size();
+    /* Z = H0^-1 P and C = P' H0^-1 P */
+    matrix<double> Z(nr, s), C(s, s), D(s, s);
+    for (int j = 0; j < s; j++) {
+      vector<double> e(nr); e.setZero(); e[S[j]] = 1;
+      Z.col(j) = B.solve(e).matrix();
+    }
+    for (int i = 0; i < s; i++) C.row(i) = Z.row(S[i]);
+    matrix<double> I = matrix<double>::Identity(s, s);
+    Eigen::PartialPivLU<Eigen::MatrixXd> lu;
+    double f = 0;
+    bool converged = false;
+    for (int it = 0; ; it++) {
+      if (it > 0) dh = E.hessian(x) - B.h;
+      D.setZero();
+      for (int k = 0; k < dh.size(); k++) {
+        int a = spos[pat.row[k]], b = spos[pat.col[k]];
+        if (a >= 0 && b >= 0) { D(a, b) = dh[k]; D(b, a) = dh[k]; }
+      }
+      if (s > 0) lu.compute(I + D * C);
+      vector<double> g = E.gradient(x, f);
+      if (g.abs().maxCoeff() < ctrl.tol) { converged = true; break; }
+      if (it == ctrl.maxit) break;
+      vector<double> step = B.solve(g);
+      if (s > 0) {
+        vector<double> Pty(s);
+        for (int i = 0; i < s; i++) Pty[i] = step[S[i]];
+        Eigen::VectorXd c = lu.solve(D * Pty.matrix());
+        step -= (Z * c).array();
+      }
+      /* Step halving on increase */
+      vector<double> x1 = x;
+      double lambda = 1;
+      for (int k = 0; k < 30; k++) {
+        for (int i = 0; i < nr; i++)
+          x1[pat.random[i]] = x[pat.random[i]] - lambda * step[i];
+        if (E.value(x1) <= f) break;
+        lambda /= 2;
+      }
+      x = x1;
+    }
+    if (!converged) return NAN;
+    double logdet = B.logdetH;
+    if (ctrl.exact) {
+      W.factorize(E.asMatrix(E.hessian(x)));
+      logdet = W.logdetH;
+    } else if (s > 0) {
+      double det = lu.determinant();
+      if (!(det > 0)) return NAN;
+      logdet += log(det);
+    }
+    return f + .5 * logdet - nr / 2. * log(2 * M_PI);
+  }
+
+  /** \brief Newton iterations for the base configuration (numerical
+      refactorization, symbolic analysis reused). */
+  template<class ADFunType, class HessType>
+  void newton(evaluator_t<ADFunType, HessType> &E, base_t &B,
+              const control_t &ctrl) {
+    const pattern_t &pat = *E.pat;
+    vector<double> &x = B.x;
+    for (int it = 0; ; it++) {
+      double f0;
+      vector<double> g = E.gradient(x, f0);
+      B.h = E.hessian(x);
+      B.factorize(E.asMatrix(B.h));
+      if (!B.ok) return;
+      if (g.abs().maxCoeff() < ctrl.tol || it == ctrl.maxit) break;
+      vector<double> step = B.solve(g);
+      /* Step halving on increase */
+      vector<double> x1 = x;
+      double lambda = 1;
+      for (int k = 0; k < 30; k++) {
+        for (int i = 0; i < pat.nr; i++)
+          x1[pat.random[i]] = x[pat.random[i]] - lambda * step[i];
+        double f1 = E.value(x1);
+        if (f1 <= f0) break;
+        lambda /= 2;
+      }
+      x = x1;
+    }
+    B.f = E.value(x);
+  }
+
+}
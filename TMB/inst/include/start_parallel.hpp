@@ -179,6 +179,31 @@ struct parallelADFun:ADFun<Type>{ /* Inheritance just so that compiler wont comp
 	{x(vecind(tapeid)[i]*p+j)+=y(i*p+j);}
   }
 
+  /* Time spent by each tape and thread in a parallel sweep. Exposes
+     imbalance of PARALLEL_REGIONs (see stats.hpp). */
+  struct tape_timing{
+    bool on;
+    vector<double> time;
+    vector<int> thread;
+    tape_timing(int ntapes) : on(config.stats.collect) {
+      if(on){ time.resize(ntapes); thread.resize(ntapes); }
+    }
+    void stop(int i, double t0){
+      time[i]=tmbstats::wtime()-t0;
+      thread[i]=0;
+#ifdef _OPENMP
+      thread[i]=omp_get_thread_num();
+#endif
+    }
+    void add(){
+      if(!on)return;
+      for(int i=0;i<time.size();i++){
+	tmbstats_table.add(tmbstats::key("parallel","tape",i),time[i]);
+	tmbstats_table.add(tmbstats::key("parallel","thread",thread[i]),time[i]);
+      }
+    }
+  };
+
   /* Overload methods */
   size_t Domain(){return domain;}
   size_t Range(){return range;}
@@ -191,10 +216,16 @@ struct parallelADFun:ADFun<Type>{ /* Inheritance just so that compiler wont comp
   template <typename VectorBase>
   VectorBase Forward(size_t p, const VectorBase& x, std::ostream& s = std::cout){
     vector<VectorBase> ans(ntapes);
+    tape_timing timing(ntapes);
 #ifdef _OPENMP
 #pragma omp parallel for
 #endif
-    for(int i=0;i<ntapes;i++)ans(i) = vecpf(i)->Forward(p,x);
+    for(int i=0;i<ntapes;i++){
+      double t0=(timing.on ? tmbstats::wtime() : 0);
+      ans(i) = vecpf(i)->Forward(p,x);
+      if(timing.on)timing.stop(i,t0);
+    }
+    timing.add();
     VectorBase out(range);
     for(size_t i=0;i<range;i++)out(i)=0;
     for(int i=0;i<ntapes;i++)addinsert(out,ans(i),i);
@@ -207,10 +238,16 @@ struct parallelADFun:ADFun<Type>{ /* Inheritance just so that compiler wont comp
   template <typename VectorBase>
   VectorBase Reverse(size_t p, const VectorBase &v){
     vector<VectorBase> ans(ntapes);
+    tape_timing timing(ntapes);
 #ifdef _OPENMP
 #pragma omp parallel for
 #endif
-    for(int i=0;i<ntapes;i++)ans(i) = vecpf(i)->Reverse(p,subset(v,i));
+    for(int i=0;i<ntapes;i++){
+      double t0=(timing.on ? tmbstats::wtime() : 0);
+      ans(i) = vecpf(i)->Reverse(p,subset(v,i));
+      if(timing.on)timing.stop(i,t0);
+    }
+    timing.add();
     VectorBase out(p*domain); 
     for(size_t i=0;i<p*domain;i++)out(i)=0;
     for(int i=0;i<ntapes;i++)out=out+ans(i);
@@ -251,3 +288,26 @@ struct parallelADFun:ADFun<Type>{ /* Inheritance just so that compiler wont comp
   }
 };
 
+/** \brief Deep copy of an ADFun or parallelADFun object.
+
+    Used when several threads need to evaluate the same tape at the
+    same time (each thread must own its copy).
+*/
+template<class Type>
+ADFun<Type>* copyTape(ADFun<Type>* pf){
+  ADFun<Type>* ans = new ADFun<Type>();
+  *ans = *pf;
+  return ans;
+}
+template<class Type>
+parallelADFun<Type>* copyTape(parallelADFun<Type>* pf){
+  vector<ADFun<Type>* > vecpf(pf->ntapes);
+  for(int i=0;i<pf->ntapes;i++)vecpf[i]=copyTape(pf->vecpf[i]);
+  parallelADFun<Type>* ans = new parallelADFun<Type>(vecpf);
+  /* Range embedding may differ from the default (sparse hessian case) */
+  ans->vecind=pf->vecind;
+  ans->range=pf->range;
+  ans->veci=pf->veci;
+  ans->vecj=pf->vecj;
+  return ans;
+}
@@ -0,0 +1,135 @@
+// License: GPL-2
+
+/** \file
+ * \brief Timers and counters of tape evaluations.
+ */
+
+/** \brief Timers and counters of tape evaluations.
+
+    Collection is disabled by default and is switched on from R with
+    config(stats.collect=1, DLL="mymodel"). The accumulated table is
+    read from R as the data frame obj$env$stats.
+
+    Entries are only updated outside parallel regions. Timings of
+    parallel work are obtained by the caller of the parallel region
+    (see parallelADFun).
+*/
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include <map>
+#include <sstream>
+#if __cplusplus >= 201103L
+#include <chrono>
+#elif !defined(_OPENMP)
+#include <sys/time.h>
+#endif
+namespace tmbstats {
+  /** \brief Wall clock time in seconds (monotonic when available).
+
+      Note: std::clock() is not an option as it measures CPU time of
+      the process, which counts all threads of a parallel region.
+  */
+  inline double wtime() {
+#if __cplusplus >= 201103L
+    return std::chrono::duration<double>(
+      std::chrono::steady_clock::now().time_since_epoch() ).count();
+#elif defined(_OPENMP)
+    return omp_get_wtime();
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return double(tv.tv_sec) + 1e-6 * double(tv.tv_usec);
+#endif
+  }
+  /** \brief Number of calls and total time of a named operation */
+  struct entry_t {
+    double count;
+    double time;
+    entry_t() : count(0), time(0) {}
+  };
+  typedef std::map<std::string, entry_t> map_t;
+  struct table_t {
+    map_t table;
+    void add(const std::string &name, double time, double count = 1) {
+#ifdef _OPENMP
+      if (omp_in_parallel()) return;
+#endif
+      entry_t &e = table[name];
+      e.count += count;
+      e.time += time;
+    }
+    void clear() { table.clear(); }
+  };
+}
+TMB_EXTERN tmbstats::table_t tmbstats_table;
+
+namespace tmbstats {
+  /** \brief Key of an operation of order 'p' (e.g. "ADFun.forward0") */
+  inline std::string key(const char* prefix, const char* op, int p) {
+    std::ostringstream s;
+    s << prefix << "." << op;
+    if (p >= 0) s << p;
+    return s.str();
+  }
+  /** \brief Scoped timer: adds the elapsed time to the entry
+      key(prefix,op,p) when it goes out of scope. Nothing is done
+      (and no key is formed) if collection is disabled. */
+  struct scoped_timer {
+    const char* prefix;
+    const char* op;
+    int p;
+    double count;
+    double t0;
+    bool on;
+    scoped_timer(const char* prefix_, const char* op_, int p_ = -1,
+                 double count_ = 1) :
+      prefix(prefix_), op(op_), p(p_), count(count_), t0(0),
+      on(config.stats.collect)
+    { if (on) t0 = wtime(); }
+    ~scoped_timer() {
+      if (on) tmbstats_table.add(key(prefix, op, p), wtime() - t0, count);
+    }
+  };
+}
+
+extern "C"
+{
+  /** \brief Return (and optionally reset) the table of timings */
+  SEXP getStats(SEXP reset) CSKIP(
+  {
+    int n = tmbstats_table.table.size();
+    SEXP ans;
+    SEXP names;
+    SEXP name;
+    SEXP count;
+    SEXP time;
+    PROTECT(ans = allocVector(VECSXP, 3));
+    PROTECT(names = allocVector(STRSXP, 3));
+    PROTECT(name = allocVector(STRSXP, n));
+    PROTECT(count = allocVector(REALSXP, n));
+    PROTECT(time = allocVector(REALSXP, n));
+    tmbstats::map_t::iterator it;
+    int i = 0;
+    for (it = tmbstats_table.table.begin(); it != tmbstats_table.table.end(); ++it, i++) {
+      SET_STRING_ELT(name, i, mkChar(it->first.c_str()));
+      REAL(count)[i] = it->second.count;
+      REAL(time)[i] = it->second.time;
+    }
+    SET_VECTOR_ELT(ans, 0, name);  SET_STRING_ELT(names, 0, mkChar("name"));
+    SET_VECTOR_ELT(ans, 1, count); SET_STRING_ELT(names, 1, mkChar("count"));
+    SET_VECTOR_ELT(ans, 2, time);  SET_STRING_ELT(names, 2, mkChar("time"));
+    setAttrib(ans, R_NamesSymbol, names);
+    if (asInteger(reset)) tmbstats_table.clear();
+    UNPROTECT(5);
+    return ans;
+  })
+
+  /** \brief Add timings of operations carried out in R (e.g. Cholesky) */
+  SEXP addStats(SEXP name, SEXP count, SEXP time) CSKIP(
+  {
+    if (config.stats.collect)
+      tmbstats_table.add(CHAR(STRING_ELT(name, 0)), asReal(time), asReal(count));
+    return R_NilValue;
+  })
+}
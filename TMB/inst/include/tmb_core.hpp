@@ -835,15 +835,26 @@ SEXP EvalADFunObjectTemplate(SEXP f, SEXP theta, SEXP control)
   }
   vector<double> x = asVector<double>(theta);
   SEXP res=R_NilValue;
+  /* Name of tape used by timers (see stats.hpp) */
+  const char* tape="ADFun";
+  if(config.stats.collect){
+    SEXP name=getAttrib(f,install("tape"));
+    if(!isNull(name))tape=CHAR(STRING_ELT(name,0));
+  }
   SEXP rangeweight=getListElement(control,"rangeweight");
   if(rangeweight!=R_NilValue){
     if(LENGTH(rangeweight)!=m)error("rangeweight must have length equal to range dimension");
-    if(doforward)pf->Forward(0,x);
+    if(doforward){
+      tmbstats::scoped_timer timer(tape,"forward",0);
+      pf->Forward(0,x);
+    }
+    tmbstats::scoped_timer timer(tape,"reverse",1);
     res=asSEXP(pf->Reverse(1,asVector<double>(rangeweight)));
     UNPROTECT(3);
     return res;
   }
   if(order==3){
+    tmbstats::scoped_timer timer(tape,"order",3);
     vector<double> w(1);
     w[0]=1;
     if((nrows!=1) | (ncols!=1))error("For 3rd order derivatives a single hessian coordinate must be specified.");
@@ -851,6 +862,7 @@ SEXP EvalADFunObjectTemplate(SEXP f, SEXP theta, SEXP control)
     PROTECT(res=asSEXP(asMatrix(pf->Reverse(3,w),n,3)));
   }
   if(order==0){
+    tmbstats::scoped_timer timer(tape,"forward",0);
     if(dumpstack)CppAD::traceforward0sweep(1);
     PROTECT(res=asSEXP(pf->Forward(0,x)));
     if(dumpstack)CppAD::traceforward0sweep(0);
@@ -861,7 +873,11 @@ SEXP EvalADFunObjectTemplate(SEXP f, SEXP theta, SEXP control)
   }
   if(order==1){
     //PROTECT(res=asSEXP(asMatrix(pf->Jacobian(x),m,n)));
-    if(doforward)pf->Forward(0,x);
+    if(doforward){
+      tmbstats::scoped_timer timer(tape,"forward",0);
+      pf->Forward(0,x);
+    }
+    tmbstats::scoped_timer timer(tape,"reverse",1,m);
     vector<double> jac(n*m);
     vector<double> u(n);
     vector<double> v(m);
@@ -875,6 +891,7 @@ SEXP EvalADFunObjectTemplate(SEXP f, SEXP theta, SEXP control)
   }
   //if(order==2)res=asSEXP(pf->Hessian(x,0),1);
   if(order==2){
+    tmbstats::scoped_timer timer(tape,"order",2);
     if(ncols==0){
       if(sparsitypattern){
 	PROTECT(res=asSEXP(HessianSparsityPattern(pf)));  
@@ -1015,6 +1032,7 @@ extern "C"
       setAttrib(res,install("range.names"),info);
       R_RegisterCFinalizer(res,finalizeADFun);
     }
+    setAttrib(res,install("tape"),mkString("ADFun"));
 
     /* Return list of external pointer and default-parameter */
     SEXP ans;
@@ -1254,6 +1272,7 @@ extern "C"
       PROTECT(res=R_MakeExternalPtr((void*) pf,mkChar("ADFun"),R_NilValue));
       R_RegisterCFinalizer(res,finalizeADFun);
     }
+    setAttrib(res,install("tape"),mkString("ADGrad"));
 
     /* Return ptrList */
     SEXP ans;
@@ -1370,6 +1389,7 @@ SEXP asSEXP(const sphess_t<ADFunType> &H, const char* tag)
     setAttrib(res,install("par"),par);
     setAttrib(res,install("i"),asSEXP(H.i));
     setAttrib(res,install("j"),asSEXP(H.j));
+    setAttrib(res,install("tape"),mkString("ADHess"));
     PROTECT(ans=ptrList(res));
     UNPROTECT(2);
     return ans;
@@ -1432,6 +1452,306 @@ extern "C"
 #endif
 }
 
+/** \brief Run independent HMC or NUTS chains on an ADFun object
+
+   Template argument can be "ADFun" or "parallelADFun".
+   @param f R external pointer to ADFunType representing the negative log posterior
+   @param init R matrix with one column of initial values per chain
+   @param control R list with sampler settings (see mcmc::control_t),
+   the initial inverse metric "minv" and one integer seed per chain.
+
+   Each chain works on a private copy of the tape. Chains are
+   distributed over the available OpenMP threads. Output is written
+   into memory allocated before the parallel region.
+*/
+template<class ADFunType>
+SEXP RunMCMCObjectTemplate(SEXP f, SEXP init, SEXP control)
+{
+  if(!isNewList(control))error("'control' must be a list");
+  ADFunType* pf=(ADFunType*)R_ExternalPtrAddr(f);
+  int n=pf->Domain();
+  if(pf->Range()!=1)error("Objective must be scalar valued");
+  if(!isMatrix(init) || nrows(init)!=n)error("'init' must be a matrix with one row per parameter");
+  PROTECT(init=coerceVector(init,REALSXP));
+  int nchain=ncols(init);
+  mcmc::control_t ctrl;
+  ctrl.algorithm=INTEGER(getListElement(control,"algorithm"))[0];
+  ctrl.nsim=INTEGER(getListElement(control,"nsim"))[0];
+  ctrl.warmup=INTEGER(getListElement(control,"warmup"))[0];
+  ctrl.L=INTEGER(getListElement(control,"L"))[0];
+  ctrl.max_doublings=INTEGER(getListElement(control,"max_doublings"))[0];
+  ctrl.eps=REAL(getListElement(control,"eps"))[0];
+  ctrl.delta=REAL(getListElement(control,"delta"))[0];
+  ctrl.metric=INTEGER(getListElement(control,"metric"))[0];
+  ctrl.adapt_metric=INTEGER(getListElement(control,"adapt_metric"))[0];
+  matrix<double> minv=asMatrix<double>(getListElement(control,"minv",&isMatrix));
+  if(minv.rows()!=n || minv.cols()!=n)error("'minv' must be a square matrix of dimension %d",n);
+  SEXP seed=getListElement(control,"seed",&isInteger);
+  if(LENGTH(seed)!=nchain)error("Need one seed per chain");
+  int* seedptr=INTEGER(seed);
+  int nsim=ctrl.nsim;
+  /* Preallocate output */
+  SEXP par,depth,accept,divergent,stepsize,ncalls;
+  PROTECT(par=allocVector(REALSXP,nsim*n*nchain));
+  PROTECT(depth=allocVector(INTSXP,nsim*nchain));
+  PROTECT(accept=allocVector(REALSXP,nsim*nchain));
+  PROTECT(divergent=allocVector(INTSXP,nsim*nchain));
+  PROTECT(stepsize=allocVector(REALSXP,nsim*nchain));
+  PROTECT(ncalls=allocVector(REALSXP,nchain));
+  /* Raw pointers - no R API calls from inside the threads */
+  double* parptr=REAL(par);
+  int* depthptr=INTEGER(depth);
+  double* acceptptr=REAL(accept);
+  int* divergentptr=INTEGER(divergent);
+  double* stepsizeptr=REAL(stepsize);
+  double* ncallsptr=REAL(ncalls);
+  vector<matrix<double> > minv_out(nchain);
+  vector<vector<double> > x0(nchain);
+  for(int k=0;k<nchain;k++){
+    x0[k].resize(n);
+    for(int i=0;i<n;i++)x0[k][i]=REAL(init)[i+k*n];
+  }
+#ifdef _OPENMP
+  start_parallel();
+#endif
+  bool bad_thread_alloc = false;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1)
+#endif
+  for(int k=0;k<nchain;k++){
+    ADFunType* pfk=NULL;
+    TMB_TRY {
+      pfk=copyTape(pf);
+      mcmc::chain_t<ADFunType> chain(pfk,minv,ctrl,(unsigned int)seedptr[k]);
+      mcmc::output_t out;
+      out.par=parptr+k*nsim*n;
+      out.depth=depthptr+k*nsim;
+      out.accept=acceptptr+k*nsim;
+      out.divergent=divergentptr+k*nsim;
+      out.stepsize=stepsizeptr+k*nsim;
+      chain.run(x0[k],out);
+      ncallsptr[k]=chain.target.ncalls;
+      minv_out[k]=chain.metric.minv;
+    }
+    TMB_CATCH { bad_thread_alloc = true; }
+    if(pfk!=NULL)delete pfk;
+  }
+  if(bad_thread_alloc)TMB_ERROR_BAD_ALLOC;
+  /* Collect results */
+  SEXP ans,names,M;
+  PROTECT(ans=allocVector(VECSXP,7));
+  PROTECT(names=allocVector(STRSXP,7));
+  PROTECT(M=allocVector(VECSXP,nchain));
+  for(int k=0;k<nchain;k++)SET_VECTOR_ELT(M,k,asSEXP(minv_out[k]));
+  SET_VECTOR_ELT(ans,0,par);       SET_STRING_ELT(names,0,mkChar("par"));
+  SET_VECTOR_ELT(ans,1,depth);     SET_STRING_ELT(names,1,mkChar("depth"));
+  SET_VECTOR_ELT(ans,2,accept);    SET_STRING_ELT(names,2,mkChar("accept"));
+  SET_VECTOR_ELT(ans,3,divergent); SET_STRING_ELT(names,3,mkChar("divergent"));
+  SET_VECTOR_ELT(ans,4,stepsize);  SET_STRING_ELT(names,4,mkChar("stepsize"));
+  SET_VECTOR_ELT(ans,5,ncalls);    SET_STRING_ELT(names,5,mkChar("n.calls"));
+  SET_VECTOR_ELT(ans,6,M);         SET_STRING_ELT(names,6,mkChar("minv"));
+  setAttrib(ans,R_NamesSymbol,names);
+  UNPROTECT(10);
+  return ans;
+} // RunMCMCObjectTemplate
+
+extern "C"
+{
+  SEXP RunMCMCObject(SEXP f, SEXP init, SEXP control)
+  {
+    TMB_TRY {
+      if(isNull(f))error("Expected external pointer - got NULL");
+      SEXP tag=R_ExternalPtrTag(f);
+      if(!strcmp(CHAR(tag), "ADFun"))
+	return RunMCMCObjectTemplate<ADFun<double> >(f,init,control);
+      if(!strcmp(CHAR(tag), "parallelADFun"))
+	return RunMCMCObjectTemplate<parallelADFun<double> >(f,init,control);
+      error("RunMCMCObject: NOT A KNOWN FUNCTION POINTER");
+    }
+    TMB_CATCH {
+      TMB_ERROR_BAD_ALLOC;
+    }
+  }
+}
+
+/** \brief Native one-step-ahead engine (see osa.hpp)
+
+   @param f R external pointer to the joint negative log likelihood (ADFunType)
+   @param h R external pointer to the sparse Hessian (HessType) with attributes "i" and "j"
+   @param control R list with components:
+   * par: Full parameter vector (random effects part is used as initial guess)
+   * random: One-based random effect indices (numeric)
+   * obs, dataterm: One-based (numeric) indices of observation k and its indicator, in the order to process
+   * lower, upper: One-based indices of cdf indicators (may be empty)
+   * grid: K x G matrix of values of observation k at which to evaluate (may be empty)
+   * maxit, tol, exact: See osa::control_t
+
+   Configurations of the same observation are distributed over the
+   OpenMP threads each having its own copy of the tapes.
+*/
+template<class ADFunType, class HessType>
+SEXP RunOSAObjectTemplate(SEXP f, SEXP h, SEXP control)
+{
+  if(!isNewList(control))error("'control' must be a list");
+  ADFunType* pf=(ADFunType*)R_ExternalPtrAddr(f);
+  HessType* ph=(HessType*)R_ExternalPtrAddr(h);
+  int n=pf->Domain();
+  vector<double> par=asVector<double>(getListElement(control,"par",&isReal));
+  if(par.size()!=n)error("Wrong parameter length.");
+  vector<int> random=asVector<int>(getListElement(control,"random",&isReal))-1;
+  vector<int> obs=asVector<int>(getListElement(control,"obs",&isReal))-1;
+  vector<int> dataterm=asVector<int>(getListElement(control,"dataterm",&isReal))-1;
+  vector<int> lower=asVector<int>(getListElement(control,"lower",&isReal))-1;
+  vector<int> upper=asVector<int>(getListElement(control,"upper",&isReal))-1;
+  matrix<double> grid=asMatrix<double>(getListElement(control,"grid",&isMatrix));
+  vector<int> hi=asVector<int>(getAttrib(h,install("i")));
+  vector<int> hj=asVector<int>(getAttrib(h,install("j")));
+  osa::control_t ctrl;
+  ctrl.maxit=INTEGER(getListElement(control,"maxit"))[0];
+  ctrl.tol=REAL(getListElement(control,"tol"))[0];
+  ctrl.exact=INTEGER(getListElement(control,"exact"))[0];
+  int K=obs.size();
+  bool cdf=(lower.size()==K) && (upper.size()==K) && (K>0);
+  int G=grid.cols();
+  if(G>0 && grid.rows()!=K)error("'grid' must have one row per observation");
+  int nconf=1+2*cdf+G;
+  /* Preallocate output */
+  SEXP nll,nlcdf_lower,nlcdf_upper,gridval;
+  PROTECT(nll=allocVector(REALSXP,K));
+  PROTECT(nlcdf_lower=allocVector(REALSXP,K));
+  PROTECT(nlcdf_upper=allocVector(REALSXP,K));
+  PROTECT(gridval=allocMatrix(REALSXP,K,G));
+  double* nllptr=REAL(nll);
+  double* lowerptr=REAL(nlcdf_lower);
+  double* upperptr=REAL(nlcdf_upper);
+  double* gridptr=REAL(gridval);
+  osa::pattern_t pat(n,random,hi,hj);
+  /* One evaluator per thread. Thread 0 uses the original tapes. */
+  int nthreads=1;
+#ifdef _OPENMP
+  start_parallel();
+  nthreads=omp_get_max_threads();
+#endif
+  vector<ADFunType*> vpf(nthreads);
+  vector<HessType*> vph(nthreads);
+  for(int t=0;t<nthreads;t++){vpf[t]=NULL; vph[t]=NULL;}
+  vpf[0]=pf; vph[0]=ph;
+  bool bad_thread_alloc = false;
+  /* Copied serially: A parallel region may get fewer threads than
+     requested, which would leave some copies missing. */
+  for(int t=1;t<nthreads && !bad_thread_alloc;t++){
+    TMB_TRY { vpf[t]=copyTape(pf); vph[t]=copyTape(ph); }
+    TMB_CATCH { bad_thread_alloc = true; }
+  }
+  std::vector<osa::evaluator_t<ADFunType,HessType> > E;
+  for(int t=0;t<nthreads;t++)
+    E.push_back(osa::evaluator_t<ADFunType,HessType>(vpf[t],vph[t],&pat));
+  /* Base configuration: all observations to process are disabled */
+  osa::base_t B;
+  /* Per thread workspace of the exact mode (pattern analyzed once) */
+  std::vector<osa::base_t*> W(nthreads, (osa::base_t*) NULL);
+  bool base_ok=true;
+  int kfail=-1;
+  if(!bad_thread_alloc){
+    TMB_TRY {
+      B.x=par;
+      for(int k=0;k<K;k++)B.x[dataterm[k]]=0;
+      if(cdf)for(int k=0;k<K;k++){B.x[lower[k]]=0; B.x[upper[k]]=0;}
+      B.ldlt.analyzePattern(pat.H);
+      for(int t=0;t<nthreads;t++){
+	W[t]=new osa::base_t();
+	if(ctrl.exact)W[t]->ldlt.analyzePattern(pat.H);
+      }
+      osa::newton(E[0],B,ctrl);
+      base_ok=B.ok;
+      for(int k=0;k<K && base_ok;k++){
+	vector<double> value(nconf);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic,1)
+#endif
+	for(int c=0;c<nconf;c++){
+	  int t=0;
+#ifdef _OPENMP
+	  t=omp_get_thread_num();
+#endif
+	  TMB_TRY {
+	    vector<double> x=B.x;
+	    if(c==0){ /* Point probability */
+	      x[dataterm[k]]=1;
+	    } else if(cdf && c<=2){ /* Lower and upper CDF */
+	      x[(c==1 ? lower[k] : upper[k])]=1;
+	    } else { /* Grid */
+	      x[dataterm[k]]=1;
+	      x[obs[k]]=grid(k,c-1-2*cdf);
+	    }
+	    value[c]=osa::lowrank(E[t],B,x,ctrl,*W[t]);
+	  }
+	  TMB_CATCH { bad_thread_alloc = true; }
+	}
+	if(bad_thread_alloc)break;
+	nllptr[k]=value[0];
+	lowerptr[k]=(cdf ? value[1] : NA_REAL);
+	upperptr[k]=(cdf ? value[2] : NA_REAL);
+	for(int g=0;g<G;g++)gridptr[k+g*K]=value[1+2*cdf+g];
+	/* Advance base */
+	B.x[dataterm[k]]=1;
+	osa::newton(E[0],B,ctrl);
+	base_ok=B.ok;
+	if(!base_ok)kfail=k;
+      }
+    }
+    TMB_CATCH { bad_thread_alloc = true; }
+  }
+  for(int t=1;t<nthreads;t++){
+    if(vpf[t]!=NULL)delete vpf[t];
+    if(vph[t]!=NULL)delete vph[t];
+  }
+  for(int t=0;t<nthreads;t++)if(W[t]!=NULL)delete W[t];
+  if(bad_thread_alloc)TMB_ERROR_BAD_ALLOC;
+  if(!base_ok)error("Hessian not positive definite (observation %d)", kfail+1);
+  SEXP ans,names;
+  PROTECT(ans=allocVector(VECSXP,4));
+  PROTECT(names=allocVector(STRSXP,4));
+  SET_VECTOR_ELT(ans,0,nll);         SET_STRING_ELT(names,0,mkChar("nll"));
+  SET_VECTOR_ELT(ans,1,nlcdf_lower); SET_STRING_ELT(names,1,mkChar("nlcdf.lower"));
+  SET_VECTOR_ELT(ans,2,nlcdf_upper); SET_STRING_ELT(names,2,mkChar("nlcdf.upper"));
+  SET_VECTOR_ELT(ans,3,gridval);     SET_STRING_ELT(names,3,mkChar("grid"));
+  setAttrib(ans,R_NamesSymbol,names);
+  UNPROTECT(6);
+  return ans;
+} // RunOSAObjectTemplate
+
+template<class ADFunType>
+SEXP RunOSAObjectTemplate(SEXP f, SEXP h, SEXP control)
+{
+  SEXP tag=R_ExternalPtrTag(h);
+  if(!strcmp(CHAR(tag), "ADFun"))
+    return RunOSAObjectTemplate<ADFunType,ADFun<double> >(f,h,control);
+  if(!strcmp(CHAR(tag), "parallelADFun"))
+    return RunOSAObjectTemplate<ADFunType,parallelADFun<double> >(f,h,control);
+  error("RunOSAObject: NOT A KNOWN FUNCTION POINTER");
+  return R_NilValue;
+}
+
+extern "C"
+{
+  SEXP RunOSAObject(SEXP f, SEXP h, SEXP control)
+  {
+    TMB_TRY {
+      if(isNull(f) || isNull(h))error("Expected external pointer - got NULL");
+      SEXP tag=R_ExternalPtrTag(f);
+      if(!strcmp(CHAR(tag), "ADFun"))
+	return RunOSAObjectTemplate<ADFun<double> >(f,h,control);
+      if(!strcmp(CHAR(tag), "parallelADFun"))
+	return RunOSAObjectTemplate<parallelADFun<double> >(f,h,control);
+      error("RunOSAObject: NOT A KNOWN FUNCTION POINTER");
+    }
+    TMB_CATCH {
+      TMB_ERROR_BAD_ALLOC;
+    }
+  }
+}
+
 extern "C"
 {
   SEXP usingAtomics(){
@@ -1463,6 +1783,8 @@ extern "C"
   SEXP getParameterOrder(SEXP data, SEXP parameters, SEXP report);
   SEXP MakeADGradObject(SEXP data, SEXP parameters, SEXP report);
   SEXP MakeADHessObject2(SEXP data, SEXP parameters, SEXP report, SEXP skip);
+  SEXP RunMCMCObject(SEXP f, SEXP init, SEXP control);
+  SEXP RunOSAObject(SEXP f, SEXP h, SEXP control);
   SEXP usingAtomics();
 }
 
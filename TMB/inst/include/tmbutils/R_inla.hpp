@@ -23,20 +23,35 @@ struct spde_t{
   SparseMatrix<Type> M0;	// G0 eqn (10) in Lindgren 
   SparseMatrix<Type> M1;	// G1 eqn (10) in Lindgren 
   SparseMatrix<Type> M2;	// G2 eqn (10) in Lindgren 
+  /* M0, M1 and M2 on the union of their patterns (used by Q_spde) */
+  sparse_pattern pattern;
+  vector<Type> M0x, M1x, M2x;
   spde_t(SEXP x){  /* x = List passed from R */
   M0 = asSparseMatrix<Type>(getListElement(x,"M0"));
   M1 = asSparseMatrix<Type>(getListElement(x,"M1"));
   M2 = asSparseMatrix<Type>(getListElement(x,"M2"));
+  std::vector<int> i, j;
+  sparse_pattern(M0).pairs(i, j);
+  sparse_pattern(M1).pairs(i, j);
+  sparse_pattern(M2).pairs(i, j);
+  pattern = sparse_pattern(M0.rows(), M0.cols(), i, j);
+  M0x = pattern.values(M0);
+  M1x = pattern.values(M1);
+  M2x = pattern.values(M2);
 }
 };
 
 /** Precision matrix eqn (10) in Lindgren et al. (2011) */    
 template<class Type>
-  SparseMatrix<Type> Q_spde(spde_t<Type> spde, Type kappa){
+  SparseMatrix<Type> Q_spde(const spde_t<Type> &spde, Type kappa){
   Type kappa_pow2 = kappa*kappa;
   Type kappa_pow4 = kappa_pow2*kappa_pow2;
-  	
-  return kappa_pow4*spde.M0 + Type(2.0)*kappa_pow2*spde.M1 + spde.M2;    // M0=G0, M1=G1, M2=G2
+  Type two_kappa_pow2 = Type(2.0)*kappa_pow2;
+  // kappa^4*M0 + 2*kappa^2*M1 + M2 in a single pass over the nonzeros
+  vector<Type> Qx(spde.pattern.nonZeros());
+  for(int k=0; k<Qx.size(); k++)
+    Qx[k] = kappa_pow4*spde.M0x[k] + two_kappa_pow2*spde.M1x[k] + spde.M2x[k];
+  return spde.pattern.asSparseMatrix(Qx);
 }
 
 /** \brief Object containing all elements of an anisotropic SPDE object, i.e. eqn (20) in Lindgren et al. */	
@@ -51,6 +66,16 @@ struct spde_aniso_t{
   matrix<int>  TV;
   SparseMatrix<Type> G0;
   SparseMatrix<Type> G0_inv;
+  /* Fixed patterns used by Q_spde (computed once from TV) */
+  sparse_pattern G1_pattern;    // Pattern of G1_aniso
+  std::vector<int> G1_index;    // Position of the 3x3 entries of each triangle in G1_aniso
+  sparse_pattern G0_inv_pattern;
+  vector<Type> G0_inv_x;
+  sparse_product G1_G0_inv;     // G1_aniso * G0_inv
+  sparse_product G2;            // (G1_aniso * G0_inv) * G1_aniso
+  sparse_pattern pattern;       // Pattern of Q (union of G0, G1 and G2)
+  vector<Type> G0_x;            // G0 on the pattern of Q
+  std::vector<int> G1_pos, G2_pos; // Positions of G1 and G2 in the pattern of Q
   spde_aniso_t(SEXP x){  /* x = List passed from R */
   n_s = 	CppAD::Integer(asVector<Type>(getListElement(x,"n_s"))[0]);  
   n_tri = 	CppAD::Integer(asVector<Type>(getListElement(x,"n_tri"))[0]);  
@@ -62,32 +87,48 @@ struct spde_aniso_t{
   G0 = asSparseMatrix<Type>(getListElement(x,"G0"));
   G0_inv = asSparseMatrix<Type>(getListElement(x,"G0_inv"));
   
+  std::vector<int> i, j;
+  for(int t=0; t<n_tri; t++)
+    for(int a=0; a<3; a++)
+      for(int b=0; b<3; b++){
+        i.push_back(TV(t,a));
+        j.push_back(TV(t,b));
+      }
+  G1_pattern = sparse_pattern(n_s, n_s, i, j);
+  G1_index.resize(i.size());
+  for(size_t k=0; k<i.size(); k++) G1_index[k] = G1_pattern.index(i[k], j[k]);
+  G0_inv_pattern = sparse_pattern(G0_inv);
+  G0_inv_x = G0_inv_pattern.values(G0_inv);
+  G1_G0_inv = sparse_product(G1_pattern, G0_inv_pattern);
+  G2 = sparse_product(G1_G0_inv.C, G1_pattern);
+  i.resize(0); j.resize(0);
+  sparse_pattern(G0).pairs(i, j);
+  G1_pattern.pairs(i, j);
+  G2.C.pairs(i, j);
+  pattern = sparse_pattern(n_s, n_s, i, j);
+  G0_x = pattern.values(G0);
+  G1_pos = pattern.index(G1_pattern);
+  G2_pos = pattern.index(G2.C);
 }
 };
 
 
 /** Precision matrix for the anisotropic case, eqn (20) in Lindgren et al. (2011) */    
 template<class Type>
-  SparseMatrix<Type> Q_spde(spde_aniso_t<Type> spde, Type kappa, matrix<Type> H){
+  SparseMatrix<Type> Q_spde(const spde_aniso_t<Type> &spde, Type kappa, matrix<Type> H){
 
   int i;
   Type kappa_pow2 = kappa*kappa;
   Type kappa_pow4 = kappa_pow2*kappa_pow2;
   
-  int n_s = spde.n_s;
   int n_tri = spde.n_tri;
-  vector<Type> Tri_Area = spde.Tri_Area;
-  matrix<Type> E0 = spde.E0;
-  matrix<Type> E1 = spde.E1;
-  matrix<Type> E2 = spde.E2;
-  matrix<int> TV = spde.TV;
-  SparseMatrix<Type> G0 = spde.G0;
-  SparseMatrix<Type> G0_inv = spde.G0_inv;
+  const vector<Type> &Tri_Area = spde.Tri_Area;
+  const matrix<Type> &E0 = spde.E0;
+  const matrix<Type> &E1 = spde.E1;
+  const matrix<Type> &E2 = spde.E2;
 	  	  
   //Type H_trace = H(0,0)+H(1,1);
   //Type H_det = H(0,0)*H(1,1)-H(0,1)*H(1,0);
-  SparseMatrix<Type> G1_aniso(n_s,n_s); 
-  SparseMatrix<Type> G2_aniso(n_s,n_s); 
   // Calculate adjugate of H
   matrix<Type> adj_H(2,2);
   adj_H(0,0) = H(1,1);
@@ -96,34 +137,35 @@ template<class Type>
   adj_H(1,1) = H(0,0);
   // Calculate new SPDE matrices
 
-  // Calculate G1 - pt. 1
-  array<Type> Gtmp(n_tri,3,3);
+  // Calculate G1: Scatter-add the 3x3 element matrix of each triangle
+  vector<Type> G1_x(spde.G1_pattern.nonZeros());
+  G1_x.setZero();
+  Type Gtmp[3][3];
+  const matrix<Type>* E[3] = {&E0, &E1, &E2};
   for(i=0; i<n_tri; i++){    
-    // 1st line: E0(i,) %*% adjH %*% t(E0(i,)), etc.    
-    Gtmp(i,0,0) = (E0(i,0)*(E0(i,0)*adj_H(0,0)+E0(i,1)*adj_H(1,0)) + E0(i,1)*(E0(i,0)*adj_H(0,1)+E0(i,1)*adj_H(1,1))) / (4*Tri_Area(i));  
-    Gtmp(i,0,1) = (E1(i,0)*(E0(i,0)*adj_H(0,0)+E0(i,1)*adj_H(1,0)) + E1(i,1)*(E0(i,0)*adj_H(0,1)+E0(i,1)*adj_H(1,1))) / (4*Tri_Area(i));  
-    Gtmp(i,0,2) = (E2(i,0)*(E0(i,0)*adj_H(0,0)+E0(i,1)*adj_H(1,0)) + E2(i,1)*(E0(i,0)*adj_H(0,1)+E0(i,1)*adj_H(1,1))) / (4*Tri_Area(i));
-    Gtmp(i,1,1) = (E1(i,0)*(E1(i,0)*adj_H(0,0)+E1(i,1)*adj_H(1,0)) + E1(i,1)*(E1(i,0)*adj_H(0,1)+E1(i,1)*adj_H(1,1))) / (4*Tri_Area(i));
-    Gtmp(i,1,2) = (E2(i,0)*(E1(i,0)*adj_H(0,0)+E1(i,1)*adj_H(1,0)) + E2(i,1)*(E1(i,0)*adj_H(0,1)+E1(i,1)*adj_H(1,1))) / (4*Tri_Area(i));
-    Gtmp(i,2,2) = (E2(i,0)*(E2(i,0)*adj_H(0,0)+E2(i,1)*adj_H(1,0)) + E2(i,1)*(E2(i,0)*adj_H(0,1)+E2(i,1)*adj_H(1,1))) / (4*Tri_Area(i));
+    // Gtmp(a,b) = E_b(i,) %*% adjH %*% t(E_a(i,)) / (4*Tri_Area(i))
+    for(int a=0; a<3; a++){
+      Type u0 = (*E[a])(i,0)*adj_H(0,0)+(*E[a])(i,1)*adj_H(1,0);
+      Type u1 = (*E[a])(i,0)*adj_H(0,1)+(*E[a])(i,1)*adj_H(1,1);
+      for(int b=a; b<3; b++){
+        Gtmp[a][b] = ((*E[b])(i,0)*u0 + (*E[b])(i,1)*u1) / (4*Tri_Area(i));
+        Gtmp[b][a] = Gtmp[a][b];
+      }
+    }
+    const int* pos = &spde.G1_index[9*i];
+    for(int a=0; a<3; a++)
+      for(int b=0; b<3; b++)
+        G1_x[pos[3*a+b]] += Gtmp[a][b];
   }
-  // Calculate G1 - pt. 2
-  for(i=0; i<n_tri; i++){
-    G1_aniso.coeffRef(TV(i,1),TV(i,0)) = G1_aniso.coeffRef(TV(i,1),TV(i,0)) + (Gtmp(i,0,1));  
-    G1_aniso.coeffRef(TV(i,0),TV(i,1)) = G1_aniso.coeffRef(TV(i,0),TV(i,1)) + (Gtmp(i,0,1));  
-    G1_aniso.coeffRef(TV(i,2),TV(i,1)) = G1_aniso.coeffRef(TV(i,2),TV(i,1)) + (Gtmp(i,1,2));  
-    G1_aniso.coeffRef(TV(i,1),TV(i,2)) = G1_aniso.coeffRef(TV(i,1),TV(i,2)) + (Gtmp(i,1,2));  
-    G1_aniso.coeffRef(TV(i,2),TV(i,0)) = G1_aniso.coeffRef(TV(i,2),TV(i,0)) + (Gtmp(i,0,2));  
-    G1_aniso.coeffRef(TV(i,0),TV(i,2)) = G1_aniso.coeffRef(TV(i,0),TV(i,2)) + (Gtmp(i,0,2));  
-    G1_aniso.coeffRef(TV(i,0),TV(i,0)) = G1_aniso.coeffRef(TV(i,0),TV(i,0)) + (Gtmp(i,0,0));  
-    G1_aniso.coeffRef(TV(i,1),TV(i,1)) = G1_aniso.coeffRef(TV(i,1),TV(i,1)) + (Gtmp(i,1,1));  
-    G1_aniso.coeffRef(TV(i,2),TV(i,2)) = G1_aniso.coeffRef(TV(i,2),TV(i,2)) + (Gtmp(i,2,2));  
-  }
-  G2_aniso = G1_aniso * G0_inv * G1_aniso; 
-
-  return kappa_pow4*G0 + Type(2.0)*kappa_pow2*G1_aniso + G2_aniso;
+  // G2 = G1_aniso * G0_inv * G1_aniso using the precomputed product patterns
+  vector<Type> G2_x = spde.G2(spde.G1_G0_inv(G1_x, spde.G0_inv_x), G1_x);
+
+  // kappa^4*G0 + 2*kappa^2*G1_aniso + G2_aniso
+  Type two_kappa_pow2 = Type(2.0)*kappa_pow2;
+  vector<Type> Qx = kappa_pow4*spde.G0_x;
+  for(int k=0; k<G1_x.size(); k++) Qx[spde.G1_pos[k]] += two_kappa_pow2*G1_x[k];
+  for(int k=0; k<G2_x.size(); k++) Qx[spde.G2_pos[k]] += G2_x[k];
+  return spde.pattern.asSparseMatrix(Qx);
 }
 
 } // end namespace R_inla
-
-
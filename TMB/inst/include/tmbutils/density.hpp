@@ -122,6 +122,113 @@ MVNORM_t<scalartype> MVNORM(matrix<scalartype> x, bool use_atomic=true){
   return MVNORM_t<scalartype>(x, use_atomic);
 }
 
+/** \cond */
+/* Log determinant of the leading KxK block of a fixed size matrix as
+   the sum of log pivots of its LDL' factorization (NaN unless
+   positive definite). The pivots are ratios of leading minors. */
+template <class matrixN, int K>
+struct fixed_logdet {
+  typedef typename matrixN::Scalar scalartype;
+  static scalartype eval(const matrixN &S, scalartype &det){
+    scalartype det0;
+    scalartype ans = fixed_logdet<matrixN, K-1>::eval(S, det0);
+    det = S.template topLeftCorner<K,K>().determinant();
+    return ans + log(det / det0);
+  }
+};
+template <class matrixN>
+struct fixed_logdet<matrixN, 0> {
+  typedef typename matrixN::Scalar scalartype;
+  static scalartype eval(const matrixN &S, scalartype &det){
+    det = scalartype(1);
+    return scalartype(0);
+  }
+};
+/** \endcond */
+
+/** \brief Multivariate normal distribution of small fixed dimension
+
+    Same density as \ref MVNORM_t but for a compile-time dimension N
+    (intended for N<=4). Matrices are fixed size Eigen types so the
+    inverse and determinant of Sigma are closed form expressions and
+    no heap allocation takes place. Used by \ref contAR2_t.
+    \code
+      Matrix<Type,2,2> Sigma;
+      Matrix<Type,2,1> x;
+      res = MVNORM_fixed_t<Type,2>(Sigma)(x);
+    \endcode
+*/
+template <class scalartype_, int N>
+class MVNORM_fixed_t{
+  TYPEDEFS(scalartype_);
+  typedef Matrix<scalartype,N,N> matrixN;
+  typedef Matrix<scalartype,N,1> vectorN;
+private:
+  matrixN Q;          /* Inverse covariance matrix */
+  scalartype logdetQ; /* log-determinant of Q */
+public:
+  MVNORM_fixed_t(){}
+  MVNORM_fixed_t(const matrixN &Sigma){
+    setSigma(Sigma);
+  }
+  void setSigma(const matrixN &Sigma){
+    Q = Sigma.inverse();
+    scalartype det;
+    logdetQ = -fixed_logdet<matrixN, N>::eval(Sigma, det);
+  }
+  matrixN precision(){return Q;}
+  scalartype Quadform(const vectorN &x){
+    scalartype ans = 0;
+    for(int j=0;j<N;j++){
+      scalartype Qx = 0;
+      for(int i=0;i<N;i++) Qx += Q(i,j)*x(i);
+      ans += Qx*x(j);
+    }
+    return ans;
+  }
+  /** \brief Evaluate the negative log density */
+  scalartype operator()(const vectorN &x){
+    return -scalartype(.5)*logdetQ + scalartype(.5)*Quadform(x) + N*scalartype(log(sqrt(2.0*M_PI)));
+  }
+  arraytype jacobian(arraytype x){
+    arraytype y(x.dim);
+    matrixtype m(x.size()/x.cols(),x.cols());
+    for(int i=0;i<x.size();i++)m(i)=x[i];
+    matrixtype mQ=m*matrixtype(Q);
+    for(int i=0;i<x.size();i++)y[i]=mQ(i);
+    return y;
+  }
+};
+
+/** \brief Sum of multivariate zero-mean normal densities with common covariance matrix
+
+    \param Sigma Covariance matrix (p-by-p).
+    \param X Matrix (p-by-m) of points at which the density is evaluated (one per column).
+    \return Sum of negative log densities of the columns of X.
+
+    Equivalent to
+    \code
+      for(int j=0; j<X.cols(); j++) ans += MVNORM(Sigma)(X.col(j));
+    \endcode
+    but recorded as a single atomic operation: Sigma is factorized
+    once and all columns are evaluated by a batched triangular
+    solve. The factorizations of the last few distinct covariance
+    matrices are cached, so calling MVNORM_sum repeatedly with the
+    same Sigma (e.g. once per group) does not refactorize.
+*/
+template <class scalartype>
+scalartype MVNORM_sum(matrix<scalartype> Sigma, matrix<scalartype> X){
+  int p = Sigma.rows();
+  if (Sigma.cols() != p || X.rows() != p)
+    error("MVNORM_sum: Non-conformable arguments");
+  if (p == 0 || X.cols() == 0) return scalartype(0);
+  CppAD::vector<scalartype> arg(1 + Sigma.size() + X.size());
+  arg[0] = p;
+  for(int i=0;i<Sigma.size();i++) arg[1+i] = Sigma(i);
+  for(int i=0;i<X.size();i++) arg[1+Sigma.size()+i] = X(i);
+  return atomic::mvnorm_sum(arg)[0];
+}
+
 /** \brief Multivariate normal distribution with unstructered correlation matrix
 
    Class to evaluate the negative log density of a multivariate Gaussian 
@@ -514,7 +621,7 @@ private:
   matrix4x4 B, iB; /* B=A %x% I + I %x% A  */
   matexp<scalartype,2> expA;
   matrix4x1 vecSigma,iBvecSigma;
-  vector<MVNORM_t<scalartype> > neglogdmvnorm; /* Cache the 2-dim increments */
+  vector<MVNORM_fixed_t<scalartype,2> > neglogdmvnorm; /* Cache the 2-dim increments */
   vector<matrix2x2 > expAdt; /* Cache matrix exponential for grid increments */
 public:
   contAR2_t(){};
@@ -530,23 +637,42 @@ public:
     expA=matexp<scalartype,2>(A);
     vecSigma << 0,0,0,scalartype(-2)*c1*V0(1,1);
     iBvecSigma=iB*vecSigma;
-    /* cache increment distribution N(0,V(dt)) - one for each grid point */
+    /* cache matrix exponential and increment distribution N(0,V(dt))
+       - one for each grid point. Computed once for each distinct
+       grid increment (see step_groups). */
     neglogdmvnorm.resize(grid.size());
-    neglogdmvnorm[0]=MVNORM_t<scalartype>(V0);
-    for(int i=1;i<grid.size();i++)neglogdmvnorm[i]=MVNORM_t<scalartype>(V(grid(i)-grid(i-1)));
-    /* cache matrix exponential */
     expAdt.resize(grid.size());
+    neglogdmvnorm[0]=MVNORM_fixed_t<scalartype,2>(V0);
     expAdt[0]=expA(scalartype(0));
-    for(int i=1;i<grid.size();i++)expAdt[i]=expA(grid(i)-grid(i-1));
+    int n=grid.size();
+    if(n>1){
+      vectortype dt=grid.tail(n-1)-grid.head(n-1);
+      step_groups<scalartype> groups(dt);
+      for(int k=0;k<groups.size();k++){
+        int i=groups.first[k];
+        expAdt[i+1]=expA(dt(i));
+        neglogdmvnorm[i+1]=MVNORM_fixed_t<scalartype,2>(V_expA(expAdt[i+1]));
+      }
+      for(int i=0;i<n-1;i++){
+        int j=groups.first[groups.index[i]];
+        expAdt[i+1]=expAdt[j+1];
+        neglogdmvnorm[i+1]=neglogdmvnorm[j+1];
+      }
+    }
   }
   /* Simple formula for matrix exponential exp(B*t) */
   matrix4x4 expB(scalartype t){
-    return kronecker(expA(t),expA(t));
+    matrix2x2 expAt=expA(t);
+    return kronecker(expAt,expAt);
   }
   /* Variance as fct. of time when started deterministic */
   matrix2x2 V(scalartype t){
+    return V_expA(expA(t));
+  }
+  /* Same as V(t) given expA(t) */
+  matrix2x2 V_expA(const matrix2x2 &expAt){
     matrix4x1 tmp;
-    tmp=expB(t)*iBvecSigma-iBvecSigma;
+    tmp=kronecker(expAt,expAt)*iBvecSigma-iBvecSigma;
     matrix2x2 ans;
     for(int i=0;i<4;i++)ans(i)=tmp(i);
     return ans;
@@ -664,6 +790,7 @@ class GMRF_t{
 private:
   Eigen::SparseMatrix<scalartype> Q;
   scalartype logdetQ;
+  bool use_atomic;
   int sqdist(vectortype x, vectortype x_){
     int ans=0;
     int tmp;
@@ -674,11 +801,11 @@ private:
     return ans;
   }
 public:
-  GMRF_t(){}
-  GMRF_t(Eigen::SparseMatrix<scalartype> Q_, int order_=1){
-    setQ(Q_,order_);
+  GMRF_t() : use_atomic(true) {}
+  GMRF_t(Eigen::SparseMatrix<scalartype> Q_, int order_=1, bool use_atomic=true){
+    setQ(Q_,order_,use_atomic);
   }
-  GMRF_t(arraytype x, vectortype delta, int order_=1){
+  GMRF_t(arraytype x, vectortype delta, int order_=1, bool use_atomic=true){
     int n=x.cols();
     typedef Eigen::Triplet<scalartype> T;
     std::vector<T> tripletList;
@@ -695,13 +822,22 @@ public:
     }
     Eigen::SparseMatrix<scalartype> Q_(n,n);
     Q_.setFromTriplets(tripletList.begin(), tripletList.end());
-    setQ(Q_,order_);
+    setQ(Q_,order_,use_atomic);
   }
-  void setQ(Eigen::SparseMatrix<scalartype> Q_, int order=1){
+  /* If use_atomic=true (default) the log determinant and the
+     quadratic form are single atomic operations (see
+     atomic_sparse.hpp) rather than a taped sparse factorization and
+     matrix-vector product. */
+  void setQ(Eigen::SparseMatrix<scalartype> Q_, int order=1, bool use_atomic=true){
     Q=Q_;
-    Eigen::SimplicialLDLT< Eigen::SparseMatrix<scalartype> > ldl(Q);
-    vectortype D=ldl.vectorD();
-    logdetQ=(log(D)).sum();
+    this->use_atomic=use_atomic;
+    if(use_atomic){
+      logdetQ=atomic::logdet(Q);
+    } else {
+      Eigen::SimplicialLDLT< Eigen::SparseMatrix<scalartype> > ldl(Q);
+      vectortype D=ldl.vectorD();
+      logdetQ=(log(D)).sum();
+    }
     /* Q^order */
     for(int i=1;i<order;i++){
       Q=Q*Q_;
@@ -710,6 +846,7 @@ public:
   }
   /* Quadratic form: x'*Q^order*x */
   scalartype Quadform(vectortype x){
+    if(use_atomic) return atomic::quadform(Q,x);
     return (x*(Q*x.matrix()).array()).sum();
   }
   scalartype operator()(vectortype x){
@@ -725,7 +862,10 @@ public:
     return y;
   }
   int ndim(){return 1;}
+  /* Marginal variances: Diagonal of Q^-1 by selected inversion if
+     use_atomic=true (see atomic_sparse.hpp) */
   vectortype variance(){
+    if(use_atomic) return atomic::inverse_diagonal(Q);
     int n=Q.rows();
     vectortype ans(n);
     matrixtype C=invertSparseMatrix(Q);
@@ -738,21 +878,24 @@ public:
   For detailed explanation of GMRFs see the class definition @ref GMRF_t
   \param Q precision matrix
   \param order Convolution order, i.e. the precision matrix is Q^order (matrix product)
+  \param use_atomic Use the atomic sparse operations (see
+  atomic_sparse.hpp). Set to false to tape the sparse factorization
+  and matrix-vector product as before.
 
 */
 template <class scalartype>
-GMRF_t<scalartype> GMRF(Eigen::SparseMatrix<scalartype> Q, int order=1){
-  return GMRF_t<scalartype>(Q, order);
+GMRF_t<scalartype> GMRF(Eigen::SparseMatrix<scalartype> Q, int order=1, bool use_atomic=true){
+  return GMRF_t<scalartype>(Q, order, use_atomic);
 }
 template <class scalartype, class arraytype >
-GMRF_t<scalartype> GMRF(arraytype x, vector<scalartype> delta, int order=1){
-  return GMRF_t<scalartype>(x, delta, order);
+GMRF_t<scalartype> GMRF(arraytype x, vector<scalartype> delta, int order=1, bool use_atomic=true){
+  return GMRF_t<scalartype>(x, delta, order, use_atomic);
 }
 template <class scalartype, class arraytype >
-GMRF_t<scalartype> GMRF(arraytype x, scalartype delta, int order=1){
-  vector<scalartype> d(x.rows());
+GMRF_t<scalartype> GMRF(arraytype x, scalartype delta, int order=1, bool use_atomic=true){
+  vector<scalartype> d(x.cols());
   for(int i=0;i<d.size();i++)d[i]=delta;
-  return GMRF_t<scalartype>(x, d, order);
+  return GMRF_t<scalartype>(x, d, order, use_atomic);
 }
 
 /** \brief Apply scale transformation on a density
@@ -0,0 +1,323 @@
+// License: GPL-2
+
+/**
+   \brief Adaptive univariate and multivariate numerical integration
+
+   - Globally adaptive Gauss-Kronrod quadrature (10 point Gauss, 21
+     point Kronrod) as in QUADPACK's 'dqage' and R's 'integrate'.
+   - The subdivision is selected from the double values of the
+     integrand. Only the Kronrod nodes of the final subintervals
+     contribute to the result, so the derivative is the quadrature of
+     the derivative of the integrand (differentiation under the
+     integral sign) and the evaluations of discarded subintervals are
+     dead code of the tape.
+   - The integrand is evaluated in batches of 21 points per
+     subinterval. Integrands that are cheaper to evaluate on a vector
+     of points can be passed to \ref integrate_batch.
+   - Infinite integration limits are mapped to a finite interval.
+
+   \note The subdivision is part of the tape, i.e. it is selected for
+   the parameter values at which the tape is recorded. The final
+   Kronrod sum is the atomic function atomic::kronrod_sum which
+   re-computes the error estimate of the taped subdivision at every
+   evaluation and warns (once per integral) if it exceeds the
+   tolerance. The tape should
+   then be re-recorded closer to the current parameters (e.g. by
+   re-running MakeADFun at the estimate).
+*/
+namespace gauss_kronrod {
+
+  /** \brief Integration settings (defaults as R's 'integrate') */
+  struct control {
+    int subdivisions; /**< Maximum number of subintervals */
+    double reltol;    /**< Relative accuracy requested */
+    double abstol;    /**< Absolute accuracy requested */
+    int flag;         /**< Warning flag of the taped integral (internal) */
+    control(int subdivisions_ = 100,
+            double reltol_ = 1.220703125e-4,
+            double abstol_ = 1.220703125e-4) :
+      subdivisions(subdivisions_), reltol(reltol_), abstol(abstol_),
+      flag(-1) {}
+  };
+
+  /* Batch evaluation of a scalar integrand */
+  template<class Type, class F>
+  struct scalar_batch {
+    F &f;
+    scalar_batch(F &f_) : f(f_) {}
+    vector<Type> operator()(const vector<Type> &x) {
+      vector<Type> y(x.size());
+      for (int i = 0; i < x.size(); i++) y[i] = f(x[i]);
+      return y;
+    }
+  };
+
+  /* Integrand on (0,1) or (-1,1) for infinite limits:
+     - mode 1: [a, Inf)   x = a + t/(1-t)
+     - mode 2: (-Inf, b]  x = b - t/(1-t)
+     - mode 3: (-Inf, Inf) x = t/(1-t^2)  (t in (-1,1)) */
+  template<class Type, class Batch>
+  struct transform_t {
+    Batch &f;
+    int mode;
+    Type a;
+    transform_t(Batch &f_, int mode_, Type a_) : f(f_), mode(mode_), a(a_) {}
+    vector<Type> operator()(const vector<Type> &t) {
+      int n = t.size();
+      vector<Type> x(n), jac(n);
+      for (int i = 0; i < n; i++) {
+        if (mode == 3) {
+          Type s = Type(1) - t[i] * t[i];
+          x[i] = t[i] / s;
+          jac[i] = (Type(1) + t[i] * t[i]) / (s * s);
+        } else {
+          Type s = Type(1) - t[i];
+          x[i] = (mode == 1 ? a + t[i] / s : a - t[i] / s);
+          jac[i] = Type(1) / (s * s);
+        }
+      }
+      return f(x) * jac;
+    }
+  };
+
+  /* One subinterval with integrand values at the Kronrod nodes and
+     (double) estimates of the integral and the error */
+  template<class Type>
+  struct interval_t {
+    Type a, b, half;
+    vector<Type> fx;
+    double result, error;
+  };
+
+  /* dqk21 on [a, b] */
+  template<class Type, class Batch>
+  interval_t<Type> kronrod(Batch &f, Type a, Type b) {
+    using atomic::kronrod21::xgk;
+    Type center = Type(0.5) * (a + b);
+    Type half = Type(0.5) * (b - a);
+    vector<Type> x(21);
+    for (int j = 0; j < 10; j++) {
+      x[2 * j] = center - half * Type(xgk[j]);
+      x[2 * j + 1] = center + half * Type(xgk[j]);
+    }
+    x[20] = center;
+    interval_t<Type> ans;
+    ans.a = a; ans.b = b; ans.half = half;
+    ans.fx = f(x);
+    if (ans.fx.size() != 21) error("gauss_kronrod: Integrand returned wrong length");
+    double fxd[21];
+    for (int j = 0; j < 21; j++) fxd[j] = asDouble(ans.fx[j]);
+    ans.error = atomic::kronrod21::error(fxd, asDouble(half), &ans.result);
+    return ans;
+  }
+
+  /* Globally adaptive bisection of the subinterval with largest
+     error. The result is the atomic Kronrod sum of the final
+     subintervals. */
+  template<class Type, class Batch>
+  Type adaptive(Batch &f, Type a, Type b, control c) {
+    std::vector<interval_t<Type> > iv(1, kronrod(f, a, b));
+    while ((int) iv.size() < c.subdivisions) {
+      double total = 0, err = 0;
+      size_t worst = 0;
+      for (size_t i = 0; i < iv.size(); i++) {
+        total += iv[i].result;
+        err += iv[i].error;
+        if (iv[i].error > iv[worst].error) worst = i;
+      }
+      if (err <= std::max(c.abstol, c.reltol * fabs(total))) break;
+      Type mid = Type(0.5) * (iv[worst].a + iv[worst].b);
+      /* Give up on intervals that can no longer be bisected */
+      double am = asDouble(iv[worst].a), bm = asDouble(iv[worst].b);
+      if (asDouble(mid) == am || asDouble(mid) == bm) break;
+      interval_t<Type> right = kronrod(f, mid, iv[worst].b);
+      iv[worst] = kronrod(f, iv[worst].a, mid);
+      iv.push_back(right);
+    }
+    size_t n = iv.size();
+    CppAD::vector<Type> arg(3 + 22 * n);
+    arg[0] = Type(c.flag);
+    arg[1] = Type(c.abstol);
+    arg[2] = Type(c.reltol);
+    for (size_t i = 0; i < n; i++) {
+      arg[3 + i] = iv[i].half;
+      for (int j = 0; j < 21; j++) arg[3 + n + 21 * i + j] = iv[i].fx[j];
+    }
+    return atomic::kronrod_sum(arg)[0];
+  }
+
+  /* Allocate the warning flag of a taped integral. Nested integrals
+     inherit the flag of the outer integral through 'c'. */
+  template<class Type>
+  void set_flag(control &c) {
+    if (c.flag < 0 && !isDouble<Type>::value)
+      c.flag = atomic::kronrod21::new_flag();
+  }
+
+  /** \brief 1D adaptive integration of a batch integrand.
+
+      \param f Functor mapping a vector of points to the vector of
+      integrand values at the points.
+      \param a Lower integration limit (may be -Inf)
+      \param b Upper integration limit (may be Inf)
+      \param c Integration settings
+  */
+  template<class Type, class Batch>
+  Type integrate_batch(Batch f, Type a, Type b, control c = control()) {
+    if (asDouble(a) == asDouble(b)) return Type(0);
+    set_flag<Type>(c);
+    bool ainf = !R_FINITE(asDouble(a)), binf = !R_FINITE(asDouble(b));
+    if (!ainf && !binf) return adaptive(f, a, b, c);
+    if (asDouble(a) > asDouble(b)) return -integrate_batch(f, b, a, c);
+    if (ainf && binf) {
+      transform_t<Type, Batch> g(f, 3, Type(0));
+      return adaptive(g, Type(-1), Type(1), c);
+    }
+    transform_t<Type, Batch> g(f, (ainf ? 2 : 1), (ainf ? b : a));
+    return adaptive(g, Type(0), Type(1), c);
+  }
+
+  /** \brief 1D adaptive Gauss-Kronrod integration.
+
+      \param f Univariate functor
+      \param a Lower scalar integration limit (may be -Inf)
+      \param b Upper scalar integration limit (may be Inf)
+      \param c Integration settings
+
+      Example:
+
+      \code
+      #include <TMB.hpp>
+
+      template<class Type>
+      struct univariate {
+        Type theta;               // Parameter in integrand
+        univariate(Type theta_)   // Constructor of integrand
+        : theta (theta_) {}       // Initializer list
+        Type operator()(Type x){  // Evaluate integrand
+          return exp( -theta * (x * x) );
+        }
+      };
+
+      template<class Type>
+      Type objective_function<Type>::operator() () {
+        DATA_SCALAR(a);
+        DATA_SCALAR(b);
+        PARAMETER(theta);
+        univariate<Type> f(theta);
+        Type res = gauss_kronrod::integrate(f, a, b);
+        return res;
+      }
+      \endcode
+  */
+  template<class Type, class F>
+  Type integrate(F f, Type a, Type b, control c = control()) {
+    scalar_batch<Type, F> fb(f);
+    return integrate_batch(fb, a, b, c);
+  }
+
+  template<class Type>
+  struct multivariate_integrand {
+    virtual Type operator()(vector<Type>) = 0;
+    virtual ~multivariate_integrand() {}
+  };
+
+  /* Batch of evaluations along the last coordinate of f */
+  template<class Type>
+  struct slice_batch {
+    multivariate_integrand<Type> &f;
+    vector<Type> &x;
+    slice_batch(multivariate_integrand<Type> &f_, vector<Type> &x_) :
+      f(f_), x(x_) {}
+    vector<Type> operator()(const vector<Type> &y) {
+      vector<Type> ans(y.size());
+      for (int i = 0; i < y.size(); i++) {
+        x[x.size() - 1] = y[i];
+        ans[i] = f(x);
+      }
+      return ans;
+    }
+  };
+
+  /* Integrate out the last coordinate of f */
+  template<class Type>
+  struct integratelast : multivariate_integrand<Type> {
+    multivariate_integrand<Type> &f;
+    vector<Type> x;
+    Type a, b;
+    control c;
+    integratelast(multivariate_integrand<Type> &f_, int dim, Type a_, Type b_,
+                  control c_) : f(f_), x(dim), a(a_), b(b_), c(c_) {}
+    Type operator()(vector<Type> y) {
+      for (int i = 0; i < y.size(); i++) x[i] = y[i];
+      return integrate_batch(slice_batch<Type>(f, x), a, b, c);
+    }
+  };
+
+  template<class Type>
+  Type integrate_multi(multivariate_integrand<Type> &f, vector<Type> a,
+                       vector<Type> b, control c) {
+    int dim = a.size();
+    integratelast<Type> ffirst(f, dim, a(dim - 1), b(dim - 1), c);
+    if (dim == 1) {
+      vector<Type> y(0);
+      return ffirst(y);
+    } else {
+      vector<Type> afirst = a.segment(0, dim - 1);
+      vector<Type> bfirst = b.segment(0, dim - 1);
+      return integrate_multi(ffirst, afirst, bfirst, c);
+    }
+  }
+
+  /** \brief Multi-dimensional adaptive integration by nested 1D
+      Gauss-Kronrod integration. Dimension need not be known at
+      compile time.
+
+      \param f Multivariate functor
+      \param a Lower vector integration limit
+      \param b Upper vector integration limit
+      \param c Integration settings (used in each dimension)
+
+      Example:
+
+      \code
+      #include <TMB.hpp>
+
+      template<class Type>
+      struct multivariate {
+        Type theta;               // Parameter in integrand
+        multivariate(Type theta_) // Constructor of integrand
+        : theta (theta_) {}       // Initializer list
+        Type operator()           // Evaluate integrand
+	(vector<Type> x){
+          return exp( -theta * (x * x).sum() );
+        }
+      };
+
+      template<class Type>
+      Type objective_function<Type>::operator() () {
+        DATA_VECTOR(a);
+        DATA_VECTOR(b);
+        PARAMETER(theta);
+        multivariate<Type> f(theta);
+        Type res = gauss_kronrod::integrate(f, a, b);
+        return res;
+      }
+      \endcode
+  */
+  template<class Type, class F>
+  Type integrate(F f, vector<Type> a, vector<Type> b, control c = control()) {
+    if (a.size() != b.size()) error("gauss_kronrod: Non-conformable limits");
+    // Wrap f in container
+    struct integrand : multivariate_integrand<Type> {
+      F f;
+      integrand(F f_) : f(f_) {}
+      Type operator()(vector<Type> x) {
+        return f(x);
+      }
+    };
+    integrand f_cpy(f);
+    set_flag<Type>(c);
+    return integrate_multi(f_cpy, a, b, c);
+  }
+}
@@ -76,3 +76,70 @@ struct matexp<scalartype,2>{
     return ans;
   }
 };
+
+/** \cond */
+/* Is x a constant (not a variable on any of the nested tapes)? */
+inline bool isConstant(double x){ return true; }
+template <class Type>
+bool isConstant(const CppAD::AD<Type> &x){
+  return !CppAD::Variable(x) && isConstant(CppAD::Value(x));
+}
+/** \endcond */
+
+/** \brief Grouping of equal time steps
+
+    index[i] is the group of step dt[i] and first[k] is the first step
+    of group k. Only constant steps (data) are grouped by value - a
+    step depending on parameters always forms its own group.
+*/
+template <class Type>
+struct step_groups{
+  vector<int> index;
+  vector<int> first;
+  step_groups(){}
+  step_groups(const vector<Type> &dt){
+    index.resize(dt.size());
+    std::map<double, int> group;
+    std::vector<int> first_;
+    for(int i=0;i<dt.size();i++){
+      if(isConstant(dt[i])){
+        std::pair<std::map<double, int>::iterator, bool> ins =
+          group.insert(std::make_pair(asDouble(dt[i]), (int) first_.size()));
+        index[i] = ins.first->second;
+        if(ins.second) first_.push_back(i);
+      } else {
+        index[i] = first_.size();
+        first_.push_back(i);
+      }
+    }
+    first.resize(first_.size());
+    for(int k=0;k<first.size();k++) first[k] = first_[k];
+  }
+  /** \brief Number of distinct steps */
+  int size() const { return first.size(); }
+};
+
+/** \brief Matrix exponentials exp(A*dt[i]) for a vector of time steps
+
+    The matrix exponential (atomic::expm) is computed once per
+    distinct time step (see step_groups), so for a grid with a few
+    distinct step lengths the number of expm evaluations is the
+    number of distinct steps rather than the number of steps.
+    \code
+      expm_steps<Type> P(A, dt);
+      for(int i=0; i<dt.size(); i++) x = P(i) * x;
+    \endcode
+*/
+template <class Type>
+struct expm_steps{
+  step_groups<Type> groups;
+  vector<matrix<Type> > P;   /* One for each group */
+  expm_steps(){}
+  expm_steps(const matrix<Type> &A, const vector<Type> &dt) : groups(dt){
+    P.resize(groups.size());
+    for(int k=0;k<groups.size();k++)
+      P[k] = atomic::expm(matrix<Type>(A * dt[groups.first[k]]));
+  }
+  /** \brief exp(A*dt[i]) */
+  const matrix<Type>& operator()(int i) const { return P[groups.index[i]]; }
+};
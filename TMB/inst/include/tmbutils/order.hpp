@@ -1,7 +1,7 @@
 // Copyright (C) 2013-2015 Kasper Kristensen
 // License: GPL-2
 
-/** \file 
+/** \file
    \brief Taped sorting of a vector.
 
    Example:
@@ -10,53 +10,69 @@
    vector<Type> xsort=perm(x);
    \endcode
 
+   The ranks and the permutations are atomic (atomic::sort_rank and
+   atomic::sort_permute): The key is sorted in double (O(n log n))
+   each time the tape is evaluated, so the tape remains valid when the
+   order of the key changes. The derivative of a permutation is the
+   inverse permutation of the adjoints.
  */
 template <class Type>
 class order{
 public:
-  vector<Type> iperm;
-  matrix<Type> P;
+  vector<Type> iperm; /* Ranks (zero based) - ties in order of appearance */
+  vector<Type> key;
   int n;
   order(vector<Type> x){
-    Type Zero=0;
-    Type One=1;
     n=x.size();
+    key=x;
     iperm.resize(n);
-    iperm.setZero();
-    P.resize(n,n);
-    P.setZero();
-    /* Permutation vector - n^2 comparisons */
-    for(int i=0;i<n;i++)
-      for(int j=0;j<n;j++)
-	iperm[i]+=CppAD::CondExpLt(x[j], x[i], One, Zero );
-    /* Ties correction - n^2/2 comparisons */
-    for(int i=0;i<n;i++)
-      for(int j=0;j<i;j++)
-	iperm[i]+=CppAD::CondExpEq(x[j], x[i], One, Zero );
-    /* Corresponding permutation matrix - n^2 comparisons */
-    for(int i=0;i<n;i++)
-      for(int j=0;j<n;j++)
-	P(j,i)=CppAD::CondExpEq(Type(j), iperm[i], One, Zero );
+    if(n==0) return;
+    CppAD::vector<Type> tx(n);
+    for(int i=0;i<n;i++) tx[i]=x[i];
+    CppAD::vector<Type> r=atomic::sort_rank(tx);
+    for(int i=0;i<n;i++) iperm[i]=r[i];
+  }
+  /* Permute n blocks of length k stored contiguously in x */
+  void permute(const Type* x, Type* y, int k){
+    if(n==0) return;
+    CppAD::vector<Type> tx(1+n+n*k);
+    tx[0]=Type(n);
+    for(int i=0;i<n;i++) tx[1+i]=key[i];
+    for(int i=0;i<n*k;i++) tx[1+n+i]=x[i];
+    CppAD::vector<Type> ty=atomic::sort_permute(tx);
+    for(int i=0;i<n*k;i++) y[i]=ty[i];
   }
   /* Apply permutation on other vector */
   vector<Type> operator()(vector<Type> x){
-    vector<Type> y(x.size());
-    y.setZero();
-    /* y=P%*%x  - n^2 flops */
-    for(int i=0;i<n;i++)
-      for(int j=0;j<n;j++)
-	y[i]+=P(i,j)*x[j];
+    if(x.size()!=n) error("order: Non-conformable arguments");
+    vector<Type> y(n);
+    permute(x.data(),y.data(),1);
     return y;
-  }  
+  }
   /* Apply permutation on outer dimension of array */
   array<Type> operator()(array<Type> x){
+    if(x.cols()!=n) error("order: Non-conformable arguments");
     array<Type> y(x);
-    y.setZero();
-    /* y=P%*%x  - n^2 flops */
-    for(int i=0;i<n;i++)
-      for(int j=0;j<n;j++)
-  	y.row(i)+=x(j)*P(i,j);
+    permute(x.data(),y.data(),x.size()/n);
     return y;
-  }  
+  }
 
 };
+
+/** \brief Sample quantiles (as R's quantile, type 7) of a vector for
+    probabilities p. Sorting is carried out by an order object. */
+template <class Type>
+vector<Type> quantile(vector<Type> x, vector<double> p){
+  int n=x.size();
+  if(n==0) error("quantile: Empty vector");
+  vector<Type> xs=order<Type>(x)(x);
+  vector<Type> ans(p.size());
+  for(int i=0;i<p.size();i++){
+    if(!(p[i]>=0 && p[i]<=1)) error("quantile: 'p' outside [0,1]");
+    double h=(n-1)*p[i];
+    int lo=(int)floor(h);
+    int hi=std::min(lo+1,n-1);
+    ans[i]=xs[lo]+Type(h-lo)*(xs[hi]-xs[lo]);
+  }
+  return ans;
+}
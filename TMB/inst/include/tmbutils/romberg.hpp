@@ -17,6 +17,7 @@ namespace romberg {
       \param n Subdivisions (\f$2^{n-1}+1\f$ function evaluations).
 
       \note The method is not adaptive and the user may have to specify a larger n.
+      See gauss_kronrod::integrate for an adaptive alternative.
 
       Example:
 
@@ -118,6 +119,7 @@ namespace romberg {
       \param n Subdivisions per dimension (\f$(2^{n-1}+1)^d\f$ function evaluations).
 
       \note The method is not adaptive and the user may have to specify a larger n.
+      See gauss_kronrod::integrate for an adaptive alternative.
 
       Example:
 
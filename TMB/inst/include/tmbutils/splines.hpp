@@ -123,18 +123,67 @@ public:
     spline_coef(method,n,x,y,b,c,d,e);
   }
 
-  /* Evaluate spline */
+  /* Evaluate spline at a single point: A few operations on the tape.
+     The interval is located when the tape is recorded, so points that
+     move to another interval must use the vector version below. */
   Type operator()(const Type &x_){
     Type u[1];
     Type v[1];
     int nu[1];
     u[0]=x_;
     nu[0]=1;
+    /* Periodic splines: whole periods are found at evaluation time */
+    if(*method==1 && *n > 1){
+      CppAD::vector<Type> targ(3);
+      targ[0]=x_;
+      targ[1]=x[0];
+      targ[2]=x[*n-1]-x[0];
+      u[0]-=atomic::spline_period(targ)[0]*targ[2];
+    }
     spline_eval(method, nu, u, v,
 		n, x, y, b, c, d);
     return v[0];
   }
 
+  /* Evaluate spline (or its 'deriv'th derivative) at many points as
+     a single tape node (atomic::spline_eval). The interval of each
+     point is found in double by direct indexing (uniform knots) or
+     binary search. */
+  vector<Type> operator()(const vector<Type> &x_, int deriv=0){
+    int m=*n;
+    if(m < 2) error("splinefun: At least two knots required");
+    /* Natural splines extrapolate linearly to the left: Prepend a
+       knot with the linear part of the first interval */
+    int extra=(*method==2 ? 1 : 0);
+    int nk=m+extra;
+    int nu=x_.size();
+    CppAD::vector<Type> arg(2+5*nk+nu);
+    arg[0]=Type(nk);
+    arg[1]=Type(deriv);
+    Type* coef[5]={x, y, b, c, d};
+    for(int j=0;j<5;j++){
+      size_t pos=2+j*nk;
+      if(extra) arg[pos++]=(j<3 ? coef[j][0] : Type(0));
+      for(int i=0;i<m;i++) arg[pos+i]=coef[j][i];
+    }
+    for(int l=0;l<nu;l++) arg[2+5*nk+l]=x_[l];
+    /* Periodic splines: map into the first period. The number of
+       whole periods is found at evaluation time (atomic::spline_period) */
+    if(*method==1){
+      Type period=x[m-1]-x[0];
+      CppAD::vector<Type> targ(nu+2);
+      for(int l=0;l<nu;l++) targ[l]=x_[l];
+      targ[nu]=x[0];
+      targ[nu+1]=period;
+      CppAD::vector<Type> r=atomic::spline_period(targ);
+      for(int l=0;l<nu;l++) arg[2+5*nk+l]-=r[l]*period;
+    }
+    CppAD::vector<Type> res=atomic::spline_eval(arg);
+    vector<Type> ans(nu);
+    for(int l=0;l<nu;l++) ans[l]=res[l];
+    return ans;
+  }
+
   /* ------------------------------------------------------------------ 
    * The following is copy-pasted from R-package "stats" where "double"
    * has been replaced by "Type".
@@ -465,8 +514,10 @@ public:
 
 	/* WARNING - "fmod(AD<double>,AD<double>)" is not defined */
 	// v[l] = fmod(u[l]-x[0], dx);
-	if(v[l] < 0.0) v[l] += dx;
-	v[l] += x[0];
+	tmp = (u[l] - x[0]) / dx;
+	i = CppAD::Integer(tmp);
+	if(tmp < Type(i)) i--;
+	v[l] = u[l] - Type(i) * dx;
       }
     }
     else {
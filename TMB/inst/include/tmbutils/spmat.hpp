@@ -49,6 +49,151 @@ Eigen::SparseVector<Type> asSparseVector(vector<Type> x){
   return mat;  
 }
 
+/** \brief Fixed sparsity pattern in compressed column form.
+
+    Used to assemble sparse matrices with AD valued nonzeros: The
+    pattern is set up once (integer work only) and the nonzeros are
+    kept in a separate contiguous vector. Positions of entries are
+    looked up when the pattern is set up, so the assembly itself
+    involves no searching or insertion.
+*/
+struct sparse_pattern {
+  int rows, cols;
+  std::vector<int> outer; /* Column start (length cols+1) */
+  std::vector<int> inner; /* Row index of each nonzero */
+  sparse_pattern() : rows(0), cols(0), outer(1, 0) {}
+  /** \brief Pattern of (i[k], j[k]) pairs (duplicates are merged) */
+  sparse_pattern(int rows_, int cols_,
+                 const std::vector<int> &i, const std::vector<int> &j) :
+    rows(rows_), cols(cols_), outer(cols_ + 1, 0) {
+    std::vector<std::pair<int, int> > ji(i.size());
+    for (size_t k = 0; k < i.size(); k++) ji[k] = std::make_pair(j[k], i[k]);
+    std::sort(ji.begin(), ji.end());
+    ji.erase(std::unique(ji.begin(), ji.end()), ji.end());
+    inner.resize(ji.size());
+    for (size_t k = 0; k < ji.size(); k++) {
+      inner[k] = ji[k].second;
+      outer[ji[k].first + 1]++;
+    }
+    for (int c = 0; c < cols; c++) outer[c + 1] += outer[c];
+  }
+  /** \brief Pattern of an Eigen sparse matrix */
+  template<class T>
+  sparse_pattern(const Eigen::SparseMatrix<T> &A) :
+    rows(A.rows()), cols(A.cols()), outer(A.cols() + 1, 0) {
+    typedef typename Eigen::SparseMatrix<T>::InnerIterator Iterator;
+    for (int c = 0; c < cols; c++) {
+      for (Iterator it(A, c); it; ++it) inner.push_back(it.row());
+      outer[c + 1] = inner.size();
+    }
+  }
+  int nonZeros() const { return inner.size(); }
+  /** \brief Append the (row, col) pairs of the pattern to i and j */
+  void pairs(std::vector<int> &i, std::vector<int> &j) const {
+    for (int c = 0; c < cols; c++)
+      for (int k = outer[c]; k < outer[c + 1]; k++) {
+        i.push_back(inner[k]);
+        j.push_back(c);
+      }
+  }
+  /** \brief Position of entry (i,j) in the value vector (-1 if absent) */
+  int index(int i, int j) const {
+    std::vector<int>::const_iterator
+      first = inner.begin() + outer[j],
+      last = inner.begin() + outer[j + 1],
+      it = std::lower_bound(first, last, i);
+    return (it != last && *it == i ? it - inner.begin() : -1);
+  }
+  /** \brief Positions of the nonzeros of a sub pattern */
+  std::vector<int> index(const sparse_pattern &A) const {
+    std::vector<int> ans(A.nonZeros());
+    for (int c = 0; c < A.cols; c++)
+      for (int k = A.outer[c]; k < A.outer[c + 1]; k++) {
+        ans[k] = index(A.inner[k], c);
+        if (ans[k] < 0) error("sparse_pattern: Not a sub pattern");
+      }
+    return ans;
+  }
+  /** \brief Values of an Eigen sparse matrix with this pattern */
+  template<class Type>
+  vector<Type> values(const Eigen::SparseMatrix<Type> &A) const {
+    typedef typename Eigen::SparseMatrix<Type>::InnerIterator Iterator;
+    vector<Type> x(nonZeros());
+    x.setZero();
+    for (int c = 0; c < A.outerSize(); c++)
+      for (Iterator it(A, c); it; ++it) {
+        int k = index(it.row(), it.col());
+        if (k < 0) error("sparse_pattern: Not a sub pattern");
+        x[k] = it.value();
+      }
+    return x;
+  }
+  /** \brief Eigen sparse matrix with this pattern and nonzeros x */
+  template<class Type>
+  Eigen::SparseMatrix<Type> asSparseMatrix(const vector<Type> &x) const {
+    Eigen::SparseMatrix<Type> A(rows, cols);
+    A.reserve(nonZeros());
+    for (int c = 0; c < cols; c++) {
+      A.startVec(c);
+      for (int k = outer[c]; k < outer[c + 1]; k++)
+        A.insertBack(inner[k], c) = x[k];
+    }
+    A.finalize();
+    return A;
+  }
+};
+
+/** \brief Precomputed product C=A*B of two fixed sparse patterns.
+
+    The pattern of C and, for each nonzero of C, the pairs of nonzeros
+    of A and B contributing to it are found once. Evaluation is then a
+    flat loop over these pairs.
+*/
+struct sparse_product {
+  sparse_pattern C;
+  std::vector<int> ptr;         /* Pairs of C nonzero k: ptr[k]...ptr[k+1]-1 */
+  std::vector<int> apos, bpos;  /* Nonzeros of A and B of each pair */
+  sparse_product() {}
+  sparse_product(const sparse_pattern &A, const sparse_pattern &B) {
+    if (A.cols != B.rows) error("sparse_product: Non-conformable arguments");
+    C.rows = A.rows; C.cols = B.cols;
+    C.outer.assign(B.cols + 1, 0);
+    ptr.push_back(0);
+    std::vector<std::pair<int, std::pair<int, int> > > col; /* (row, (ka, kb)) */
+    for (int j = 0; j < B.cols; j++) {
+      col.resize(0);
+      for (int kb = B.outer[j]; kb < B.outer[j + 1]; kb++) {
+        int l = B.inner[kb];
+        for (int ka = A.outer[l]; ka < A.outer[l + 1]; ka++)
+          col.push_back(std::make_pair(A.inner[ka], std::make_pair(ka, kb)));
+      }
+      std::sort(col.begin(), col.end());
+      for (size_t p = 0; p < col.size(); p++) {
+        if (p == 0 || col[p].first != col[p - 1].first) {
+          if (p > 0) ptr.push_back(apos.size());
+          C.inner.push_back(col[p].first);
+        }
+        apos.push_back(col[p].second.first);
+        bpos.push_back(col[p].second.second);
+      }
+      if (col.size() > 0) ptr.push_back(apos.size());
+      C.outer[j + 1] = C.inner.size();
+    }
+  }
+  /** \brief Nonzeros of C given the nonzeros of A and B */
+  template<class Type>
+  vector<Type> operator()(const vector<Type> &a, const vector<Type> &b) const {
+    vector<Type> c(C.nonZeros());
+    for (int k = 0; k < C.nonZeros(); k++) {
+      int p = ptr[k];
+      Type s = a[apos[p]] * b[bpos[p]];
+      for (p++; p < ptr[k + 1]; p++) s += a[apos[p]] * b[bpos[p]];
+      c[k] = s;
+    }
+    return c;
+  }
+};
+
 /** Kronecker product of two sparse matrices */
 template <class Type>
 Eigen::SparseMatrix<Type> kronecker(Eigen::SparseMatrix<Type> x,
@@ -76,29 +221,13 @@ Eigen::SparseMatrix<Type> kronecker(Eigen::SparseMatrix<Type> x,
   return mat;
 }
 
-/** Solve discrete Lyapunov equation V=AVA'+I */
+/** Solve discrete Lyapunov equation V=AVA'+I (atomic::discrLyap,
+    Bartels-Stewart in O(n^3)) */
 template <class Type>
 matrix<Type> discrLyap(matrix<Type> A_){
   matrix<Type> I_(A_.rows(),A_.cols());
   I_.setIdentity();
-  /* Sparse representations */
-  Eigen::SparseMatrix<Type> A=asSparseMatrix(A_);
-  Eigen::SparseMatrix<Type> I=asSparseMatrix(I_);
-  /* Kronecker */
-  Eigen::SparseMatrix<Type> AxA=kronecker(A,A);
-  Eigen::SparseMatrix<Type> IxI=kronecker(I,I);
-  matrix<Type> vecI=I_.vec().matrix();
-  Eigen::SparseMatrix<Type> C=IxI-AxA;
-  /* Solve system C*vecV=vecI.
-     Note: No assumptions on symmetry or eigenvalue-range of C. Therefore 
-     rewrite it as (C'*C)*vecV=(C*vecI). Since (C'*C) is symmetric, the 
-     LDL'-factorization can be applied.
-   */
-  Eigen::SimplicialLDLT< Eigen::SparseMatrix<Type> > ldlt(C.transpose()*C);
-  matrix<Type> z = ldlt.solve(C.transpose()*vecI);
-  matrix<Type> V(A_.rows(),A_.cols());
-  for(int i=0;i<z.size();i++)V(i)=z(i);
-  return V;
+  return atomic::discrLyap(A_, I_);
 }
 
 /** Inverse of PD sparse matrix */
@@ -33,4 +33,5 @@ namespace density{
 } // End namespace
 
 #include "romberg.hpp"
+#include "gauss_kronrod.hpp"
 #include "autodiff.hpp"
@@ -0,0 +1,37 @@
+// Poisson random walk with vector atomics of the random effects.
+#include <TMB.hpp>
+
+template<class Type>
+Type objective_function<Type>::operator() ()
+{
+  DATA_INTEGER(use_atomic); // Vector atomics (1) or elementwise operators (0)?
+  DATA_VECTOR(y);           // Counts
+  DATA_INTEGER(sum_exp);    // Only sum(exp(u)): Gradient is an atomic result
+  PARAMETER_VECTOR(u);      // Log intensities (random effects)
+  PARAMETER(logsd);
+
+  if (sum_exp) return sum(exp(u));
+
+  int n = y.size();
+  Type ans = 0;
+  // Random walk prior: tridiagonal random effect Hessian
+  for (int i = 1; i < n; i++)
+    ans -= dnorm(u(i), u(i - 1), exp(logsd), true);
+
+  // Observations: exp(u) and sqrt(lambda) are single tape nodes when
+  // 'u' is passed as a vector.
+  vector<Type> lambda(n), s(n);
+  if (use_atomic) {
+    lambda = exp(u);
+    s = sqrt(lambda);
+  } else {
+    for (int i = 0; i < n; i++) {
+      lambda(i) = exp(u(i));
+      s(i) = sqrt(lambda(i));
+    }
+  }
+  ans -= sum(dpois(y, lambda, true));
+  // Extra smooth penalty touching each element
+  ans += Type(0.01) * sum(s);
+  return ans;
+}
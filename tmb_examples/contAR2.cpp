@@ -0,0 +1,40 @@
+// Continuous AR(2) process observed with noise on an irregular grid.
+//
+// The grid has a few distinct increments, so contAR2 computes the
+// matrix exponential and the increment distribution once per distinct
+// increment. With grouped=0 the same density is evaluated with one
+// contAR2 object per increment (a check of the grouping).
+#include <TMB.hpp>
+
+template<class Type>
+Type objective_function<Type>::operator() ()
+{
+  DATA_VECTOR(grid);     // Irregular grid
+  DATA_VECTOR(y);        // Observations at the grid points
+  DATA_INTEGER(grouped); // Use the grouped increments of contAR2?
+
+  PARAMETER_VECTOR(x);   // Process
+  PARAMETER_VECTOR(dx);  // Derivative of the process (nuisance)
+  PARAMETER(tshape);     // shape=tanh(tshape)
+  PARAMETER(logscale);
+  PARAMETER(logsd);
+
+  Type shape=tanh(tshape);
+  Type scale=exp(logscale);
+  int n=grid.size();
+  Type ans=0;
+  if(grouped){
+    ans+=density::contAR2(grid,shape,scale)(x,dx);
+  } else {
+    // Density of the first point and one increment per object
+    density::contAR2_t<Type> first(grid.segment(0,1),shape,scale);
+    ans+=first(x.segment(0,1),dx.segment(0,1));
+    for(int i=1;i<n;i++){
+      density::contAR2_t<Type> step(grid.segment(i-1,2),shape,scale);
+      ans+=step(x.segment(i-1,2),dx.segment(i-1,2));
+      ans-=first(x.segment(i-1,1),dx.segment(i-1,1));
+    }
+  }
+  ans-=dnorm(y,x,exp(logsd),true).sum();
+  return ans;
+}
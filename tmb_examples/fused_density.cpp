@@ -0,0 +1,53 @@
+// Fused sum-of-log-density operators versus the elementwise densities.
+#include <TMB.hpp>
+
+template<class Type>
+Type objective_function<Type>::operator() ()
+{
+  DATA_INTEGER(fused);    // Use the fused dxxx_sum operators?
+  DATA_VECTOR(x);         // Continuous observations
+  DATA_VECTOR(y);         // Positive observations
+  DATA_VECTOR(k);         // Counts
+  PARAMETER_VECTOR(u);    // Random effects (one per observation)
+  PARAMETER(logsdu);
+  PARAMETER(mu);
+  PARAMETER(logsd);
+  PARAMETER(logshape);
+  PARAMETER(logsize);
+  PARAMETER(logitprob);
+  PARAMETER(logitzip);
+
+  Type sd = exp(logsd), shape = exp(logshape), size = exp(logsize);
+  Type prob = invlogit(logitprob), zip = invlogit(logitzip);
+  vector<Type> eta = mu + u;
+  vector<Type> lambda = exp(eta);
+  vector<Type> scale = exp(eta) / shape;
+  vector<Type> var = lambda + lambda * lambda / size;
+
+  Type ans = 0;
+  // Scalar and vector parameters are both covered.
+  if (fused) {
+    ans -= dnorm_sum(u, Type(0), exp(logsdu));
+    ans -= dnorm_sum(x, eta, sd);
+    ans -= dpois_sum(k, lambda);
+    ans -= dgamma_sum(y, shape, scale);
+    ans -= dnbinom_sum(k, size, prob);
+    ans -= dnbinom2_sum(k, lambda, var);
+    ans -= dzipois_sum(k, lambda, zip);
+    ans -= dzinbinom_sum(k, size, prob, zip);
+    ans -= dzinbinom2_sum(k, lambda, var, zip);
+  } else {
+    ans -= sum(dnorm(u, Type(0), exp(logsdu), true));
+    ans -= sum(dnorm(x, eta, sd, true));
+    ans -= sum(dpois(k, lambda, true));
+    for (int i = 0; i < k.size(); i++) {
+      ans -= dgamma(y(i), shape, scale(i), true);
+      ans -= dnbinom(k(i), size, prob, true);
+      ans -= dnbinom2(k(i), lambda(i), var(i), true);
+      ans -= dzipois(k(i), lambda(i), zip, true);
+      ans -= dzinbinom(k(i), size, prob, zip, true);
+      ans -= dzinbinom2(k(i), lambda(i), var(i), zip, true);
+    }
+  }
+  return ans;
+}
@@ -0,0 +1,32 @@
+// GMRF on a lattice with and without the atomic sparse operations
+// (log determinant, quadratic form, matrix-vector product and
+// marginal variances).
+#include <TMB.hpp>
+using namespace density;
+using namespace Eigen;
+
+template<class Type>
+Type objective_function<Type>::operator() ()
+{
+  DATA_INTEGER(use_atomic);  // Use the atomic sparse operations?
+  DATA_VECTOR(y);            // Observations (local averages of the field)
+  DATA_SPARSE_MATRIX(B);     // Averaging operator
+  DATA_SPARSE_MATRIX(I);     // Identity
+  DATA_SPARSE_MATRIX(G);     // Graph Laplacian of the lattice
+  PARAMETER_VECTOR(x);       // Random field
+  PARAMETER(logtau);
+  PARAMETER(logkappa);
+  PARAMETER(logsd);
+
+  Type kappa2 = exp(2. * logkappa);
+  SparseMatrix<Type> Q = exp(logtau) * (kappa2 * I + G);
+  GMRF_t<Type> gmrf(Q, 1, use_atomic);
+  Type nll = gmrf(x);
+  vector<Type> eta = (use_atomic ? atomic::matvec(B, x) : vector<Type>(B * x.matrix()));
+  nll -= sum(dnorm(y, eta, exp(logsd), true));
+  // Weak prior on the average marginal standard deviation
+  vector<Type> sdx = sqrt(gmrf.variance());
+  nll -= dnorm(log(sdx.mean()), Type(0), Type(2), true);
+  ADREPORT(sdx);
+  return nll;
+}
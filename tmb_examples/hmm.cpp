@@ -30,6 +30,10 @@ Type objective_function<Type>::operator() ()
   DATA_SCALAR(dt);
   // Measurements are grid-cell pointers (zero-based)
   DATA_IVECTOR(yobs);
+  // Propagate by the sparse generator (expmv)?
+  DATA_INTEGER(sparse);
+  // Irregular times: Time steps leading to each measurement (if non-empty)
+  DATA_VECTOR(dtobs);
 
   PARAMETER(lambda);
   PARAMETER(gamma);
@@ -46,9 +50,11 @@ Type objective_function<Type>::operator() ()
   REPORT(fvol.A);
 
   /* Construct likelihood function */
-  hmm_filter<Type> hmm_nll(fvol, dt);
+  hmm_filter<Type> hmm_nll = (sparse ?
+                              hmm_filter<Type>(fvol.As, fvol.grid, dt) :
+                              hmm_filter<Type>(fvol, dt));
   hmm_nll.setGaussianError(sigmaY);
-  Type ans = hmm_nll(yobs);
+  Type ans = (dtobs.size() > 0 ? hmm_nll(yobs, dtobs) : hmm_nll(yobs));
 
   return ans;
 }
@@ -7,6 +7,7 @@
 template<template <typename> class sde_t, class Type>
 struct fvade_t{
   matrix<Type> A;
+  Eigen::SparseMatrix<Type> As; // Tridiagonal generator in sparse form
   vector<Type> grid;
   fvade_t(sde_t<Type> sde, vector<Type> grid){
     this->grid = grid;
@@ -37,6 +38,12 @@ struct fvade_t{
     G = G / h;
     /* Setup generator */
     A = (-G + L);
+    std::vector<Eigen::Triplet<Type> > T;
+    for (int i = 0; i < nvol; i++)
+      for (int j = std::max(i - 1, 0); j <= std::min(i + 1, nvol - 1); j++)
+        T.push_back(Eigen::Triplet<Type>(i, j, A(i, j)));
+    As.resize(nvol, nvol);
+    As.setFromTriplets(T.begin(), T.end());
   }
 };
 template<template <typename> class sde_t, class Type>
@@ -47,12 +54,23 @@ fvade_t<sde_t, Type> fvade(sde_t<Type> sde, vector<Type> grid){
 /*
   Evaluate negative log-likelihood of hidden Markov model, specified
   through the (time-constant) generator matrix of the
-  process. Assuming equidistant measurements in time.
+  process. Assuming equidistant measurements in time (or irregular
+  times with the two argument operator()).
+
+  With a dense generator the filter is evaluated by the scaled
+  forward algorithm (dhmm), which occupies a single tape node.
+  With a sparse generator the state distribution is propagated by the
+  action exp(A*dt)*px (atomic::expmv) and the dense transition matrix
+  is never formed. This is preferable on large grids.
 */
 template<class Type>
 struct hmm_filter{
+  matrix<Type> A;  // Generator
   matrix<Type> P;  // Transition prob (transposed)
   matrix<Type> P0; // Observation error (transposed)
+  matrix<Type> logP0; // log(P0)
+  Eigen::SparseMatrix<Type> As; // Sparse generator
+  bool sparse;     // Propagate by expmv?
   Type dt;
   int n;
   vector<Type> grid;
@@ -61,10 +79,15 @@ struct hmm_filter{
      dt: Timestep between measurements
   */
   void init(matrix<Type> A, vector<Type> grid, Type dt){
+    this->A = A;
+    sparse = false;
     P = expm(matrix<Type>(A*dt));
     int n = A.rows();
     P0 = matrix<Type>(n, n);
     P0.setIdentity(); // Default: no obs error
+    logP0 = matrix<Type>(n, n);
+    logP0.setConstant(-INFINITY);
+    logP0.diagonal().setZero();
     this->dt = dt;
     this->n = n;
     this->grid = grid;
@@ -72,6 +95,20 @@ struct hmm_filter{
   hmm_filter(matrix<Type> A, vector<Type> grid, Type dt){
     init(A,grid,dt);
   }
+  /* Sparse generator: P is not formed */
+  hmm_filter(Eigen::SparseMatrix<Type> As, vector<Type> grid, Type dt){
+    this->As = As;
+    sparse = true;
+    int n = As.rows();
+    P0 = matrix<Type>(n, n);
+    P0.setIdentity(); // Default: no obs error
+    logP0 = matrix<Type>(n, n);
+    logP0.setConstant(-INFINITY);
+    logP0.diagonal().setZero();
+    this->dt = dt;
+    this->n = n;
+    this->grid = grid;
+  }
   template<class fvade_t>
   hmm_filter(fvade_t fvol, Type dt){
     init(fvol.A,fvol.grid,dt);
@@ -80,19 +117,41 @@ struct hmm_filter{
     vector<Type> xm = Type(.5) * (grid.head(n) + grid.tail(n));
     for(int i=0;i<n;i++)
       for(int j=0;j<n;j++)
-	P0(i,j) = dnorm(xm[j],xm[i],sd,false);
+	logP0(i,j) = dnorm(xm[j],xm[i],sd,true);
+    for(int i=0;i<n;i++)
+      for(int j=0;j<n;j++)
+	P0(i,j) = exp(logP0(i,j));
     // Normalize
     vector<Type> cs = P0.colwise().sum();
-    for(int i=0;i<n;i++) P0.col(i) /= cs[i];
+    for(int i=0;i<n;i++){
+      P0.col(i) /= cs[i];
+      logP0.col(i).array() -= log(cs[i]);
+    }
+  }
+  /* Emission log densities of observations (state x time) */
+  matrix<Type> logdens(vector<int> obs){
+    matrix<Type> L(n, obs.size());
+    for(int k=0; k<obs.size(); k++)
+      L.col(k) = logP0.row(obs[k]).transpose();
+    return L;
   }
   /* Update step */
   vector<Type> multiply(matrix<Type> x, vector<Type> y){
     return atomic::matmul(x, matrix<Type>(y.matrix())).vec();
   }
   void update(vector<Type> &px, Type &nll, int yobs){
+    if (sparse)
+      update(atomic::expmv(As, px, dt), px, nll, yobs);
+    else
+      update(multiply(P, px), px, nll, yobs);
+  }
+  void update(const matrix<Type> &P, vector<Type> &px, Type &nll, int yobs){
+    update(multiply(P, px), px, nll, yobs);
+  }
+  /* Ppx: Predicted distribution */
+  void update(const vector<Type> &Ppx, vector<Type> &px, Type &nll, int yobs){
     // Update joint distribution (J) of state and measurement, and
     // extract 'yobs'-slice:
-    vector<Type> Ppx = multiply(P, px);
     vector<Type> Jslice = Ppx * vector<Type>(P0.row(yobs));
     // Integrated slice is yobs-likelihood:
     Type Ly = Jslice.sum();
@@ -106,10 +165,38 @@ struct hmm_filter{
     px.setZero();
     px += 1.0 / Type(px.size()); // Uniform initial distribution
     px /= grid[1]-grid[0];       // prob -> density
+    if(!sparse && obs.size() > 0){
+      return -dhmm(logdens(obs), multiply(P, px),
+                   matrix<Type>(P.transpose()));
+    }
     Type nll = 0;
     for(int k=0; k<obs.size(); k++){
       update(px, nll, obs[k]);
     }
     return nll;
   }
+  /* Evaluate negative log likelihood of observations taken at
+     irregular times: dt[k] is the time step leading to observation
+     k. The transition matrix is computed once for each distinct time
+     step (see expm_steps). */
+  Type operator()(vector<int> obs, vector<Type> dt){
+    vector<Type> px(n);
+    px.setZero();
+    px += 1.0 / Type(px.size()); // Uniform initial distribution
+    px /= grid[1]-grid[0];       // prob -> density
+    Type nll = 0;
+    if (sparse) {
+      for(int k=0; k<obs.size(); k++){
+        update(atomic::expmv(As, px, dt[k]), px, nll, obs[k]);
+      }
+      return nll;
+    }
+    if(obs.size() == 0) return nll;
+    tmbutils::expm_steps<Type> Pdt(A, dt);
+    vector<matrix<Type> > Gamma(Pdt.P.size());
+    for(int k=0; k<Gamma.size(); k++)
+      Gamma[k] = Pdt.P[k].transpose();
+    vector<int> idx = Pdt.groups.index.segment(1, obs.size() - 1);
+    return -dhmm(logdens(obs), multiply(Pdt(0), px), Gamma, idx);
+  }
 };
@@ -0,0 +1,63 @@
+// Inference in a linear scalar stochastic differential equation
+// (as sde_linear.cpp) with the states integrated out by the Kalman
+// filter instead of the Laplace approximation.
+//
+// dX = - lambda*X*dt + sigmaX*dB
+//
+// based on discrete observations
+//
+// Y(i) = X(t(i)) + e(i)
+//
+// where e(i) is N(0,sigmaY^2)
+//
+// The Euler discretization on the (equidistant) simulation mesh is a
+// linear Gaussian state space model, so there are no random effects.
+// The initial state has a vague N(0, 10^2) prior.
+//
+// With lagged=1 the state is (X(t), X(t-dt)), i.e. the same model with
+// singular P0 and Q (a check of kalman_filter).
+
+#include <TMB.hpp>
+
+template<class Type>
+Type objective_function<Type>::operator() ()
+{
+  DATA_VECTOR(tsim);     // Equidistant time points where X is simulated
+  DATA_VECTOR(iobs);     // Indeces into tsim where X is observed
+  DATA_VECTOR(Y);        // Observations taken. Must have same length as iobs.
+  DATA_INTEGER(lagged);  // Include the lagged state X(t-dt)
+
+  PARAMETER(lambda);     // Rate parameter in the SDE
+  PARAMETER(logsX);      // log(sigmaX) where sigmaX is noise intensity in the SDE
+  PARAMETER(logsY);      // log(sigmaY) where sigmaY is std.dev. on measurement error
+
+  Type sX=exp(logsX);
+  Type sY=exp(logsY);
+  Type dt=tsim(1)-tsim(0);
+
+  // System matrices of the Euler scheme
+  int n=1+lagged;
+  vector<Type> m0(n);   m0.setZero();
+  matrix<Type> P0(n,n); P0.setZero(); P0(0,0)=100;
+  matrix<Type> F(n,n);  F.setZero();  F(0,0)=1+lambda*dt;
+  matrix<Type> Q(n,n);  Q.setZero();  Q(0,0)=sX*sX*dt;
+  matrix<Type> H(1,n);  H.setZero();  H(0,0)=1;
+  matrix<Type> R(1,1);  R(0,0)=sY*sY;
+  if(lagged) F(1,0)=1;
+
+  // Observations on the simulation mesh (NaN: unobserved)
+  matrix<Type> Yobs(1,tsim.size());
+  Yobs.setConstant(NAN);
+  for(int i=0;i<Y.size();i++)
+    Yobs(0,CppAD::Integer(iobs(i)))=Y(i);
+
+  // Smoothed states for reporting (not needed on the AD tapes)
+  if(isDouble<Type>::value){
+    matrix<Type> Xsd;
+    matrix<Type> Xpred=kalman_smoother(m0,P0,F,Q,H,R,Yobs,Xsd);
+    REPORT(Xpred);
+    REPORT(Xsd);
+  }
+
+  return -kalman_filter(m0,P0,F,Q,H,R,Yobs);
+}
@@ -28,8 +28,12 @@ Type objective_function<Type>::operator()()
     nll -= dnorm(x(i), x(i - 1) + mu, exp(logsigma), true);
 
   // Observations
-  for (int i = 0; i < y.size(); ++i)
+  for (int i = 0; i < y.size(); ++i) {
     nll -= keep(i) * dnorm(y(i), x(i), exp(logs), true);
+    // For one-step predictions by method="cdf"
+    nll -= keep.cdf_lower(i) * log( pnorm(y(i), x(i), exp(logs)) );
+    nll -= keep.cdf_upper(i) * log( 1.0 - pnorm(y(i), x(i), exp(logs)) );
+  }
 
   return nll;
 }
@@ -0,0 +1,23 @@
+// Forward mode of order 1 and 2 through atomic functions.
+#include <TMB.hpp>
+
+template<class Type>
+vector<Type> userfun(vector<Type> x) {
+  vector<Type> y(2);
+  y(0) = exp(x(0)) * x(1);
+  y(1) = sin(x(1)) * x(0) * x(0);
+  return y;
+}
+REGISTER_ATOMIC(userfun)
+
+template<class Type>
+Type objective_function<Type>::operator() ()
+{
+  PARAMETER_MATRIX(A);    // 2 x 2
+  PARAMETER_MATRIX(B);    // 2 x 3
+  PARAMETER_VECTOR(x);    // length 2
+  matrix<Type> C = atomic::matmul(A, B);
+  matrix<Type> Ai = atomic::matinv(A);
+  vector<Type> c = C.vec();
+  return exp(c).sum() + Ai.sum() + userfun(x).sum() + pnorm(x).sum();
+}
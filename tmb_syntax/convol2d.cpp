@@ -0,0 +1,13 @@
+// Valid 2D correlation y(i,j) = sum_ab x(i+a,j+b) K(a,b)
+#include <TMB.hpp>
+
+template<class Type>
+Type objective_function<Type>::operator() ()
+{
+  DATA_MATRIX(W);  // Weights of the entries of y
+  PARAMETER_MATRIX(x);
+  PARAMETER_MATRIX(K);
+  matrix<Type> y = atomic::convol2d(x, K);
+  REPORT(y);
+  return (W.array() * y.array()).sum();
+}
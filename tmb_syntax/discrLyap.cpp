@@ -0,0 +1,16 @@
+// Solution V of the discrete Lyapunov equation V = A V A' + Q
+#include <TMB.hpp>
+
+template<class Type>
+Type objective_function<Type>::operator() ()
+{
+  DATA_MATRIX(W);         // Weights of the entries of V
+  DATA_INTEGER(identity); // Q = I (tmbutils::discrLyap)?
+  PARAMETER_MATRIX(A);
+  PARAMETER_MATRIX(Q);
+  matrix<Type> V = (identity ?
+                    tmbutils::discrLyap(A) :
+                    atomic::discrLyap(A, Q));
+  REPORT(V);
+  return (W.array() * V.array()).sum();
+}
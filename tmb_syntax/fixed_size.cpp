@@ -0,0 +1,45 @@
+// Fixed size (dimension up to 4) code paths against the dynamic ones:
+// - what=0,1: expm of A (FixedBlock) and expm of the block diagonal
+//   matrix diag(A, B) of dimension > 4 (Block<double>).
+// - what=2,3: MVNORM_fixed_t and MVNORM_t with Sigma=(A+A')/2.
+#include <TMB.hpp>
+
+template<class Type, int N>
+Type mvnorm_fixed(const matrix<Type> &Sigma, const vector<Type> &x) {
+  Eigen::Matrix<Type, N, N> S;
+  Eigen::Matrix<Type, N, 1> y;
+  for (int i = 0; i < N * N; i++) S(i) = Sigma(i);
+  for (int i = 0; i < N; i++) y(i) = x(i);
+  return density::MVNORM_fixed_t<Type, N>(S)(y);
+}
+
+template<class Type>
+Type objective_function<Type>::operator() ()
+{
+  DATA_INTEGER(what);
+  DATA_MATRIX(W);         // Weights of the entries of expm(A)
+  DATA_MATRIX(B);         // Second block (dimension > 4 - n)
+  PARAMETER_MATRIX(A);    // n x n
+  PARAMETER_VECTOR(x);    // length n
+  int n = A.rows();
+  if (what == 0) {
+    return (W.array() * expm(A).array()).sum();
+  }
+  if (what == 1) {
+    int m = B.rows();
+    matrix<Type> D(n + m, n + m);
+    D.setZero();
+    D.topLeftCorner(n, n) = A;
+    D.bottomRightCorner(m, m) = B;
+    matrix<Type> E = expm(D);
+    return (W.array() * E.topLeftCorner(n, n).array()).sum();
+  }
+  matrix<Type> Sigma = Type(.5) * (A + matrix<Type>(A.transpose()));
+  if (what == 3) return density::MVNORM(Sigma)(x);
+  switch (n) {
+  case 2: return mvnorm_fixed<Type, 2>(Sigma, x);
+  case 3: return mvnorm_fixed<Type, 3>(Sigma, x);
+  default: error("Dimension not implemented");
+  }
+  return 0;
+}
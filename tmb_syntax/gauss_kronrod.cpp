@@ -0,0 +1,34 @@
+// Check of gauss_kronrod::integrate (see gauss_kronrod.R)
+#include <TMB.hpp>
+
+template<class Type>
+struct univariate {
+  Type theta0, theta1;
+  univariate(Type theta0_, Type theta1_) : theta0(theta0_), theta1(theta1_) {}
+  Type operator()(Type x) {
+    return exp( -theta0 * x * x + theta1 * x );
+  }
+};
+
+template<class Type>
+struct multivariate {
+  Type theta0, theta1;
+  multivariate(Type theta0_, Type theta1_) : theta0(theta0_), theta1(theta1_) {}
+  Type operator()(vector<Type> x) {
+    return exp( -theta0 * (x * x).sum() + theta1 * x.prod() );
+  }
+};
+
+template<class Type>
+Type objective_function<Type>::operator() ()
+{
+  DATA_VECTOR(a);
+  DATA_VECTOR(b);
+  PARAMETER_VECTOR(theta);
+  if (a.size() == 1) {
+    univariate<Type> f(theta[0], theta[1]);
+    return gauss_kronrod::integrate(f, Type(a[0]), Type(b[0]));
+  }
+  multivariate<Type> f(theta[0], theta[1]);
+  return gauss_kronrod::integrate(f, vector<Type>(a), vector<Type>(b));
+}
@@ -0,0 +1,28 @@
+// Derivatives of the scaled incomplete gamma function wrt. the shape
+// parameter (atomic::D_incpl_gamma_shape) and the numerical
+// integration it falls back on.
+#include <TMB.hpp>
+
+template<class Type>
+Type objective_function<Type>::operator() ()
+{
+  DATA_VECTOR(x);
+  DATA_VECTOR(logc);
+  DATA_INTEGER(n);      // Order of the derivative
+  PARAMETER_VECTOR(shape);
+  vector<Type> value(x.size());
+  vector<Type> integrate(x.size());
+  for (int i = 0; i < x.size(); i++) {
+    CppAD::vector<Type> tx(4);
+    tx[0] = x[i];
+    tx[1] = shape[i];
+    tx[2] = Type(n);
+    tx[3] = logc[i];
+    value[i] = atomic::D_incpl_gamma_shape(tx)[0];
+    integrate[i] = atomic::Rmath::D_incpl_gamma_shape_integrate(
+      asDouble(x[i]), asDouble(shape[i]), n, asDouble(logc[i]));
+  }
+  REPORT(value);
+  REPORT(integrate);
+  return value.sum();
+}
@@ -0,0 +1,35 @@
+// MVNORM_sum against a loop over MVNORM. The columns of X are split
+// in groups and each group uses one of two covariance matrices, so
+// MVNORM_sum is called repeatedly with the same Sigma.
+#include <TMB.hpp>
+
+template<class Type>
+Type objective_function<Type>::operator() ()
+{
+  DATA_INTEGER(looped);  // Use MVNORM (1) or MVNORM_sum (0)
+  DATA_IVECTOR(group);   // Group of each column of X (0-based)
+  DATA_IVECTOR(cov);     // Covariance (0 or 1) of each group
+  PARAMETER_MATRIX(A1);  // Sigma1 = A1 * A1'
+  PARAMETER_MATRIX(A2);  // Sigma2 = A2 * A2'
+  PARAMETER_MATRIX(X);   // p x m
+  int p = X.rows();
+  matrix<Type> Sigma1 = A1 * A1.transpose();
+  matrix<Type> Sigma2 = A2 * A2.transpose();
+  Type ans = 0;
+  for (int g = 0; g < cov.size(); g++) {
+    matrix<Type> Sigma = (cov[g] == 0 ? Sigma1 : Sigma2);
+    int m = (group == g).count();
+    matrix<Type> Xg(p, m);
+    for (int j = 0, k = 0; j < X.cols(); j++)
+      if (group[j] == g) Xg.col(k++) = X.col(j);
+    if (looped) {
+      for (int k = 0; k < m; k++) {
+        vector<Type> x = Xg.col(k);
+        ans += density::MVNORM(Sigma)(x);
+      }
+    } else {
+      ans += density::MVNORM_sum(Sigma, Xg);
+    }
+  }
+  return ans;
+}
@@ -0,0 +1,31 @@
+// Taped sorting (tmbutils::order) and sample quantiles
+#include <TMB.hpp>
+
+template<class Type>
+Type objective_function<Type>::operator() ()
+{
+  DATA_VECTOR(p);       // Probabilities of the quantiles
+  DATA_VECTOR(w);       // Weights of sorted y
+  DATA_VECTOR(wq);      // Weights of the quantiles of y
+  DATA_ARRAY(wa);       // Weights of the permuted array
+  PARAMETER_VECTOR(x);  // Key with ties and NaN
+  PARAMETER_VECTOR(y);  // Key without ties
+  PARAMETER_ARRAY(a);   // Outer dimension of length x.size()
+
+  tmbutils::order<Type> ox(x);
+  vector<Type> xrank = ox.iperm;
+  vector<Type> xsort = ox(x);
+  array<Type> asort = ox(a);
+  REPORT(xrank);
+  REPORT(xsort);
+  REPORT(asort);
+
+  vector<double> pd(p.size());
+  for (int i = 0; i < p.size(); i++) pd[i] = asDouble(p[i]);
+  vector<Type> ysort = tmbutils::order<Type>(y)(y);
+  vector<Type> q = tmbutils::quantile(y, pd);
+  REPORT(ysort);
+  REPORT(q);
+
+  return (w * ysort).sum() + (wq * q).sum() + (wa * asort).sum();
+}
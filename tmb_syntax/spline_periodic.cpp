@@ -0,0 +1,14 @@
+// Periodic splinefun evaluated at parameter dependent points
+#include <TMB.hpp>
+
+template<class Type>
+Type objective_function<Type>::operator() ()
+{
+  DATA_VECTOR(x);    // Knots
+  DATA_VECTOR(y);    // Values (y[0] == y[n-1])
+  PARAMETER_VECTOR(u);
+  tmbutils::splinefun<Type> s(x, y, 1);
+  vector<Type> v = s(u);
+  REPORT(v);
+  return v.sum();
+}
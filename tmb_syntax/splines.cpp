@@ -0,0 +1,20 @@
+// splinefun with parameter dependent knot values and points
+#include <TMB.hpp>
+
+template<class Type>
+Type objective_function<Type>::operator() ()
+{
+  DATA_VECTOR(x);          // Knots
+  DATA_INTEGER(method);    // 1: periodic, 2: natural, 3: fmm
+  DATA_INTEGER(scalar);    // Evaluate point by point?
+  PARAMETER_VECTOR(y);     // Values at the knots
+  PARAMETER_VECTOR(u);     // Points
+  tmbutils::splinefun<Type> s(x, y, method);
+  Type ans = 0;
+  if (scalar) {
+    for (int i = 0; i < u.size(); i++) ans += s(u[i]);
+  } else {
+    ans = s(u).sum();
+  }
+  return ans;
+}
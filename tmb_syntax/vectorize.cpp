@@ -0,0 +1,24 @@
+// Vector atomics (exp, log, sqrt, pow, lgamma of a vector) against
+// the elementwise scalar functions.
+#include <TMB.hpp>
+
+template<class Type>
+Type objective_function<Type>::operator() ()
+{
+  DATA_INTEGER(vectorized); // Vector (1) or scalar (0) functions
+  PARAMETER_VECTOR(x);
+  PARAMETER_VECTOR(y);      // Positive
+  PARAMETER_VECTOR(u);      // Non-negative (may be zero)
+  int n = x.size();
+  vector<Type> r(n);
+  if (vectorized) {
+    r = exp(x) + log(y) + sqrt(y) + pow(y, x) + lgamma(y) +
+      pow(u, y) + pow(u, Type(2)) + pow(Type(2), x);
+  } else {
+    for (int i = 0; i < n; i++)
+      r(i) = exp(x(i)) + log(y(i)) + sqrt(y(i)) + pow(y(i), x(i)) +
+        lgamma(y(i)) + pow(u(i), y(i)) + pow(u(i), Type(2)) +
+        pow(Type(2), x(i));
+  }
+  return sum(r);
+}